@@ -0,0 +1,429 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : bench.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : Throughput of every op family of lav_mat, for inputs on
+ *                 the RAM and on the video RAM. A host case copies its
+ *                 inputs before each iteration, untimed, so the upload is
+ *                 paid every time instead of once by the mirror. Results
+ *                 go out as JSON, one object per case, to diff between two
+ *                 versions. On a CPU-only OpenCL such as pocl, select the
+ *                 device with BOOST_COMPUTE_DEFAULT_DEVICE_TYPE=CPU.
+ *
+ *                 lav_mat_bench [--quick] [--filter text] [--min-time s]
+ *                               [--out path]
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat.h>
+
+#include <functional>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <chrono>
+
+using namespace lav;
+
+struct Result
+{
+	std::string name;
+	std::string shape;
+	std::string residency;
+	size_t iterations;
+	double seconds;//Best iteration.
+	double mean;
+	double rate;
+	std::string unit;
+	Stats stats;//Per iteration.
+};
+
+static bool quick = false;
+static double min_time = 0.5;
+static std::string filter;
+static bool on_device = false;//Residency of the inputs of the cases being run.
+static std::vector<Result> results;
+
+static std::string shape_of(std::initializer_list<size_t> dims)
+{
+	std::string shape;
+
+	for (auto dim : dims)
+	{
+		shape += (shape.empty() ? "" : "x") + std::to_string(dim);
+	}
+
+	return shape;
+}
+
+//Runs op on the inputs until min_time has passed, at least 3 times after a warm up. Work is the
+//number of bytes (unit GB/s) or of floating point operations (unit GFLOP/s) of one iteration.
+static void run(const std::string& name, const std::string& shape, const std::vector<Mat>& inputs, double work, const std::string& unit, const std::function<void(const std::vector<Mat>&)>& op)
+{
+	if (!filter.empty() && name.find(filter) == std::string::npos)
+	{
+		return;
+	}
+
+	Result result{ name, shape, on_device ? "device" : "host", 0, 1e300, 0, 0, unit, {} };
+	Stats::Scope scope;
+	double total = 0;
+
+	for (size_t i = 0; i < 4 || total < min_time; ++i)
+	{
+		const std::vector<Mat> fresh = on_device ? std::vector<Mat>() : inputs;
+		const auto& args = on_device ? inputs : fresh;
+
+		Mat::queue.finish();
+
+		const auto start = std::chrono::steady_clock::now();
+
+		op(args);
+		Mat::queue.finish();
+
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if (i == 0)
+		{
+			scope = Stats::Scope();
+			continue;
+		}
+
+		result.iterations += 1;
+		result.seconds = std::min(result.seconds, seconds);
+		total += seconds;
+	}
+
+	result.mean = total / result.iterations;
+	result.rate = work / result.seconds / 1e9;
+	result.stats = scope.get();
+
+	std::cerr << name << " " << result.residency << " " << shape << ": " << result.rate << " " << unit << std::endl;
+
+	results.push_back(std::move(result));
+}
+
+static void json(std::ostream& out)
+{
+	auto&& per = [](size_t count, size_t iterations)
+	{
+		return double(count) / iterations;
+	};
+
+	out << "{\n\t\"device\": \"" << Mat::device.name() << "\",\n\t\"results\": [";
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const auto& r = results[i];
+		const auto& s = r.stats;
+
+		out << (i ? ",\n" : "\n") << "\t\t{ \"name\": \"" << r.name << "\", \"shape\": \"" << r.shape << "\", \"residency\": \"" << r.residency
+			<< "\", \"iterations\": " << r.iterations << ", \"seconds\": " << r.seconds << ", \"mean_seconds\": " << r.mean
+			<< ", \"" << (r.unit == "GB/s" ? "gb_per_s" : "gflop_per_s") << "\": " << r.rate
+			<< ", \"uploads\": " << per(s.uploads, r.iterations) << ", \"downloads\": " << per(s.downloads, r.iterations)
+			<< ", \"launches\": " << per(s.launches, r.iterations) << ", \"device_allocations\": " << per(s.device_allocations, r.iterations) << " }";
+	}
+
+	out << "\n\t]\n}" << std::endl;
+}
+
+static void bench_mul(bool upload_flag)
+{
+	std::vector<std::array<size_t, 3>> shapes = { { 256, 256, 256 }, { 1024, 1024, 1024 }, { 4096, 64, 4096 }, { 8192, 256, 16 }, { 16, 4096, 4096 } };
+
+	if (quick)
+	{
+		shapes = { { 128, 128, 128 }, { 512, 512, 512 }, { 2048, 64, 256 } };
+	}
+
+	for (auto& s : shapes)
+	{
+		const double flops = 2.0 * s[0] * s[1] * s[2];
+		const std::string shape = shape_of({ s[0], s[1], s[2] });
+
+		run("mul", shape, { randu(s[0], s[1], upload_flag), randu(s[1], s[2], upload_flag) }, flops, "GFLOP/s", [](const std::vector<Mat>& x)
+		{
+			mul(x[0], x[1]);
+		});
+
+		run("mul_trans_a", shape, { randu(s[1], s[0], upload_flag), randu(s[1], s[2], upload_flag) }, flops, "GFLOP/s", [](const std::vector<Mat>& x)
+		{
+			mul(x[0], x[1], true, false);
+		});
+
+		run("mul_trans_b", shape, { randu(s[0], s[1], upload_flag), randu(s[2], s[1], upload_flag) }, flops, "GFLOP/s", [](const std::vector<Mat>& x)
+		{
+			mul(x[0], x[1], false, true);
+		});
+	}
+}
+
+static void bench_binary(bool upload_flag)
+{
+	const std::vector<std::array<size_t, 2>> shapes = quick ? std::vector<std::array<size_t, 2>>{ { 512, 512 } } : std::vector<std::array<size_t, 2>>{ { 256, 256 }, { 2048, 2048 }, { 65536, 32 } };
+
+	for (auto& s : shapes)
+	{
+		const double n = double(s[0]) * s[1];
+		const std::string shape = shape_of({ s[0], s[1] });
+
+		run("add", shape, { randu(s[0], s[1], upload_flag), randu(s[0], s[1], upload_flag) }, 12 * n, "GB/s", [](const std::vector<Mat>& x)
+		{
+			x[0] + x[1];
+		});
+
+		run("mul_elementwise", shape, { randu(s[0], s[1], upload_flag), randu(s[0], s[1], upload_flag) }, 12 * n, "GB/s", [](const std::vector<Mat>& x)
+		{
+			x[0] * x[1];
+		});
+
+		run("add_broadcast_row", shape, { randu(s[0], s[1], upload_flag), randu(1, s[1], upload_flag) }, 8 * n, "GB/s", [](const std::vector<Mat>& x)
+		{
+			x[0] + x[1];
+		});
+
+		run("add_broadcast_col", shape, { randu(s[0], s[1], upload_flag), randu(s[0], 1, upload_flag) }, 8 * n, "GB/s", [](const std::vector<Mat>& x)
+		{
+			x[0] + x[1];
+		});
+
+		run("add_scalar", shape, { randu(s[0], s[1], upload_flag) }, 8 * n, "GB/s", [](const std::vector<Mat>& x)
+		{
+			x[0] + 1.0f;
+		});
+	}
+}
+
+static void bench_reduce(bool upload_flag)
+{
+	const std::vector<std::array<size_t, 2>> shapes = quick ? std::vector<std::array<size_t, 2>>{ { 512, 512 } } : std::vector<std::array<size_t, 2>>{ { 256, 256 }, { 2048, 2048 }, { 65536, 32 }, { 32, 65536 } };
+
+	for (auto& s : shapes)
+	{
+		const double bytes = 4.0 * s[0] * s[1];
+		const std::string shape = shape_of({ s[0], s[1] });
+		const std::vector<Mat> inputs = { randu(s[0], s[1], upload_flag) };
+
+		run("sum", shape, inputs, bytes, "GB/s", [](const std::vector<Mat>& x) { x[0].sum(); });
+		run("max", shape, inputs, bytes, "GB/s", [](const std::vector<Mat>& x) { x[0].max(); });
+		run("sum_axis_rows", shape, inputs, bytes, "GB/s", [](const std::vector<Mat>& x) { x[0].sum(true); });
+		run("sum_axis_cols", shape, inputs, bytes, "GB/s", [](const std::vector<Mat>& x) { x[0].sum(false); });
+		run("max_axis_rows", shape, inputs, bytes, "GB/s", [](const std::vector<Mat>& x) { x[0].max(true); });
+		run("max_loc_axis_cols", shape, inputs, bytes, "GB/s", [](const std::vector<Mat>& x) { x[0].max_loc(false); });
+	}
+}
+
+static void bench_layout(bool upload_flag)
+{
+	const std::vector<std::array<size_t, 2>> shapes = quick ? std::vector<std::array<size_t, 2>>{ { 512, 512 } } : std::vector<std::array<size_t, 2>>{ { 256, 256 }, { 2048, 2048 }, { 65536, 32 } };
+
+	for (auto& s : shapes)
+	{
+		const double n = double(s[0]) * s[1];
+		const std::string shape = shape_of({ s[0], s[1] });
+		const std::vector<Mat> inputs = { randu(s[0], s[1], upload_flag) };
+
+		run("t", shape, inputs, 8 * n, "GB/s", [](const std::vector<Mat>& x) { x[0].t(); });
+
+		run("sub_matrix", shape, inputs, 8 * (s[0] / 2) * (s[1] / 2), "GB/s", [s](const std::vector<Mat>& x)
+		{
+			x[0](s[0] / 4, s[0] / 4 + s[0] / 2, s[1] / 4, s[1] / 4 + s[1] / 2);
+		});
+
+		run("shuffle_rows", shape, inputs, 8 * n, "GB/s", [](const std::vector<Mat>& x) { shuffle(x[0], true); });
+		run("shuffle_cols", shape, inputs, 8 * n, "GB/s", [](const std::vector<Mat>& x) { shuffle(x[0], false); });
+	}
+}
+
+static void bench_conv4d(bool upload_flag)
+{
+	//Width, height, in channels, filter side, batch, out channels, stride.
+	std::vector<std::array<size_t, 7>> layers = { { 32, 32, 3, 3, 16, 32, 1 }, { 16, 16, 64, 3, 16, 64, 1 }, { 8, 8, 128, 3, 16, 256, 2 }, { 56, 56, 64, 1, 8, 64, 1 }, { 28, 28, 16, 5, 8, 32, 1 } };
+
+	if (quick)
+	{
+		layers = { { 16, 16, 3, 3, 4, 16, 1 }, { 8, 8, 32, 3, 4, 32, 1 } };
+	}
+
+	for (auto& l : layers)
+	{
+		for (std::string padding : { "valid", "same" })
+		{
+			const size_t nw = padding == "valid" ? (l[0] - l[3]) / l[6] + 1 : (l[0] + l[6] - 1) / l[6];
+			const size_t nh = padding == "valid" ? (l[1] - l[3]) / l[6] + 1 : (l[1] + l[6] - 1) / l[6];
+			const double flops = 2.0 * nw * nh * l[4] * l[3] * l[3] * l[2] * l[5];
+
+			run("conv4d_" + padding, shape_of({ l[4], l[1], l[0], l[2] }) + "_k" + std::to_string(l[3]) + "_o" + std::to_string(l[5]) + "_s" + std::to_string(l[6]),
+				{ randu(l[0] * l[1] * l[4], l[2], upload_flag), randu(l[3] * l[3] * l[2], l[5], upload_flag) }, flops, "GFLOP/s", [l, padding](const std::vector<Mat>& x)
+			{
+				conv4d(x[0], x[1], { l[0], l[1], l[2], l[3], l[4] }, l[6], padding);
+			});
+		}
+	}
+}
+
+static void bench_random(bool upload_flag)
+{
+	const std::vector<std::array<size_t, 2>> shapes = quick ? std::vector<std::array<size_t, 2>>{ { 512, 512 } } : std::vector<std::array<size_t, 2>>{ { 256, 256 }, { 2048, 2048 } };
+
+	for (auto& s : shapes)
+	{
+		const double bytes = 4.0 * s[0] * s[1];
+		const std::string shape = shape_of({ s[0], s[1] });
+		std::vector<Mat> inputs = { Mat(s[0], s[1], upload_flag) };
+
+		//The inputs are only there to carry the residency, fills write in place.
+		auto&& target = [](const std::vector<Mat>& x) -> Mat& { return const_cast<Mat&>(x[0]); };
+
+		run("fill_randu", shape, inputs, bytes, "GB/s", [&](const std::vector<Mat>& x) { fill_randu_(target(x)); });
+		run("fill_randn", shape, inputs, bytes, "GB/s", [&](const std::vector<Mat>& x) { fill_randn_(target(x)); });
+		run("fill_bernoulli", shape, inputs, bytes, "GB/s", [&](const std::vector<Mat>& x) { fill_bernoulli_(target(x)); });
+		run("fill_trunc_normal", shape, inputs, bytes, "GB/s", [&](const std::vector<Mat>& x) { fill_trunc_normal_(target(x)); });
+	}
+}
+
+static void bench_norm(bool upload_flag)
+{
+	const std::vector<std::array<size_t, 2>> shapes = quick ? std::vector<std::array<size_t, 2>>{ { 512, 512 } } : std::vector<std::array<size_t, 2>>{ { 256, 256 }, { 2048, 2048 }, { 65536, 32 }, { 32, 65536 } };
+
+	for (auto& s : shapes)
+	{
+		const double n = double(s[0]) * s[1];
+		const std::string shape = shape_of({ s[0], s[1] });
+		const std::vector<Mat> inputs = { randu(s[0], s[1], upload_flag), randu(s[0], s[1], upload_flag), randu(1, s[1], upload_flag), randu(1, s[1], upload_flag) };
+
+		//The running statistics are written by every iteration, they are only there to be updated.
+		Mat running_mean = Zeros(1, s[1], upload_flag);
+		Mat running_var = Ones(1, s[1], upload_flag);
+
+		run("batch_norm", shape, inputs, 8 * n, "GB/s", [&](const std::vector<Mat>& x) { batch_norm(x[0], x[2], x[3], running_mean, running_var); });
+
+		run("batch_norm_backward", shape, inputs, 12 * n, "GB/s", [](const std::vector<Mat>& x)
+		{
+			Mat dgamma, dbeta;
+			batch_norm_backward(x[1], x[0], x[2], dgamma, dbeta);
+		});
+
+		run("layer_norm", shape, inputs, 8 * n, "GB/s", [](const std::vector<Mat>& x) { layer_norm(x[0], x[2], x[3]); });
+
+		run("layer_norm_backward", shape, inputs, 12 * n, "GB/s", [](const std::vector<Mat>& x)
+		{
+			Mat dgamma, dbeta;
+			layer_norm_backward(x[1], x[0], x[2], dgamma, dbeta);
+		});
+	}
+}
+
+static void bench_io(bool upload_flag)
+{
+	const std::vector<std::array<size_t, 2>> shapes = quick ? std::vector<std::array<size_t, 2>>{ { 256, 256 } } : std::vector<std::array<size_t, 2>>{ { 256, 256 }, { 2048, 512 } };
+	const std::string txt = "lav_mat_bench.txt";
+	const std::string bin = "lav_mat_bench.bin";
+
+	for (auto& s : shapes)
+	{
+		const double bytes = 4.0 * s[0] * s[1];
+		const std::string shape = shape_of({ s[0], s[1] });
+		const std::vector<Mat> inputs = { randu(s[0], s[1], upload_flag) };
+
+		//The loads read these even when --filter skips the saves.
+		save_txt(txt, inputs[0], ' ');
+		save_bin(bin, inputs[0]);
+
+		run("save_txt", shape, inputs, bytes, "GB/s", [&](const std::vector<Mat>& x) { save_txt(txt, x[0], ' '); });
+		run("load_txt", shape, inputs, bytes, "GB/s", [&](const std::vector<Mat>&) { load_txt(txt, ' ', 0, {}, upload_flag); });
+		run("save_bin", shape, inputs, bytes, "GB/s", [&](const std::vector<Mat>& x) { save_bin(bin, x[0]); });
+		run("load_bin", shape, inputs, bytes, "GB/s", [&](const std::vector<Mat>&) { load_bin(bin, upload_flag); });
+	}
+
+	std::remove(txt.c_str());
+	std::remove(bin.c_str());
+}
+
+int main(int argc, char* argv[])
+{
+	std::string out_path;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+
+		if (arg == "--quick")
+		{
+			quick = true;
+			min_time = 0.1;
+		}
+		else if (arg == "--filter" && i + 1 < argc)
+		{
+			filter = argv[++i];
+		}
+		else if (arg == "--min-time" && i + 1 < argc)
+		{
+			min_time = std::stod(argv[++i]);
+		}
+		else if (arg == "--out" && i + 1 < argc)
+		{
+			out_path = argv[++i];
+		}
+		else
+		{
+			std::cerr << "Usage: " << argv[0] << " [--quick] [--filter text] [--min-time seconds] [--out path]" << std::endl;
+			return 1;
+		}
+	}
+
+	try
+	{
+		for (bool upload_flag : { false, true })
+		{
+			on_device = upload_flag;
+
+			bench_mul(upload_flag);
+			bench_binary(upload_flag);
+			bench_reduce(upload_flag);
+			bench_layout(upload_flag);
+			bench_conv4d(upload_flag);
+			bench_random(upload_flag);
+			bench_norm(upload_flag);
+			bench_io(upload_flag);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	if (out_path.empty())
+	{
+		json(std::cout);
+	}
+	else
+	{
+		std::ofstream out(out_path);
+
+		json(out);
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,156 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : tune.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : Runs every kernel of lav_mat over a sweep of shapes with
+ *                 the tuner on, on scratch matrices of the video RAM, and
+ *                 saves the winners. It starts from the file loaded at
+ *                 startup unless --fresh is given, so only the new shape
+ *                 classes are searched.
+ *
+ *                 lav_mat_tune [--fresh] [--quick] [--out path]
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat.h>
+
+#include <iostream>
+
+using namespace lav;
+
+static void sweep(size_t rows, size_t cols)
+{
+	Mat a = randu(rows, cols, true);
+	Mat b = randu(rows, cols, true);
+	Mat rows_indices(1, std::min<size_t>(rows, 64), true);
+	Mat cols_indices(1, std::min<size_t>(cols, 64), true);
+
+	iota_(rows_indices);
+	iota_(cols_indices);
+
+	a.t();
+	a.max(true);
+	a.max(false);
+	a.min(true);
+	a.min(false);
+	a.max_loc(true);
+	a.max_loc(false);
+	a.min_loc(true);
+	a.min_loc(false);
+	a(rows / 4, rows / 4 + rows / 2, cols / 4, cols / 4 + cols / 2);
+	vstack({ a, b });
+	hstack({ a, b });
+
+	take(a, rows_indices, true);
+	take(a, cols_indices, false);
+	put_(b, rows_indices, take(a, rows_indices, true), true);
+	scatter_add_(b, cols_indices, take(a, cols_indices, false), false);
+
+	shuffle(a, true);
+	shuffle(a, false);
+	Permutation(rows).apply_(b, true);
+	Permutation(rows).inverse();
+
+	set_diag_(b, 1);
+	fill_randu_(a);
+	fill_randn_(a);
+	fill_bernoulli_(a);
+	fill_trunc_normal_(a);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string out_path;
+	bool quick = false;
+	bool fresh = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+
+		if (arg == "--fresh")
+		{
+			fresh = true;
+		}
+		else if (arg == "--quick")
+		{
+			quick = true;
+		}
+		else if (arg == "--out" && i + 1 < argc)
+		{
+			out_path = argv[++i];
+		}
+		else
+		{
+			std::cerr << "Usage: " << argv[0] << " [--fresh] [--quick] [--out path]" << std::endl;
+			return 1;
+		}
+	}
+
+	try
+	{
+		//Creating a matrix runs Mat::init, which loads the tuning file.
+		Mat(0, 0, true);
+
+		if (fresh)
+		{
+			Tuner::clear();
+		}
+
+		Tuner::tune(true);
+
+		const size_t last = quick ? 10 : 12;
+
+		for (size_t r = 4; r <= last; r += 2)
+		{
+			for (size_t c = 4; c <= last; c += 2)
+			{
+				std::cerr << "Tuning " << (size_t(1) << r) << "x" << (size_t(1) << c) << std::endl;
+				sweep(size_t(1) << r, size_t(1) << c);
+			}
+		}
+
+		//Width, height, in channels, filter side, batch, out channels, as in lav_mat_bench.
+		for (auto& l : std::vector<std::array<size_t, 6>>{ { 32, 32, 3, 3, 16, 32 }, { 16, 16, 64, 3, 16, 64 }, { 8, 8, 128, 3, 16, 256 }, { 56, 56, 64, 1, 8, 64 }, { 28, 28, 16, 5, 8, 32 } })
+		{
+			const Mat f = randu(l[0] * l[1] * l[4], l[2], true);
+			const Mat g = randu(l[3] * l[3] * l[2], l[5], true);
+
+			for (size_t stride : { 1, 2 })
+			{
+				conv4d(f, g, { l[0], l[1], l[2], l[3], l[4] }, stride, "valid");
+				conv4d(f, g, { l[0], l[1], l[2], l[3], l[4] }, stride, "same");
+			}
+		}
+
+		Tuner::tune(false);
+		Tuner::save(out_path.empty() ? Tuner::default_path() : out_path);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	std::cerr << Tuner::size() << " entries saved" << std::endl;
+
+	return 0;
+}
\ No newline at end of file
@@ -18,7 +18,7 @@
  * Author        : (Rihothy)
  * File name     : lav_mat.h
  * Version       : 1.0
- * Last modified : 2020-4-21
+ * Last modified : 2026-10-18
  *
  * See https://github.com/rihothy/lav_mat to get source code.
  * ************************************************************************/
@@ -26,38 +26,97 @@
 #ifndef _LAV_MAT_H_
 #define _LAV_MAT_H_
 
+//Boost.Compute then keeps its program cache per thread, so its algorithms never share kernel objects.
+#ifndef BOOST_COMPUTE_THREAD_SAFE
+#define BOOST_COMPUTE_THREAD_SAFE
+#endif
+
+#ifndef BOOST_COMPUTE_HAVE_THREAD_LOCAL
+#define BOOST_COMPUTE_HAVE_THREAD_LOCAL
+#endif
+
 #include <boost/compute.hpp>
+#include <condition_variable>
 #include <initializer_list>
 #include <functional>
 #include <stdexcept>
 #include <iostream>
+#include <fstream>
+#include <cstdint>
+#include <cmath>
+#include <atomic>
+#include <array>
 #include <cstdlib>
 #include <vector>
+#include <map>
 #include <string>
+#include <utility>
+#include <memory>
+#include <thread>
+#include <mutex>
 #include <ctime>
 
 const bool _DEFAULT_ON_VIDEO_RAM_ = false;//When the matrix is created, is the datas on RAM or on VRAM.
 
 namespace lav
 {
+	//Philox4x32-10 counter-based generator. A draw of n values reserves the counters [offset, offset + n)
+	//and every value only depends on the seed and its own counter, so draws are reproducible, the same on
+	//the video RAM and on the RAM, and may be taken from several threads at once.
+	class Generator
+	{
+	public:
+
+		explicit Generator(uint64_t seed);
+		Generator(const Generator& another);
+		Generator& operator=(const Generator& another);
+
+		void manual_seed(uint64_t seed);//Also rewinds the offset to 0.
+		void set_offset(uint64_t offset);
+		uint64_t seed(void) const;
+		uint64_t offset(void) const;
+		uint64_t advance(uint64_t n);//Reserves n counters and returns the first one.
+
+		static Generator& global(void);//Seeded from std::random_device until manual_seed is called.
+
+	protected:
+
+		std::atomic<uint64_t> key;
+		std::atomic<uint64_t> counter;
+
+		static const char source[];//OpenCL versions of philox and of the float transforms.
+
+		static std::array<uint32_t, 4> philox(uint64_t key, uint64_t counter, uint32_t round);
+
+		friend class Mat;
+		friend class Permutation;
+		friend class BatchReader;
+	};
+
 	class Mat
 	{
 	protected:
 
-		bool uploaded = false;//Whether the datas is on the VRAM.
+		mutable bool uploaded = false;//Whether the datas is on the VRAM.
+		mutable bool mirrored = false;//The other buffer holds the same datas too, until the matrix is written.
+		mutable bool evicted = false;//Moved to the RAM for lack of video memory, uploaded again on next use.
+		mutable size_t pins = 0;//Number of running operations using the matrix, it cannot be evicted meanwhile.
+		mutable uint64_t last_use = 0;
+		mutable bool lazy = false;//All elements equal constant, the buffer is only filled once an operation reads it.
+		float constant = 0;
 
-		std::vector<float> c_buffer;//Datas buffer on RAM.
-		boost::compute::vector<float> g_buffer;//Datas buffer on VRAM.
+		mutable std::vector<float> c_buffer;//Datas buffer on RAM.
+		mutable boost::compute::vector<float> g_buffer;//Datas buffer on VRAM.
 
 	public:
 
 		size_t rows;
 		size_t cols;
 
-		static boost::compute::event event;
+		static thread_local boost::compute::event event;//Each thread waits on the events of its own commands.
 		static boost::compute::device device;
 		static boost::compute::context context;
-		static boost::compute::command_queue queue;
+		static boost::compute::command_queue queue;//Shared by all threads; being in order, it keeps matrices passed between threads consistent.
 		
 		explicit Mat(const size_t& rows, const size_t& cols, const std::vector<float>& vec = {}, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
 		explicit Mat(const std::string& path, char delimiter = ' ', bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
@@ -66,6 +125,11 @@ namespace lav
 		Mat(Mat&& another) noexcept;
 		Mat(const Mat& another);
 		explicit Mat(void);
+		~Mat(void);
+
+		static void set_device_budget(size_t bytes);//0 means the whole global memory of the device.
+		static size_t device_budget(void);
+		static size_t device_usage(void);
 
 		Mat t(void);
 		Mat t(void) const;
@@ -108,22 +172,79 @@ namespace lav
 		friend Mat min(const Mat& a, const Mat& b);
 
 		friend Mat shuffle(Mat& mat);
-		friend Mat shuffle(const Mat& mat);//Not yet
+		friend Mat shuffle(const Mat& mat);
 		friend Mat shuffle(Mat& mat, bool axis, bool same_as_last_time);
 		friend Mat shuffle(const Mat& mat, bool axis, bool same_as_last_time);
+		friend Mat take(Mat& mat, const Mat& indices, bool axis);
+		friend Mat take(const Mat& mat, const Mat& indices, bool axis);
+		friend void put_(Mat& dst, const Mat& indices, const Mat& src, bool axis);
+		friend void scatter_add_(Mat& dst, const Mat& indices, const Mat& src, bool axis);
 
 		friend Mat conv4d(Mat& f, Mat& g, std::vector<size_t> size, const size_t& stride, const std::string padding);
 		friend Mat conv4d(Mat& f, const Mat& g, std::vector<size_t> size, const size_t& stride, const std::string padding);
 		friend Mat conv4d(const Mat& f, Mat& g, std::vector<size_t> size, const size_t& stride, const std::string padding);
 		friend Mat conv4d(const Mat& f, const Mat& g, std::vector<size_t> size, const size_t& stride, const std::string padding);
 
+		friend Mat softmax(const Mat& mat, bool axis);
+		friend Mat log_softmax(const Mat& mat, bool axis);
+		friend Mat softmax_grad(const Mat& y, const Mat& dy, bool axis);
+		friend Mat log_softmax_grad(const Mat& y, const Mat& dy, bool axis);
+		friend Mat softmax_cross_entropy(const Mat& logits, const Mat& labels);
+		friend Mat softmax_cross_entropy(const Mat& logits, const Mat& labels, Mat& grad);
+
+		friend Mat relu(const Mat& mat);
+		friend Mat leaky_relu(const Mat& mat, float alpha);
+		friend Mat elu(const Mat& mat, float alpha);
+		friend Mat sigmoid(const Mat& mat);
+		friend Mat tanh(const Mat& mat);
+		friend Mat gelu(const Mat& mat);
+		friend Mat softplus(const Mat& mat);
+		friend Mat swish(const Mat& mat);
+		friend Mat relu_backward(const Mat& grad, const Mat& x);
+		friend Mat leaky_relu_backward(const Mat& grad, const Mat& x, float alpha);
+		friend Mat elu_backward(const Mat& grad, const Mat& x, float alpha);
+		friend Mat sigmoid_backward(const Mat& grad, const Mat& y);
+		friend Mat tanh_backward(const Mat& grad, const Mat& y);
+		friend Mat gelu_backward(const Mat& grad, const Mat& x);
+		friend Mat softplus_backward(const Mat& grad, const Mat& x);
+		friend Mat swish_backward(const Mat& grad, const Mat& x);
+
+		friend Mat where(const Mat& mask, const Mat& a, const Mat& b);
+		friend Mat where(const Mat& mask, const Mat& a, float b);
+		friend Mat where(const Mat& mask, float a, const Mat& b);
+		friend void masked_fill_(Mat& mat, const Mat& mask, float value);
+		friend bool any(const Mat& mat);
+		friend bool all(const Mat& mat);
+		friend size_t count_nonzero(const Mat& mat);
+
+		friend Mat sort(const Mat& mat, bool axis, bool descending);
+		friend Mat argsort(const Mat& mat, bool axis, bool descending);
+		friend Mat topk(const Mat& mat, size_t k, bool axis, bool largest);
+		friend Mat topk(const Mat& mat, size_t k, Mat& indices, bool axis, bool largest);
+
+		friend Mat mean_var(const Mat& mat, Mat& var, bool axis);
+		friend Mat batch_norm(const Mat& x, const Mat& gamma, const Mat& beta, Mat& running_mean, Mat& running_var, bool training, float momentum, float eps);
+		friend Mat batch_norm_backward(const Mat& dy, const Mat& x, const Mat& gamma, Mat& dgamma, Mat& dbeta, float eps);
+		friend Mat layer_norm(const Mat& x, const Mat& gamma, const Mat& beta, float eps);
+		friend Mat layer_norm_backward(const Mat& dy, const Mat& x, const Mat& gamma, Mat& dgamma, Mat& dbeta, float eps);
+		friend Mat rms_norm(const Mat& x, const Mat& gamma, float eps);
+		friend Mat rms_norm_backward(const Mat& dy, const Mat& x, const Mat& gamma, Mat& dgamma, float eps);
+
 		friend Mat Eyes(const size_t& n, bool upload_flag);
+		friend Mat Full(const size_t& rows, const size_t& cols, float value, bool upload_flag);
 		friend Mat Ones(const size_t& rows, const size_t& cols, bool upload_flag);
 		friend Mat Zeros(const size_t& rows, const size_t& cols, bool upload_flag);
+		friend void fill_(Mat& mat, float value);
+		friend void iota_(Mat& mat, float start, float step);
+		friend void set_diag_(Mat& mat, float value);
 		friend Mat randn(const size_t& rows, const size_t& cols, bool upload_flag);
 		friend Mat randu(const size_t& rows, const size_t& cols, bool upload_flag);
 		friend Mat randn(const size_t& rows, const size_t& cols, float mean, float sigma, bool upload_flag);
 		friend Mat randu(const size_t& rows, const size_t& cols, float lower, float upper, bool upload_flag);
+		friend void fill_randu_(Mat& mat, float lower, float upper, Generator& generator);
+		friend void fill_randn_(Mat& mat, float mean, float sigma, Generator& generator);
+		friend void fill_bernoulli_(Mat& mat, float p, Generator& generator);
+		friend void fill_trunc_normal_(Mat& mat, float mean, float sigma, float lower, float upper, Generator& generator);
 
 		friend Mat mul(Mat& a, Mat& b, bool trans_a, bool trans_b);
 		friend Mat mul(Mat& a, const Mat& b, bool trans_a, bool trans_b);
@@ -211,16 +332,20 @@ namespace lav
 		friend Mat operator!=(Mat& a, const Mat& b);
 		friend Mat operator!=(const Mat& a, Mat& b);
 		friend Mat operator!=(const Mat& a, const Mat& b);
+		friend Mat operator&(const Mat& a, const Mat& b);//Logical and of two masks, nonzero is true.
+		friend Mat operator|(const Mat& a, const Mat& b);
+		friend Mat operator!(const Mat& mat);
 
 		Mat row(size_t row);
 		Mat row(size_t row) const;
 		Mat col(size_t col);
 		Mat col(size_t col) const;
 		Mat& reshape(size_t rows, size_t cols);
+		void reserve(size_t rows, size_t cols);//Room for rows * cols elements, so that appends do not reallocate.
 		void push_back(const Mat& another);
 		void push_back(const std::initializer_list<float>& vec);
-		//void push_right(const Mat& another);//Too fucking slow, don't use it.
-		//void push_right(const std::initializer_list<float>& vec);//Too fucking slow, don't use it.
+		void push_right(const Mat& another);//Rewrites the matrix once, prefer hstack for many columns.
+		void push_right(const std::initializer_list<float>& vec);
 
 		Mat& operator=(Mat&& another) noexcept;
 		Mat& operator=(const Mat& another);
@@ -234,6 +359,25 @@ namespace lav
 		friend std::ofstream& operator<<(std::ofstream& out, Mat& mat);
 		friend std::ofstream& operator<<(std::ofstream& out, const Mat& mat);
 
+		friend Mat load_txt(const std::string& path, char delimiter, size_t skip_rows, const std::vector<size_t>& usecols, bool upload_flag);
+		friend void save_txt(std::ostream& out, const Mat& mat, char delimiter);
+		friend void save_txt(const std::string& path, const Mat& mat, char delimiter);
+		friend Mat load_bin(const std::string& path, bool upload_flag);
+		friend void save_bin(const std::string& path, const Mat& mat);
+		friend Mat load_npy(const std::string& path, bool upload_flag);
+		friend void save_npy(const std::string& path, const Mat& mat);
+		friend std::map<std::string, Mat> load_npz(const std::string& path, bool upload_flag);
+		friend void save_npz(const std::string& path, const std::map<std::string, Mat>& mats);
+		friend Mat vstack(const std::vector<Mat>& mats);
+		friend Mat hstack(const std::vector<Mat>& mats);
+		friend Mat concat(const std::vector<Mat>& mats, bool axis);
+		friend class BatchReader;
+		friend class Permutation;
+		friend class Dispatcher;
+		friend class Graph;
+		friend class Tape;
+		friend class SparseMat;
+
 		friend Mat exp(const Mat& mat);
 		friend Mat abs(const Mat& mat);
 		friend Mat log(const Mat& mat);
@@ -246,9 +390,95 @@ namespace lav
 
 		void upload(void);
 		void download(void);
+		void offload(void);//Uploads, unless the dispatcher would keep an elementwise op over the matrix on the host.
+		void materialize(bool fill = true) const;//Gives a lazy matrix its buffer; fill = false only allocates it.
+		void invalidate(void) const;//Called before the datas are written, the other buffer goes stale.
+		const boost::compute::vector<float>& device_buffer(void) const;//g_buffer, first mirroring c_buffer into it if the datas is on RAM.
+		const std::vector<float>& host_buffer(void) const;//c_buffer, first mirroring g_buffer into it if the datas is on VRAM.
+		void allocate(size_t size) const;//Sizes g_buffer, a new buffer is allocated exactly; the datas are not kept.
+		void grow(size_t size);//Resizes g_buffer keeping the datas, with geometric growth.
+		void track(void) const;//Records the video memory held by g_buffer after it has changed.
+		void untrack(void) const;
+		void evict(void) const;
+		void restore(void) const;
+
+		static void make_room(size_t bytes, const Mat* keep = nullptr);//Evicts idle matrices but keep until bytes more fit in the budget.
+
+		//Pins matrices for the duration of an operation, fills lazy ones and brings evicted ones back.
+		class Use
+		{
+		public:
+
+			explicit Use(std::initializer_list<std::reference_wrapper<const Mat>> mats, bool fill = true);
+			Use(const Use& another) = delete;
+			~Use(void);
+
+		protected:
+
+			std::vector<std::reference_wrapper<const Mat>> mats;
+		};
 
 		static std::function<void(void)> init;
 
+		static Mat from_npy(const char* data, size_t size, const std::string& name, bool upload_flag);
+		static void scatter(Mat& dst, const Mat& indices, const Mat& src, bool axis, bool add);
+		static Mat stack(const std::vector<const Mat*>& mats, bool axis);
+		static void fill_random(Mat& mat, Generator& generator, size_t type, float a, float b, float c, float d);
+		static Mat im2col(const Mat& f, const std::vector<size_t>& size, size_t stride, bool valid_padding);//One row per output pixel, conv4d multiplies it by g.
+		static Mat col2im(const Mat& cols, const std::vector<size_t>& size, size_t stride, bool valid_padding);//Sums the patches back onto the pixels they were read from.
+		static Mat broadcast(const Mat& mat, size_t rows, size_t cols);//A row or a column repeated to rows x cols on the VRAM.
+		static Mat softmax_op(const Mat& mat, bool axis, bool log_flag);
+		static Mat activate(const Mat& mat, size_t type, float alpha);
+		static Mat activate_backward(const Mat& grad, const Mat& mat, size_t type, float alpha);
+		static Mat select(const Mat& mask, const Mat* a, float a_value, const Mat* b, float b_value);//A null operand is the constant value.
+		static bool find(const Mat& mat, bool zero);//Whether an element is zero, or nonzero, stopping at the first one.
+		static void sort_lines(const Mat& mat, size_t k, bool axis, bool descending, Mat* values, Mat* indices);//The first k of every sorted line.
+		static Mat layer_norm_op(const Mat& x, const Mat& gamma, const Mat* beta, float eps);//rms_norm without a beta.
+		static Mat layer_norm_backward_op(const Mat& dy, const Mat& x, const Mat& gamma, Mat& dgamma, Mat* dbeta, float eps);
+		static Mat softmax_grad_op(const Mat& y, const Mat& dy, bool axis, bool log_flag);
+		static Mat cross_entropy_op(const Mat& logits, const Mat& labels, Mat* grad);
+
+		static boost::compute::program build(const std::string& source);
+		static void enqueue(const char* name, boost::compute::kernel& kernel, size_t dims, const size_t* global, size_t bytes, const size_t* local = nullptr);//A local size given is used as is, not tuned.
+		static void write(boost::compute::vector<float>& dst, const float* src, size_t n);//Blocking copy from the RAM.
+		static void read(const boost::compute::vector<float>& src, float* dst, size_t n);//Blocking copy to the RAM.
+
+		//Sets the arguments in order, runs the kernel over the global range and waits for it.
+		template<typename... Args>
+		static void launch(const char* name, boost::compute::kernel& kernel, size_t global, const Args&... args);
+
+		template<typename... Args>
+		static void launch(const char* name, boost::compute::kernel& kernel, const std::array<size_t, 2>& global, const Args&... args);
+
+		//Runs groups work groups of exactly local work items, for kernels that reduce in local memory.
+		template<typename... Args>
+		static void launch_groups(const char* name, boost::compute::kernel& kernel, size_t groups, size_t local, const Args&... args);
+
+		static size_t group_size(const boost::compute::kernel& kernel, size_t limit = 256);//The largest power of two up to limit the kernel runs in one group.
+		static size_t tile_rows(size_t rows, size_t cols);//Rows per tile when columns are reduced by tiles of rows, then by tile.
+
+		template<typename T>
+		static size_t bytes_of(const T& arg);
+
+		template<typename T>
+		static size_t bytes_of(const boost::compute::vector<T>& arg);
+
+		template<typename T>
+		static float constant_op(T&& op, float a);
+
+		template<typename T>
+		static float constant_op(T&& op, float a, float b);
+
+		//The same ops evaluated on the host, for the calls the dispatcher keeps there.
+		template<typename T>
+		static float host_op(const T& op, float a, float b = 0);
+		static float host_op(const boost::compute::exp<float>& op, float a, float b = 0);
+		static float host_op(const boost::compute::fabs<float>& op, float a, float b = 0);
+		static float host_op(const boost::compute::log<float>& op, float a, float b = 0);
+		static float host_op(const boost::compute::log2<float>& op, float a, float b = 0);
+		static float host_op(const boost::compute::log10<float>& op, float a, float b = 0);
+		static float host_op(const boost::compute::sqrt<float>& op, float a, float b = 0);
+
 		template<typename T>
 		static Mat unary_op(const Mat& mat, T&& op);
 
@@ -258,24 +488,561 @@ namespace lav
 
 	Mat shuffle(Mat& mat, bool axis, bool same_as_last_time = false);
 	Mat shuffle(const Mat& mat, bool axis, bool same_as_last_time = false);
+	Mat take(Mat& mat, const Mat& indices, bool axis = true);
+	Mat take(const Mat& mat, const Mat& indices, bool axis = true);
+	void put_(Mat& dst, const Mat& indices, const Mat& src, bool axis = true);
+	void scatter_add_(Mat& dst, const Mat& indices, const Mat& src, bool axis = true);
 
 	Mat conv4d(Mat& f, Mat& g, std::vector<size_t> size, const size_t& stride = 1, const std::string padding = "valid");
 	Mat conv4d(Mat& f, const Mat& g, std::vector<size_t> size, const size_t& stride = 1, const std::string padding = "valid");
 	Mat conv4d(const Mat& f, Mat& g, std::vector<size_t> size, const size_t& stride = 1, const std::string padding = "valid");
 	Mat conv4d(const Mat& f, const Mat& g, std::vector<size_t> size, const size_t& stride = 1, const std::string padding = "valid");
 
+	Mat softmax(const Mat& mat, bool axis = true);//axis = true normalizes each row, false each column.
+	Mat log_softmax(const Mat& mat, bool axis = true);
+	Mat softmax_grad(const Mat& y, const Mat& dy, bool axis = true);//y is the output of softmax and dy the gradient over it.
+	Mat log_softmax_grad(const Mat& y, const Mat& dy, bool axis = true);//y is the output of log_softmax.
+	Mat softmax_cross_entropy(const Mat& logits, const Mat& labels);//A loss per row; labels are a column of class indices or a distribution per row.
+	Mat softmax_cross_entropy(const Mat& logits, const Mat& labels, Mat& grad);//Also writes the gradient over logits in the same pass.
+
+	Mat relu(const Mat& mat);
+	Mat leaky_relu(const Mat& mat, float alpha = 0.01f);
+	Mat elu(const Mat& mat, float alpha = 1);
+	Mat sigmoid(const Mat& mat);
+	Mat tanh(const Mat& mat);
+	Mat gelu(const Mat& mat);//The tanh approximation.
+	Mat softplus(const Mat& mat);
+	Mat swish(const Mat& mat);
+	Mat relu_backward(const Mat& grad, const Mat& x);//The gradient over the input x given the gradient over the output.
+	Mat leaky_relu_backward(const Mat& grad, const Mat& x, float alpha = 0.01f);
+	Mat elu_backward(const Mat& grad, const Mat& x, float alpha = 1);
+	Mat sigmoid_backward(const Mat& grad, const Mat& y);//Takes the output y, which is all the derivative needs.
+	Mat tanh_backward(const Mat& grad, const Mat& y);//Takes the output y too.
+	Mat gelu_backward(const Mat& grad, const Mat& x);
+	Mat softplus_backward(const Mat& grad, const Mat& x);
+	Mat swish_backward(const Mat& grad, const Mat& x);
+
+	Mat where(const Mat& mask, const Mat& a, const Mat& b);//a where mask is nonzero, b elsewhere, in one pass.
+	Mat where(const Mat& mask, const Mat& a, float b);
+	Mat where(const Mat& mask, float a, const Mat& b);
+	void masked_fill_(Mat& mat, const Mat& mask, float value);
+	bool any(const Mat& mat);//Stops at the first nonzero element, only a flag is read back.
+	bool all(const Mat& mat);//Stops at the first zero.
+	size_t count_nonzero(const Mat& mat);
+
+	Mat sort(const Mat& mat, bool axis = true, bool descending = false);//axis = true sorts each row, false each column.
+	Mat argsort(const Mat& mat, bool axis = true, bool descending = false);//The indices, as floats like the ones take reads.
+	Mat topk(const Mat& mat, size_t k, bool axis = true, bool largest = true);//The best k of each row, best first.
+	Mat topk(const Mat& mat, size_t k, Mat& indices, bool axis = true, bool largest = true);//Also gives their indices.
+
+	Mat mean_var(const Mat& mat, Mat& var, bool axis = true);//The mean of each row, or column, and its variance in var, in a single pass.
+	Mat batch_norm(const Mat& x, const Mat& gamma, const Mat& beta, Mat& running_mean, Mat& running_var, bool training = true, float momentum = 0.1f, float eps = 1e-5f);//Normalizes each column, by the batch statistics while training, which also updates the running ones, by the running ones otherwise.
+	Mat batch_norm_backward(const Mat& dy, const Mat& x, const Mat& gamma, Mat& dgamma, Mat& dbeta, float eps = 1e-5f);//The gradient over x in training mode; the statistics are recomputed from x.
+	Mat layer_norm(const Mat& x, const Mat& gamma, const Mat& beta, float eps = 1e-5f);//Normalizes each row; gamma and beta have one value per column.
+	Mat layer_norm_backward(const Mat& dy, const Mat& x, const Mat& gamma, Mat& dgamma, Mat& dbeta, float eps = 1e-5f);
+	Mat rms_norm(const Mat& x, const Mat& gamma, float eps = 1e-5f);
+	Mat rms_norm_backward(const Mat& dy, const Mat& x, const Mat& gamma, Mat& dgamma, float eps = 1e-5f);
+
 	Mat Eyes(const size_t& n, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
+	Mat Full(const size_t& rows, const size_t& cols, float value, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
 	Mat Ones(const size_t& rows, const size_t& cols, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
 	Mat Zeros(const size_t& rows, const size_t& cols, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
+	void fill_(Mat& mat, float value);
+	void iota_(Mat& mat, float start = 0, float step = 1);
+	void set_diag_(Mat& mat, float value);
 	Mat randn(const size_t& rows, const size_t& cols, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
 	Mat randu(const size_t& rows, const size_t& cols, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
 	Mat randn(const size_t& rows, const size_t& cols, float mean, float sigma, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
 	Mat randu(const size_t& rows, const size_t& cols, float lower, float upper, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
+	void fill_randu_(Mat& mat, float lower = 0, float upper = 1, Generator& generator = Generator::global());
+	void fill_randn_(Mat& mat, float mean = 0, float sigma = 1, Generator& generator = Generator::global());
+	void fill_bernoulli_(Mat& mat, float p = 0.5f, Generator& generator = Generator::global());
+	void fill_trunc_normal_(Mat& mat, float mean = 0, float sigma = 1, float lower = -2, float upper = 2, Generator& generator = Generator::global());//Redraws outside [lower, upper].
 
 	Mat mul(Mat& a, Mat& b, bool trans_a = false, bool trans_b = false);
 	Mat mul(Mat& a, const Mat& b, bool trans_a = false, bool trans_b = false);
 	Mat mul(const Mat& a, Mat& b, bool trans_a = false, bool trans_b = false);
 	Mat mul(const Mat& a, const Mat& b, bool trans_a = false, bool trans_b = false);
+
+	Mat vstack(const std::vector<Mat>& mats);
+	Mat hstack(const std::vector<Mat>& mats);
+	Mat concat(const std::vector<Mat>& mats, bool axis = true);//axis = true stacks the rows, false the columns.
+
+	Mat load_txt(const std::string& path, char delimiter = ' ', size_t skip_rows = 0, const std::vector<size_t>& usecols = {}, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
+	void save_txt(std::ostream& out, const Mat& mat, char delimiter = ',');
+	void save_txt(const std::string& path, const Mat& mat, char delimiter = ',');
+	Mat load_bin(const std::string& path, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
+	void save_bin(const std::string& path, const Mat& mat);
+	Mat load_npy(const std::string& path, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
+	void save_npy(const std::string& path, const Mat& mat);
+	std::map<std::string, Mat> load_npz(const std::string& path, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
+	void save_npz(const std::string& path, const std::map<std::string, Mat>& mats);
+
+	//Compressed sparse rows: the nonzeros of row r are values[row_ptr[r], row_ptr[r + 1]), sorted by their
+	//columns col_idx, so memory and work scale with the nonzeros. Coordinates, in any order and with
+	//duplicates summed, are the way to build one. Like Mat the datas are either on the RAM or on the VRAM,
+	//and an op runs where the sparse matrix is, reading its dense operand from there. Indices are 32 bits.
+	class SparseMat
+	{
+	public:
+
+		size_t rows;
+		size_t cols;
+
+		explicit SparseMat(void);
+		explicit SparseMat(size_t rows, size_t cols, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);//All zeros.
+		explicit SparseMat(size_t rows, size_t cols, const std::vector<size_t>& row_indices, const std::vector<size_t>& col_indices, const std::vector<float>& values, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);
+		explicit SparseMat(const Mat& dense, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);//Keeps the nonzeros.
+		SparseMat(const SparseMat& another);
+		SparseMat(SparseMat&& another) = default;
+		SparseMat& operator=(const SparseMat& another);
+		SparseMat& operator=(SparseMat&& another) = default;
+
+		size_t nnz(void) const;
+		bool on_device(void) const;
+		void upload(void);
+		void download(void);
+		Mat to_dense(void) const;
+		void to_coo(std::vector<size_t>& row_indices, std::vector<size_t>& col_indices, std::vector<float>& values) const;
+
+		friend SparseMat sparse_t(const SparseMat& mat);
+		friend Mat spmv(const SparseMat& a, const Mat& x);
+		friend Mat spmm(const SparseMat& a, const Mat& b);
+		friend SparseMat load_mtx(const std::string& path, bool upload_flag);
+		friend void save_mtx(const std::string& path, const SparseMat& mat);
+
+	protected:
+
+		bool uploaded = false;
+
+		std::vector<uint32_t> row_ptr;
+		std::vector<uint32_t> col_idx;
+		std::vector<float> values;
+
+		boost::compute::vector<cl_uint> g_row_ptr;
+		boost::compute::vector<cl_uint> g_col_idx;
+		boost::compute::vector<float> g_values;
+
+		void build(const std::vector<size_t>& row_indices, const std::vector<size_t>& col_indices, const std::vector<float>& values);
+
+		static Mat product(const SparseMat& a, const Mat& b, size_t k);//a times the datas of b read as a.cols x k.
+		static SparseMat transpose(const SparseMat& mat);
+	};
+
+	SparseMat sparse_t(const SparseMat& mat);
+	Mat spmv(const SparseMat& a, const Mat& x);//x has a.cols elements, as a row or a column; the result is a column.
+	Mat spmm(const SparseMat& a, const Mat& b);
+	Mat mul(const SparseMat& a, const Mat& b);
+	Mat mul(const Mat& a, const SparseMat& b);
+	SparseMat load_mtx(const std::string& path, bool upload_flag = _DEFAULT_ON_VIDEO_RAM_);//Matrix Market coordinate files.
+	void save_mtx(const std::string& path, const SparseMat& mat);
+
+	//Reads a text or binary matrix file batch_rows rows at a time. A background thread reads ahead
+	//into depth host buffers (pinned when uploading), and the upload of the next batch is started on a
+	//separate queue before the current one is handed out, so it overlaps with the work on that batch.
+	class BatchReader
+	{
+	public:
+
+		size_t rows;
+		size_t cols;
+		size_t batch_rows;
+
+		explicit BatchReader(const std::string& path, size_t batch_rows, char delimiter = ' ', bool upload_flag = _DEFAULT_ON_VIDEO_RAM_, bool shuffle_flag = false, size_t depth = 2);
+		BatchReader(const BatchReader& another) = delete;
+		BatchReader& operator=(const BatchReader& another) = delete;
+		~BatchReader(void);
+
+		size_t batches(void) const;
+		bool next(Mat& batch);//Returns false when the epoch is over.
+		void reset(void);//Starts a new epoch, in a new random batch order if shuffle_flag is set.
+
+	protected:
+
+		struct Slot
+		{
+			boost::compute::buffer pinned;
+			std::vector<float> buffer;
+			float* data = nullptr;
+			size_t rows = 0;
+		};
+
+		std::string path;
+		char delimiter;
+		bool binary;
+		bool upload_flag;
+		bool shuffle_flag;
+
+		std::vector<size_t> offsets;//Byte offset of every batch in the file.
+		std::vector<size_t> order;
+		std::vector<Slot> slots;
+
+		std::thread reader;
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::exception_ptr error;
+		size_t produced = 0;
+		size_t consumed = 0;
+		bool stop = false;
+
+		Mat pending;
+		bool prefetched = false;
+		boost::compute::event pending_event;
+		boost::compute::command_queue transfer;
+
+		void start(void);
+		void finish(void);
+		void read(void);
+		void prefetch(void);
+	};
+
+	//A random permutation of [0, size). Each index gets a Philox4x32-10 key on the device and the indices
+	//are sorted by key, so the same seed always gives the same order and nothing is built on the host.
+	class Permutation
+	{
+	public:
+
+		size_t size;
+		uint64_t seed;
+
+		explicit Permutation(size_t size);
+		explicit Permutation(size_t size, uint64_t seed);
+
+		Mat indices(void) const;//1 x size, as floats like max_loc.
+		Permutation inverse(void) const;
+
+		Mat apply(const Mat& mat, bool axis = true) const;
+		std::pair<Mat, Mat> apply(const Mat& a, const Mat& b) const;//Permutes the rows of both in a single launch.
+		void apply_(Mat& mat, bool axis = true) const;//In place, through a strip of a few columns (or rows).
+
+		friend Mat shuffle(const Mat& mat);
+		friend Mat shuffle(const Mat& mat, bool axis, bool same_as_last_time);
+
+	protected:
+
+		boost::compute::vector<cl_uint> g_indices;
+
+		explicit Permutation(void);
+
+		static uint64_t draw_seed(void);//From the global generator, so that shuffles follow manual_seed.
+
+		Mat gather(const Mat& mat, size_t rows, size_t cols, bool axis) const;
+	};
+
+	//Opt-in timeline of the work sent to the device. While it is enabled, every kernel launched by
+	//lav_mat, every GEMM and every copy between c_buffer and g_buffer is recorded with the queued,
+	//submit, start and end times of its event, next to the host spans, and save_trace writes them
+	//all as Chrome trace JSON, which chrome://tracing and Perfetto open.
+	class Profiler
+	{
+	public:
+
+		struct Record
+		{
+			std::string name;
+			std::string category;//kernel, gemm, transfer, device (all the commands of a span) or host.
+			std::string shape;
+			size_t bytes;
+			size_t thread;
+			uint64_t queued, submit, start, end;//Nanoseconds, on the host clock.
+		};
+
+		//Times a block on the host. While profiling, the commands it enqueues are timed as one more
+		//record, so the algorithms of Boost.Compute are covered as well; it then waits for them.
+		class Span
+		{
+		public:
+
+			//The shape is rows x cols, or rows alone, and is only formatted while profiling; name must outlive the span.
+			explicit Span(const char* name, size_t rows = SIZE_MAX, size_t cols = SIZE_MAX);
+			Span(const Span& another) = delete;
+			~Span(void);
+
+		protected:
+
+			const char* name;
+			size_t rows;
+			size_t cols;
+			uint64_t start;//0 when profiling was off as the span began.
+			boost::compute::event marker;
+		};
+
+		static void enable(bool flag = true);//Recreates the shared queue with or without profiling, call it while no other thread runs commands.
+		static bool enabled(void);
+		static void clear(void);
+		static std::vector<Record> records(void);
+		static void save_trace(const std::string& path);
+		static void record(const std::string& name, const std::string& category, const std::string& shape, size_t bytes, const boost::compute::event& event);
+
+	protected:
+
+		static std::atomic<bool> flag;
+		static std::atomic<int64_t> offset;//Host clock minus device clock.
+
+		static uint64_t now(void);
+		static size_t thread(void);
+		static void add(Record record);
+	};
+
+	//Counters of the work lav_mat does, kept for the whole process. Stats::get() reads them and
+	//Stats::reset() zeroes them; a Stats::Scope gives the counts of one region of code, so that a test
+	//can check, say, that an inference step transfers nothing between the RAM and the video RAM.
+	struct Stats
+	{
+		size_t uploads = 0;
+		size_t upload_bytes = 0;
+		size_t downloads = 0;
+		size_t download_bytes = 0;
+		size_t device_allocations = 0;
+		size_t device_peak = 0;//Most bytes held on the video RAM at once.
+		size_t host_allocations = 0;//Of c_buffer.
+		size_t host_peak = 0;
+		size_t launches = 0;
+		size_t builds = 0;//Programs of lav_mat, Boost.Compute keeps its own in a cache.
+		size_t gemms = 0;
+		std::map<std::string, size_t> launches_per_op;
+
+		Stats operator-(const Stats& another) const;//The counts in between, the peaks are the newer ones.
+
+		static Stats get(void);
+		static void reset(void);//The peaks start again from what is held right now.
+
+		class Scope;
+
+		static void count_transfer(bool upload, size_t bytes);
+		static void count_memory(bool device, bool allocation, size_t usage);
+		static void count_launch(const char* name);
+		static void count_build(void);
+		static void count_gemm(void);
+	};
+
+	class Stats::Scope
+	{
+	public:
+
+		explicit Scope(void);
+
+		Stats get(void) const;//The counts since the scope was opened.
+
+	protected:
+
+		Stats start;
+	};
+
+	//Picks the local size of the kernels of lav_mat. The winners are kept per device, kernel and shape
+	//class (the highest power of two of each global size) in a text file, which is loaded at startup
+	//from $LAV_MAT_TUNING_FILE, else lav_mat_tuning.txt; launches without one are left to the driver.
+	//While tuning, a launch with no winner yet times every candidate first and so runs its kernel many
+	//times over its own arguments: only meant for scratch matrices, as in the sweep of lav_mat_tune.
+	class Tuner
+	{
+	public:
+
+		static void tune(bool flag = true);
+		static bool tuning(void);
+		static void clear(void);
+		static size_t size(void);//Number of winners.
+		static bool load(const std::string& path);//Returns false when there is no such file.
+		static void save(const std::string& path);
+		static std::string default_path(void);
+
+		static bool local_size(const char* name, boost::compute::kernel& kernel, size_t dims, const size_t* global, size_t* local);//False leaves it to the driver.
+
+	protected:
+
+		static std::atomic<bool> flag;
+
+		static std::string key(const char* name, const boost::compute::kernel& kernel, size_t dims, const size_t* global);
+		static std::vector<std::array<size_t, 2>> candidates(const boost::compute::kernel& kernel, size_t dims, const size_t* global);
+		static std::array<size_t, 2> search(boost::compute::kernel& kernel, size_t dims, const size_t* global);
+	};
+
+	//Chooses whether an elementwise op, a full reduction or a mul runs on the RAM or on the video RAM.
+	//Each side costs its work at its own throughput, plus the copies of the operands it does not hold
+	//yet, plus one launch for the device; the result stays on the side that computed it. The model is
+	//measured the first time it is needed, unless set_model gave one. The policy, whose default comes
+	//from $LAV_MAT_DISPATCH (auto, host or device), can force one side for every call.
+	class Dispatcher
+	{
+	public:
+
+		enum class Policy { automatic, host, device };
+
+		struct Model
+		{
+			double launch;//Seconds to run an empty kernel and wait for it.
+			double upload;//Bytes per second.
+			double download;
+			double device_rate;//Elements per second of an elementwise kernel.
+			double host_rate;
+			double device_flops;//Multiply-adds per second of mul.
+			double host_flops;
+		};
+
+		static void set_policy(Policy policy);
+		static Policy policy(void);
+		static void set_model(const Model& model);
+		static Model model(void);
+
+		static bool on_host(size_t work, std::initializer_list<std::reference_wrapper<const Mat>> mats, bool gemm = false);
+
+	protected:
+
+		static std::atomic<int> mode;
+
+		static Model calibrate(void);
+	};
+
+	//Records the device work of a step and sends it again. The constructor runs step once, on copies of
+	//the inputs on the video RAM, and every kernel launch, GEMM, elementwise op, copy and fill it sends
+	//is recorded with its arguments bound to a kernel object of its own, while the graph holds the
+	//buffers of all the intermediates. replay copies new inputs into the same buffers and sends the whole
+	//step again, with no checks, allocations or waits in between. The other matrices the step reads are
+	//bound by the buffers they had during the capture, so they must stay on the video RAM and only be
+	//updated in place; ops that bring a result back to the RAM, like max(void), cannot be captured.
+	class Graph
+	{
+	public:
+
+		explicit Graph(const std::vector<Mat>& inputs, const std::function<std::vector<Mat>(const std::vector<Mat>&)>& step);
+		Graph(const Graph& another) = delete;
+		Graph& operator=(const Graph& another) = delete;
+
+		const std::vector<Mat>& replay(const std::vector<Mat>& inputs);//Waits for the step and returns the outputs.
+		const std::vector<Mat>& outputs(void) const;
+		size_t size(void) const;//Number of recorded commands.
+
+		static bool capturing(void);
+		static void unsupported(const char* name);//Throws while capturing.
+		static void record(const std::function<void(void)>& command);
+		static void record_copy(const boost::compute::vector<float>& src, size_t src_offset, const boost::compute::vector<float>& dst, size_t dst_offset, size_t n);
+		static void record_fill(const boost::compute::vector<float>& dst, float value);
+
+		template<typename... Args>
+		static void record(const char* name, const boost::compute::kernel& kernel, size_t dims, const size_t* global, const size_t* local, const Args&... args);
+
+		template<typename T, typename... Iterators>
+		static void record_transform(const T& op, const Iterators&... iterators);
+
+		template<typename T>
+		static auto keep(const T& op);//A copy of op that holds no reference, to be called on replay.
+
+	protected:
+
+		std::vector<Mat> arguments;
+		std::vector<Mat> results;
+		std::vector<std::function<void(void)>> commands;
+		std::vector<boost::compute::buffer> buffers;//Keeps the intermediates alive.
+		std::vector<std::unique_ptr<Mat::Use>> uses;
+
+		static thread_local Graph* current;
+
+		template<typename T>
+		void hold(const T& arg);
+
+		template<typename T>
+		void hold(const boost::compute::vector<T>& arg);
+
+		template<typename T, size_t... I>
+		static auto keep(const T& op, std::index_sequence<I...>);
+	};
+
+	//Records a computation as nodes and runs it forward then backward, from the loss seeded with ones.
+	//Before running, plan walks the schedule once: every activation is freed right after the last step,
+	//forward or backward, that reads it, every gradient after the backward step that consumes it, and
+	//the gradient of an elementwise pass-through (add, sub, neg, scale, shift) is reused in place for
+	//its operand instead of being copied. Contributions to a gradient that already exists are added in
+	//place. The peak of video memory of the run is thus known before it starts. Nodes are indices; the
+	//matrices given to input and param are not copied and must outlive the runs.
+	class Tape
+	{
+	public:
+
+		explicit Tape(void) = default;
+		Tape(const Tape& another) = delete;
+		Tape& operator=(const Tape& another) = delete;
+
+		size_t input(const Mat& mat);//A leaf without gradient.
+		size_t param(const Mat& mat);//A leaf whose gradient is kept after the run.
+		size_t add(size_t a, size_t b);//The elementwise ops broadcast like the operators of Mat.
+		size_t sub(size_t a, size_t b);
+		size_t mul(size_t a, size_t b);
+		size_t div(size_t a, size_t b);
+		size_t neg(size_t a);
+		size_t scale(size_t a, float th);
+		size_t shift(size_t a, float th);
+		size_t matmul(size_t a, size_t b, bool trans_a = false, bool trans_b = false);
+		size_t conv4d(size_t f, size_t g, std::vector<size_t> size, size_t stride = 1, const std::string& padding = "valid");
+		size_t exp(size_t a);
+		size_t log(size_t a);
+		size_t sqrt(size_t a);
+		size_t relu(size_t a);
+		size_t sum(size_t a, bool axis);
+		size_t mean(size_t a, bool axis);
+
+		void keep(size_t node);//The activation of node survives the run, to be read with value.
+		size_t plan(size_t loss);//Plans the run and returns its peak, in bytes of the buffers it allocates.
+		void run(size_t loss);
+
+		const Mat& value(size_t node) const;
+		const Mat& grad(size_t node) const;
+		size_t size(void) const;
+		void clear(void);
+
+	protected:
+
+		enum class Op { input, param, add, sub, mul, div, neg, scale, shift, matmul, conv4d, exp, log, sqrt, relu, sum, mean };
+
+		struct Node
+		{
+			Op op = Op::input;
+			size_t a = 0;
+			size_t b = 0;
+			size_t rows = 0;
+			size_t cols = 0;
+			float th = 0;
+			bool trans_a = false;
+			bool trans_b = false;
+			bool axis = false;
+			bool valid_padding = true;
+			bool kept = false;
+			size_t stride = 1;
+			std::vector<size_t> shape;//The size vector of conv4d.
+			const Mat* source = nullptr;//The matrix of a leaf.
+
+			//Filled by plan.
+			bool needed = false;
+			bool grad_needed = false;
+			size_t last_use = 0;
+			size_t reuse = SIZE_MAX;//The operand that takes over the gradient buffer in place.
+
+			Mat value;
+			Mat grad;
+			bool has_grad = false;
+		};
+
+		std::vector<Node> nodes;
+		std::vector<std::vector<size_t>> frees;//Per step, the activations read for the last time.
+		size_t target = SIZE_MAX;//The loss of the last plan.
+
+		size_t push(Node node);
+		Node elementwise(size_t a, size_t b) const;//A node of the shape the two operands broadcast to.
+		Node unary(size_t a) const;
+		size_t step_of(size_t node, bool backward) const;
+		std::vector<size_t> reads(size_t node) const;//Activations the backward step of node reads.
+		bool leaf(size_t node) const;
+		bool binary(size_t node) const;
+		size_t bytes(size_t node) const;
+
+		void forward(size_t node);
+		void backward(size_t node);
+		void contribute(size_t node, Mat&& grad);
+		const Mat& in(size_t node) const;
+		Mat reduce(Mat&& grad, size_t node) const;//Sums the broadcast axes back to the shape of node.
+
+		static void accumulate_(Mat& dst, const Mat& src);
+		static void scale_(Mat& mat, float th);
+	};
 }
 
 #include <lav_mat/src/operation.hpp>
@@ -18,12 +18,13 @@
  * Author        : (Rihothy)
  * File name     : algorithm.cpp
  * Version       : 1.0
- * Last modified : 2020-4-10
+ * Last modified : 2026-10-18
  *
  * See https://github.com/rihothy/lav_mat to get source code.
  * ************************************************************************/
 
 #include <lav_mat/lav_mat.h>
+#include <algorithm>
 
 using namespace lav;
 namespace boc = boost::compute;
@@ -39,7 +40,7 @@ Mat Mat::t(void) const
 {
 	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
 	(
-		__kernel void fun(__global float* input, __global float* output, size_t rows, size_t cols)
+		__kernel void fun(__global float* input, __global float* output, uint rows, uint cols)
 		{
 			const uint i = get_global_id(0);
 
@@ -47,59 +48,55 @@ Mat Mat::t(void) const
 		}
 	);
 
-	static boc::program fun_program = boc::program::build_with_source(source, Mat::context);
-	static boc::kernel fun_kernel(fun_program, "fun");
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
 
 	auto&& fun = [&](auto& input, auto& output)
 	{
-		fun_kernel.set_arg(0, input);
-		fun_kernel.set_arg(1, output);
-		fun_kernel.set_arg(2, rows);
-		fun_kernel.set_arg(3, cols);
-
-		auto event = Mat::queue.enqueue_1d_range_kernel(fun_kernel, 0, rows * cols, 0);
-		event.wait();
+		Mat::launch("t", fun_kernel, rows * cols, input, output, cl_uint(rows), cl_uint(cols));
 	};
 
-	Mat ans(cols, rows, true);
-
-	if (uploaded)
-	{
-		fun(g_buffer, ans.g_buffer);
-	}
-	else
+	if (lazy)
 	{
-		decltype(g_buffer) t_g_buffer(c_buffer.begin(), c_buffer.end(), Mat::queue);
-		fun(t_g_buffer, ans.g_buffer);
+		return Full(cols, rows, constant, true);
 	}
 
+	Mat ans(cols, rows, true);
+	Use use{ *this, ans };
+
+	fun(device_buffer(), ans.g_buffer);
+
 	return std::move(ans);
 }
 
 float Mat::max(void)
 {
-	upload();
+	offload();
 	const auto& temp = *this;
 	return temp.max();
 }
 
 float Mat::max(void) const
 {
-	if (uploaded)
+	if (lazy)
 	{
-		return *boc::max_element(g_buffer.begin(), g_buffer.end(), Mat::queue);
+		return constant;
+	}
+
+	Graph::unsupported("Max");
+
+	Use use{ *this };
+	Profiler::Span span("max", rows, cols);
+
+	if (Dispatcher::on_host(rows * cols, { *this }))
+	{
+		const auto& input = host_buffer();
+		return *std::max_element(input.begin(), input.end());
 	}
 	else
 	{
-		if (rows * cols < 1e6)
-		{
-			return *std::max_element(c_buffer.begin(), c_buffer.end());
-		}
-		else
-		{
-			decltype(g_buffer) t_g_buffer(c_buffer.begin(), c_buffer.end(), Mat::queue);
-			return *boc::max_element(t_g_buffer.begin(), t_g_buffer.end(), Mat::queue);
-		}
+		const auto& input = device_buffer();
+		return *boc::max_element(input.begin(), input.end(), Mat::queue);
 	}
 }
 
@@ -114,7 +111,7 @@ Mat Mat::max(bool axis) const
 {
 	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
 	(
-		__kernel void fun(__global float* input, __global float* output, size_t rows, size_t cols, size_t axis)
+		__kernel void fun(__global float* input, __global float* output, uint rows, uint cols, uint axis)
 		{
 			const uint i = get_global_id(0);
 		
@@ -139,60 +136,55 @@ Mat Mat::max(bool axis) const
 		}
 	);
 
-	static boc::program fun_program = boc::program::build_with_source(source, Mat::context);
-	static boc::kernel fun_kernel(fun_program, "fun");
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
 
 	auto&& fun = [&](auto& input, auto& output)
 	{
-		fun_kernel.set_arg(0, input);
-		fun_kernel.set_arg(1, output);
-		fun_kernel.set_arg(2, rows);
-		fun_kernel.set_arg(3, cols);
-		fun_kernel.set_arg(4, size_t(axis));
-
-		auto event = Mat::queue.enqueue_1d_range_kernel(fun_kernel, 0, axis ? rows : cols, 0);
-		event.wait();
+		Mat::launch("max", fun_kernel, axis ? rows : cols, input, output, cl_uint(rows), cl_uint(cols), cl_uint(axis));
 	};
 
-	Mat ans(axis ? rows : 1, axis ? 1 : cols, true);
-
-	if (uploaded)
-	{
-		fun(g_buffer, ans.g_buffer);
-	}
-	else
+	if (lazy)
 	{
-		decltype(g_buffer) t_g_buffer(c_buffer.begin(), c_buffer.end(), Mat::queue);
-		fun(t_g_buffer, ans.g_buffer);
+		return Full(axis ? rows : 1, axis ? 1 : cols, constant, true);
 	}
 
+	Mat ans(axis ? rows : 1, axis ? 1 : cols, true);
+	Use use{ *this, ans };
+
+	fun(device_buffer(), ans.g_buffer);
+
 	return std::move(ans);
 }
 
 float Mat::min(void)
 {
-	upload();
+	offload();
 	const auto& temp = *this;
 	return temp.min();
 }
 
 float Mat::min(void) const
 {
-	if (uploaded)
+	if (lazy)
 	{
-		return *boc::min_element(g_buffer.begin(), g_buffer.end(), Mat::queue);
+		return constant;
+	}
+
+	Graph::unsupported("Min");
+
+	Use use{ *this };
+	Profiler::Span span("min", rows, cols);
+
+	if (Dispatcher::on_host(rows * cols, { *this }))
+	{
+		const auto& input = host_buffer();
+		return *std::min_element(input.begin(), input.end());
 	}
 	else
 	{
-		if (rows * cols < 1e6)
-		{
-			return *std::min_element(c_buffer.begin(), c_buffer.end());
-		}
-		else
-		{
-			decltype(g_buffer) t_g_buffer(c_buffer.begin(), c_buffer.end(), Mat::queue);
-			return *boc::min_element(t_g_buffer.begin(), t_g_buffer.end(), Mat::queue);
-		}
+		const auto& input = device_buffer();
+		return *boc::min_element(input.begin(), input.end(), Mat::queue);
 	}
 }
 
@@ -207,7 +199,7 @@ Mat Mat::min(bool axis) const
 {
 	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
 	(
-		__kernel void fun(__global float* input, __global float* output, size_t rows, size_t cols, size_t axis)
+		__kernel void fun(__global float* input, __global float* output, uint rows, uint cols, uint axis)
 		{
 			const uint i = get_global_id(0);
 
@@ -232,39 +224,30 @@ Mat Mat::min(bool axis) const
 		}
 	);
 
-	static boc::program fun_program = boc::program::build_with_source(source, Mat::context);
-	static boc::kernel fun_kernel(fun_program, "fun");
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
 
 	auto&& fun = [&](auto& input, auto& output)
 	{
-		fun_kernel.set_arg(0, input);
-		fun_kernel.set_arg(1, output);
-		fun_kernel.set_arg(2, rows);
-		fun_kernel.set_arg(3, cols);
-		fun_kernel.set_arg(4, size_t(axis));
-
-		auto event = Mat::queue.enqueue_1d_range_kernel(fun_kernel, 0, axis ? rows : cols, 0);
-		event.wait();
+		Mat::launch("min", fun_kernel, axis ? rows : cols, input, output, cl_uint(rows), cl_uint(cols), cl_uint(axis));
 	};
 
-	Mat ans(axis ? rows : 1, axis ? 1 : cols, true);
-
-	if (uploaded)
+	if (lazy)
 	{
-		fun(g_buffer, ans.g_buffer);
-	}
-	else
-	{
-		decltype(g_buffer) t_g_buffer(c_buffer.begin(), c_buffer.end(), Mat::queue);
-		fun(t_g_buffer, ans.g_buffer);
+		return Full(axis ? rows : 1, axis ? 1 : cols, constant, true);
 	}
 
+	Mat ans(axis ? rows : 1, axis ? 1 : cols, true);
+	Use use{ *this, ans };
+
+	fun(device_buffer(), ans.g_buffer);
+
 	return std::move(ans);
 }
 
 float Mat::sum(void)
 {
-	upload();
+	offload();
 	const auto& temp = *this;
 	return temp.sum();
 }
@@ -273,48 +256,164 @@ float Mat::sum(void) const
 {
 	float ans;
 
-	if (uploaded)
+	if (lazy)
+	{
+		return constant * rows * cols;
+	}
+
+	Graph::unsupported("Sum");
+
+	Use use{ *this };
+	Profiler::Span span("sum", rows, cols);
+
+	if (Dispatcher::on_host(rows * cols, { *this }))
 	{
-		boc::reduce(g_buffer.begin(), g_buffer.end(), &ans, Mat::queue);
+		const auto& input = host_buffer();
+		ans = std::accumulate(input.begin(), input.end(), 0.0f);
 	}
 	else
 	{
-		if (rows * cols < 1e6)
-		{
-			ans = std::accumulate(c_buffer.begin(), c_buffer.end(), 0.0f);
-		}
-		else
-		{
-			decltype(g_buffer) t_g_buffer(c_buffer.begin(), c_buffer.end(), Mat::queue);
-			boc::reduce(t_g_buffer.begin(), t_g_buffer.end(), &ans, Mat::queue);
-		}
+		const auto& input = device_buffer();
+		boc::reduce(input.begin(), input.end(), &ans, Mat::queue);
 	}
 
 	return ans;
 }
 
+//Not moved beforehand, the const sum reduces on whichever side the dispatcher picks.
 Mat Mat::sum(bool axis)
 {
-	upload();
 	const auto& temp = *this;
 	return temp.sum(axis);
 }
 
+//A row is summed by one work group. A column is summed by tiles of rows first, one work item per
+//column of a tile so that neighbouring work items read neighbouring floats, then by tile.
 Mat Mat::sum(bool axis) const
 {
+	static const char source[] = "#define GROUP 256\n" BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void row_sums(__global float* input, __global float* output, uint cols)
+		{
+			__local float cache[GROUP];
+
+			const uint r = get_group_id(0);
+			const uint l = get_local_id(0);
+
+			float s = 0;
+
+			for (uint k = l; k < cols; k += get_local_size(0))
+			{
+				s += input[r * cols + k];
+			}
+
+			cache[l] = s;
+
+			barrier(CLK_LOCAL_MEM_FENCE);
+
+			for (uint half = get_local_size(0) / 2; half > 0; half /= 2)
+			{
+				if (l < half)
+				{
+					cache[l] += cache[l + half];
+				}
+
+				barrier(CLK_LOCAL_MEM_FENCE);
+			}
+
+			if (l == 0)
+			{
+				output[r] = cache[0];
+			}
+		}
+
+		__kernel void tile_sums(__global float* input, __global float* partial, uint rows, uint cols, uint tile)
+		{
+			const uint c = get_global_id(0);
+			const uint t = get_global_id(1);
+			const uint end = min(rows, (t + 1) * tile);
+
+			float s = 0;
+
+			for (uint r = t * tile; r < end; ++r)
+			{
+				s += input[r * cols + c];
+			}
+
+			partial[t * cols + c] = s;
+		}
+
+		__kernel void col_sums(__global float* partial, __global float* output, uint cols, uint tiles)
+		{
+			const uint c = get_global_id(0);
+
+			float s = 0;
+
+			for (uint t = 0; t < tiles; ++t)
+			{
+				s += partial[t * cols + c];
+			}
+
+			output[c] = s;
+		}
+	);
+
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel rows_kernel(fun_program, "row_sums");
+	thread_local boc::kernel tiles_kernel(fun_program, "tile_sums");
+	thread_local boc::kernel cols_kernel(fun_program, "col_sums");
+
+	if (lazy)
+	{
+		return Full(axis ? rows : 1, axis ? 1 : cols, constant * (axis ? cols : rows), true);
+	}
+
+	if (rows * cols == 0)
+	{
+		return Full(axis ? rows : 1, axis ? 1 : cols, 0, true);
+	}
+
+	if (Dispatcher::on_host(rows * cols, { *this }))
+	{
+		Mat ans(axis ? rows : 1, axis ? 1 : cols, std::vector<float>(axis ? rows : cols, 0), false);
+		Use use{ *this, ans };
+		Profiler::Span span("sum_axis", rows, cols);
+		const auto& input = host_buffer();
+
+		for (size_t r = 0; r < rows; ++r)
+		{
+			for (size_t c = 0; c < cols; ++c)
+			{
+				ans.c_buffer[axis ? r : c] += input[r * cols + c];
+			}
+		}
+
+		return std::move(ans);
+	}
+
+	Mat ans(axis ? rows : 1, axis ? 1 : cols, true);
+	Use use{ *this, ans };
+
 	if (axis)
 	{
-		return mul(*this, Ones(cols, 1, true));
+		Mat::launch_groups("sum_axis", rows_kernel, rows, Mat::group_size(rows_kernel), device_buffer(), ans.g_buffer, cl_uint(cols));
 	}
 	else
 	{
-		return mul(Ones(1, rows, true), *this);
+		const size_t tile = Mat::tile_rows(rows, cols);
+		const size_t tiles = (rows + tile - 1) / tile;
+		boc::vector<float> partial(tiles * cols, Mat::context);
+
+		Mat::launch("sum_axis", tiles_kernel, { cols, tiles }, device_buffer(), partial, cl_uint(rows), cl_uint(cols), cl_uint(tile));
+		Mat::launch("sum_axis", cols_kernel, cols, partial, ans.g_buffer, cl_uint(cols), cl_uint(tiles));
 	}
+
+	return std::move(ans);
 }
 
 float Mat::mean(void)
 {
-	upload();
+	offload();
 	const auto& temp = *this;
 	return temp.mean();
 }
@@ -326,7 +425,6 @@ float Mat::mean(void) const
 
 Mat Mat::mean(bool axis)
 {
-	upload();
 	const auto& temp = *this;
 	return temp.mean(axis);
 }
@@ -347,7 +445,7 @@ Mat Mat::max_loc(bool axis) const
 {
 	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
 	(
-		__kernel void fun(__global float* input, __global float* output, size_t rows, size_t cols, size_t axis)
+		__kernel void fun(__global float* input, __global float* output, uint rows, uint cols, uint axis)
 		{
 			const uint i = get_global_id(0);
 
@@ -382,33 +480,24 @@ Mat Mat::max_loc(bool axis) const
 		}
 	);
 
-	static boc::program fun_program = boc::program::build_with_source(source, Mat::context);
-	static boc::kernel fun_kernel(fun_program, "fun");
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
 
 	auto&& fun = [&](auto& input, auto& output)
 	{
-		fun_kernel.set_arg(0, input);
-		fun_kernel.set_arg(1, output);
-		fun_kernel.set_arg(2, rows);
-		fun_kernel.set_arg(3, cols);
-		fun_kernel.set_arg(4, size_t(axis));
-
-		auto event = Mat::queue.enqueue_1d_range_kernel(fun_kernel, 0, axis ? rows : cols, 0);
-		event.wait();
+		Mat::launch("max_loc", fun_kernel, axis ? rows : cols, input, output, cl_uint(rows), cl_uint(cols), cl_uint(axis));
 	};
 
-	Mat ans(axis ? rows : 1, axis ? 1 : cols, true);
-
-	if (uploaded)
+	if (lazy)
 	{
-		fun(g_buffer, ans.g_buffer);
-	}
-	else
-	{
-		decltype(g_buffer) t_g_buffer(c_buffer.begin(), c_buffer.end(), Mat::queue);
-		fun(t_g_buffer, ans.g_buffer);
+		return Full(axis ? rows : 1, axis ? 1 : cols, 0, true);
 	}
 
+	Mat ans(axis ? rows : 1, axis ? 1 : cols, true);
+	Use use{ *this, ans };
+
+	fun(device_buffer(), ans.g_buffer);
+
 	return std::move(ans);
 }
 
@@ -423,7 +512,7 @@ Mat Mat::min_loc(bool axis) const
 {
 	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
 	(
-		__kernel void fun(__global float* input, __global float* output, size_t rows, size_t cols, size_t axis)
+		__kernel void fun(__global float* input, __global float* output, uint rows, uint cols, uint axis)
 		{
 			const uint i = get_global_id(0);
 
@@ -458,33 +547,24 @@ Mat Mat::min_loc(bool axis) const
 		}
 	);
 
-	static boc::program fun_program = boc::program::build_with_source(source, Mat::context);
-	static boc::kernel fun_kernel(fun_program, "fun");
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
 
 	auto&& fun = [&](auto& input, auto& output)
 	{
-		fun_kernel.set_arg(0, input);
-		fun_kernel.set_arg(1, output);
-		fun_kernel.set_arg(2, rows);
-		fun_kernel.set_arg(3, cols);
-		fun_kernel.set_arg(4, size_t(axis));
-
-		auto event = Mat::queue.enqueue_1d_range_kernel(fun_kernel, 0, axis ? rows : cols, 0);
-		event.wait();
+		Mat::launch("min_loc", fun_kernel, axis ? rows : cols, input, output, cl_uint(rows), cl_uint(cols), cl_uint(axis));
 	};
 
-	Mat ans(axis ? rows : 1, axis ? 1 : cols, true);
-
-	if (uploaded)
-	{
-		fun(g_buffer, ans.g_buffer);
-	}
-	else
+	if (lazy)
 	{
-		decltype(g_buffer) t_g_buffer(c_buffer.begin(), c_buffer.end(), Mat::queue);
-		fun(t_g_buffer, ans.g_buffer);
+		return Full(axis ? rows : 1, axis ? 1 : cols, 0, true);
 	}
 
+	Mat ans(axis ? rows : 1, axis ? 1 : cols, true);
+	Use use{ *this, ans };
+
+	fun(device_buffer(), ans.g_buffer);
+
 	return std::move(ans);
 }
 
@@ -500,7 +580,7 @@ Mat lav::max(const float& th, const Mat& mat)
 
 Mat lav::max(Mat& mat, const float& th)
 {
-	mat.upload();
+	mat.offload();
 	return Mat::unary_op(mat, boc::lambda::max(boc::lambda::_1, th));
 }
 
@@ -511,20 +591,20 @@ Mat lav::max(const Mat& mat, const float& th)
 
 Mat lav::max(Mat& a, Mat& b)
 {
-	a.upload();
-	b.upload();
+	a.offload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::max(boc::lambda::_1, boc::lambda::_2));
 }
 
 Mat lav::max(Mat& a, const Mat& b)
 {
-	a.upload();
+	a.offload();
 	return Mat::binary_op(a, b, boc::lambda::max(boc::lambda::_1, boc::lambda::_2));
 }
 
 Mat lav::max(const Mat& a, Mat& b)
 {
-	b.upload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::max(boc::lambda::_1, boc::lambda::_2));
 }
 
@@ -545,7 +625,7 @@ Mat lav::min(const float& th, const Mat& mat)
 
 Mat lav::min(Mat& mat, const float& th)
 {
-	mat.upload();
+	mat.offload();
 	return Mat::unary_op(mat, boc::lambda::min(boc::lambda::_1, th));
 }
 
@@ -556,20 +636,20 @@ Mat lav::min(const Mat& mat, const float& th)
 
 Mat lav::min(Mat& a, Mat& b)
 {
-	a.upload();
-	b.upload();
+	a.offload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::min(boc::lambda::_1, boc::lambda::_2));
 }
 
 Mat lav::min(Mat& a, const Mat& b)
 {
-	a.upload();
+	a.offload();
 	return Mat::binary_op(a, b, boc::lambda::min(boc::lambda::_1, boc::lambda::_2));
 }
 
 Mat lav::min(const Mat& a, Mat& b)
 {
-	b.upload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::min(boc::lambda::_1, boc::lambda::_2));
 }
 
@@ -578,174 +658,436 @@ Mat lav::min(const Mat& a, const Mat& b)
 	return Mat::binary_op(a, b, boc::lambda::min(boc::lambda::_1, boc::lambda::_2));
 }
 
-Mat lav::shuffle(Mat& mat)
+//Indices are float matrices of any shape, read in row-major order, like the ones max_loc returns.
+//The kernels raise a flag on an index that is negative, fractional or out of range, and the flag is
+//read back once after the launch.
+static void check_indices(const boc::vector<cl_int>& flag, const char* message)
+{
+	cl_int value = 0;
+
+	boc::copy_n(flag.begin(), 1, &value, Mat::queue);
+
+	if (value)
+	{
+		throw std::runtime_error(message);
+	}
+}
+
+Mat lav::take(Mat& mat, const Mat& indices, bool axis)
 {
 	mat.upload();
 	const auto& temp = mat;
-	return shuffle(temp);
+	return take(temp, indices, axis);
 }
 
-Mat lav::shuffle(const Mat& mat)
+Mat lav::take(const Mat& mat, const Mat& indices, bool axis)
 {
 	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
 	(
-		__kernel void fun(__global float* input, __global float* output, size_t rows, size_t cols, size_t axis)
+		__kernel void fun(__global const float* input, __global float* output, __global const float* indices, __global int* flag, uint rows, uint cols, uint n, uint axis)
 		{
 			const uint i = get_global_id(0);
+			const float index = axis ? indices[i / cols] : indices[i % n];
+			const uint j = (uint)index;
 
-			if (axis)
+			if (!(index >= 0 && index < (axis ? rows : cols)) || j != index)
 			{
+				flag[0] = 1;
 				output[i] = 0;
-				float num = input[i * cols];
-
-				for (size_t j = 0; j < cols; ++j)
-				{
-					if (num > input[i * cols + j])
-					{
-						num = input[i * cols + j];
-						output[i] = j;
-					}
-				}
 			}
 			else
 			{
-				output[i] = 0;
-				float num = input[i];
+				output[i] = axis ? input[j * cols + i % cols] : input[i / n * cols + j];
+			}
+		}
+	);
 
-				for (size_t j = 0; j < rows; ++j)
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+	const size_t n = indices.rows * indices.cols;
+
+	Mat ans(axis ? n : mat.rows, axis ? mat.cols : n, true);
+
+	if (ans.rows * ans.cols == 0)
+	{
+		return std::move(ans);
+	}
+
+	Mat::Use use{ mat, indices, ans };
+
+	boc::vector<cl_int> flag(size_t(1), cl_int(0), Mat::queue);
+
+	Mat::launch("take", fun_kernel, ans.rows * ans.cols, mat.device_buffer(), ans.g_buffer, indices.device_buffer(), flag, cl_uint(mat.rows), cl_uint(mat.cols), cl_uint(n), cl_uint(axis));
+
+	check_indices(flag, "Take: Index out of range!");
+
+	return std::move(ans);
+}
+
+//With duplicate indices put_ keeps an arbitrary one of the source rows, while scatter_add_ adds all
+//of them up with a compare-and-swap loop, since OpenCL 1.2 has no atomic add for floats.
+void Mat::scatter(Mat& dst, const Mat& indices, const Mat& src, bool axis, bool add)
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global float* output, __global const float* input, __global const float* indices, __global int* flag, uint rows, uint cols, uint n, uint axis, uint add)
+		{
+			const uint i = get_global_id(0);
+			const float index = axis ? indices[i / cols] : indices[i % n];
+			const uint j = (uint)index;
+
+			if (!(index >= 0 && index < (axis ? rows : cols)) || j != index)
+			{
+				flag[0] = 1;
+				return;
+			}
+
+			__global float* p = output + (axis ? j * cols + i % cols : i / n * cols + j);
+
+			if (add)
+			{
+				union { uint u; float f; } old, now;
+
+				do
 				{
-					if (num > input[j * cols + i])
-					{
-						num = input[j * cols + i];
-						output[i] = j;
-					}
-				}
+					old.f = *p;
+					now.f = old.f + input[i];
+				} while (atomic_cmpxchg((volatile __global uint*)p, old.u, now.u) != old.u);
+			}
+			else
+			{
+				*p = input[i];
 			}
 		}
 	);
 
-	static boc::program fun_program = boc::program::build_with_source(source, Mat::context);
-	static boc::kernel fun_kernel(fun_program, "fun");
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
 
-	auto&& fun = [&](auto& input, auto& output)
+	const char* name = add ? "Scatter_add" : "Put";
+	const size_t n = indices.rows * indices.cols;
+
+	if (src.rows != (axis ? n : dst.rows) || src.cols != (axis ? dst.cols : n))
 	{
+		throw std::runtime_error(std::string(name) + ": Size mismatch between two matrices!");
+	}
 
-		fun_kernel.set_arg(0, input);
-		fun_kernel.set_arg(1, output);
+	if (src.rows * src.cols == 0)
+	{
+		return;
+	}
 
-		auto event = Mat::queue.enqueue_1d_range_kernel(fun_kernel, 0, 0, 0);
-		event.wait();
-	};
+	Use use{ dst, src, indices };
 
-	Mat ans(mat.rows, mat.cols, true);
+	dst.upload();
+	dst.invalidate();
+
+	boc::vector<cl_int> flag(size_t(1), cl_int(0), Mat::queue);
+
+	Mat::launch(add ? "scatter_add_" : "put_", fun_kernel, src.rows * src.cols, dst.g_buffer, src.device_buffer(), indices.device_buffer(), flag, cl_uint(dst.rows), cl_uint(dst.cols), cl_uint(n), cl_uint(axis), cl_uint(add));
+
+	check_indices(flag, add ? "Scatter_add: Index out of range!" : "Put: Index out of range!");
+}
+
+void lav::put_(Mat& dst, const Mat& indices, const Mat& src, bool axis)
+{
+	Mat::scatter(dst, indices, src, axis, false);
+}
+
+void lav::scatter_add_(Mat& dst, const Mat& indices, const Mat& src, bool axis)
+{
+	Mat::scatter(dst, indices, src, axis, true);
+}
+
+uint64_t Permutation::draw_seed(void)
+{
+	auto& generator = Generator::global();
+	const auto r = Generator::philox(generator.seed(), generator.advance(1), 0);
+
+	return uint64_t(r[1]) << 32 | r[0];
+}
+
+Permutation::Permutation(void) : size(0), seed(0), g_indices(Mat::context)
+{
+
+}
+
+Permutation::Permutation(size_t size) : Permutation(size, draw_seed())
+{
+
+}
+
+Permutation::Permutation(size_t size, uint64_t seed) : size(size), seed(seed), g_indices(size, Mat::context)
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global ulong* keys, __global uint* values, uint key0, uint key1)
+		{
+			const uint i = get_global_id(0);
+			const uint4 r = philox((uint2)(key0, key1), (uint4)(i, 0, 0, 0));
+
+			keys[i] = (ulong)r.x << 32 | r.y;
+			values[i] = i;
+		}
+	);
+
+	static boc::program fun_program = Mat::build(std::string(Generator::source) + source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
 
-	if (mat.uploaded)
+	if (size == 0)
 	{
-		fun(mat.g_buffer, ans.g_buffer);
+		return;
 	}
-	else
+
+	if (size > UINT32_MAX)
 	{
-		decltype(mat.g_buffer) t_g_buffer(mat.c_buffer.begin(), mat.c_buffer.end(), Mat::queue);
-		fun(t_g_buffer, ans.g_buffer);
+		throw std::runtime_error("Permutation: Size is too large!");
 	}
 
+	Graph::unsupported("Permutation");
+
+	boc::vector<cl_ulong> keys(size, Mat::context);
+
+	Mat::launch("Permutation", fun_kernel, size, keys, g_indices, cl_uint(seed), cl_uint(seed >> 32));
+
+	Profiler::Span span("Permutation::sort", size);
+
+	boc::sort_by_key(keys.begin(), keys.end(), g_indices.begin(), Mat::queue);
+}
+
+Mat Permutation::indices(void) const
+{
+	Mat ans(1, size, true);
+
+	boc::copy(g_indices.begin(), g_indices.end(), ans.g_buffer.begin(), Mat::queue);
+
 	return std::move(ans);
 }
 
-Mat lav::shuffle(Mat& mat, bool axis, bool same_as_last_time)
+Permutation Permutation::inverse(void) const
 {
-	mat.upload();
-	const auto& temp = mat;
-	return shuffle(temp, axis, same_as_last_time);
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global const uint* indices, __global uint* output)
+		{
+			const uint i = get_global_id(0);
+
+			output[indices[i]] = i;
+		}
+	);
+
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+	Permutation ans;
+
+	ans.size = size;
+	ans.seed = seed;
+	ans.g_indices.resize(size, Mat::queue);
+
+	if (size)
+	{
+		Mat::launch("Permutation::inverse", fun_kernel, size, g_indices, ans.g_indices);
+	}
+
+	return std::move(ans);
 }
 
-Mat lav::shuffle(const Mat& mat, bool axis, bool same_as_last_time)
+Mat Permutation::gather(const Mat& mat, size_t rows, size_t cols, bool axis) const
 {
-	static bool flag = false;
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global const float* input, __global float* output, __global const uint* indices, uint cols, uint axis)
+		{
+			const uint i = get_global_id(0);
+			const uint row = i / cols;
+			const uint col = i % cols;
 
-	if (not flag)
+			output[i] = axis ? input[indices[row] * cols + col] : input[row * cols + indices[col]];
+		}
+	);
+
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+	auto&& fun = [&](auto& input, auto& output)
+	{
+		Mat::launch("Permutation::apply", fun_kernel, rows * cols, input, output, g_indices, cl_uint(cols), cl_uint(axis));
+	};
+
+	Mat ans(mat.rows, mat.cols, true);
+
+	if (rows * cols == 0)
 	{
-		flag = true;
-		srand(time(nullptr));
+		return std::move(ans);
 	}
 
-	static size_t last_rows = 0, last_cols = 0;
-	static std::vector<float> c_indexes;
-	static boc::vector<float> g_indexes(Mat::context);
+	Mat::Use use{ mat, ans };
+
+	fun(mat.device_buffer(), ans.g_buffer);
 
-	if (!(same_as_last_time && axis ? mat.rows == last_rows : mat.cols == last_cols))
+	return std::move(ans);
+}
+
+Mat Permutation::apply(const Mat& mat, bool axis) const
+{
+	if ((axis ? mat.rows : mat.cols) != size)
 	{
-		last_rows = mat.rows, last_cols = mat.cols;
+		throw std::runtime_error("Permutation: Size mismatch with the matrix!");
+	}
 
-		size_t i = 0;
-		c_indexes.resize(axis ? mat.rows : mat.cols);
-		std::generate(c_indexes.begin(), c_indexes.end(), [&] {return i++; });
+	return gather(mat, mat.rows, mat.cols, axis);
+}
 
-		for (size_t i = c_indexes.size() - 1; i < c_indexes.size(); --i)
+std::pair<Mat, Mat> Permutation::apply(const Mat& a, const Mat& b) const
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global const float* a, __global float* out_a, uint cols_a, __global const float* b, __global float* out_b, uint cols_b, __global const uint* indices, uint rows)
 		{
-			size_t randint = 0;
+			const uint i = get_global_id(0);
+			const uint n = rows * cols_a;
 
-			for (size_t j = 0; j < 8; ++j)
+			if (i < n)
 			{
-				randint = randint * 10 + rand() % 10;
+				out_a[i] = a[indices[i / cols_a] * cols_a + i % cols_a];
 			}
+			else
+			{
+				const uint j = i - n;
 
-			std::swap(c_indexes[i], c_indexes[randint % (i + 1)]);
+				out_b[j] = b[indices[j / cols_b] * cols_b + j % cols_b];
+			}
 		}
+	);
+
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+	if (a.rows != size || b.rows != size)
+	{
+		throw std::runtime_error("Permutation: Size mismatch with the matrix!");
+	}
 
-		g_indexes.assign(c_indexes.begin(), c_indexes.end(), Mat::queue);
+	auto&& fun = [&](auto& input_a, auto& input_b, auto& output_a, auto& output_b)
+	{
+		Mat::launch("Permutation::apply", fun_kernel, size * (a.cols + b.cols), input_a, output_a, cl_uint(a.cols), input_b, output_b, cl_uint(b.cols), g_indices, cl_uint(size));
+	};
+
+	if (a.cols == 0 || b.cols == 0)
+	{
+		return { a.cols ? apply(a) : Mat(a), b.cols ? apply(b) : Mat(b) };
 	}
 
+	std::pair<Mat, Mat> ans(Mat(a.rows, a.cols, true), Mat(b.rows, b.cols, true));
+
+	Mat::Use use{ a, b, ans.first, ans.second };
+
+	fun(a.device_buffer(), b.device_buffer(), ans.first.g_buffer, ans.second.g_buffer);
+
+	return std::move(ans);
+}
+
+void Permutation::apply_(Mat& mat, bool axis) const
+{
 	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
 	(
-		__kernel void fun(__global float* input, __global float* output, __global float* indexes, size_t rows, size_t cols, size_t axis)
+		__kernel void get(__global const float* mat, __global float* strip, __global const uint* indices, uint cols, uint offset, uint width, uint axis)
 		{
 			const uint i = get_global_id(0);
-			const uint row = i / cols;
-			const uint col = i % cols;
 
 			if (axis)
 			{
-				const size_t j = indexes[row];
-
-				output[i] = input[j * cols + col];
+				strip[i] = mat[indices[i / width] * cols + offset + i % width];
 			}
 			else
 			{
-				const size_t j = indexes[col];
+				strip[i] = mat[(offset + i / cols) * cols + indices[i % cols]];
+			}
+		}
 
-				output[i] = input[row * cols + j];
+		__kernel void put(__global float* mat, __global const float* strip, uint cols, uint offset, uint width, uint axis)
+		{
+			const uint i = get_global_id(0);
+
+			if (axis)
+			{
+				mat[i / width * cols + offset + i % width] = strip[i];
+			}
+			else
+			{
+				mat[offset * cols + i] = strip[i];
 			}
 		}
 	);
 
-	static boc::program fun_program = boc::program::build_with_source(source, Mat::context);
-	static boc::kernel fun_kernel(fun_program, "fun");
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel get_kernel(fun_program, "get");
+	thread_local boc::kernel put_kernel(fun_program, "put");
 
-	auto&& fun = [&](auto& input, auto& output)
+	//The strip holds about 4MB, so a permutation of any matrix costs that much extra memory at most.
+	static const size_t strip_size = 1 << 20;
+
+	if ((axis ? mat.rows : mat.cols) != size)
 	{
-		fun_kernel.set_arg(0, input);
-		fun_kernel.set_arg(1, output);
-		fun_kernel.set_arg(2, g_indexes);
-		fun_kernel.set_arg(3, mat.rows);
-		fun_kernel.set_arg(4, mat.cols);
-		fun_kernel.set_arg(5, size_t(axis));
+		throw std::runtime_error("Permutation: Size mismatch with the matrix!");
+	}
 
-		auto event = Mat::queue.enqueue_1d_range_kernel(fun_kernel, 0, mat.rows * mat.cols, 0);
-		event.wait();
-	};
+	if (mat.rows * mat.cols == 0)
+	{
+		return;
+	}
 
-	Mat ans(mat.rows, mat.cols, true);
+	Mat::Use use{ mat };
+
+	mat.upload();
+	mat.invalidate();
+
+	const size_t length = axis ? mat.cols : mat.rows;
+	const size_t step = std::max<size_t>(std::min(length, strip_size / size), 1);
+
+	boc::vector<float> strip(step * size, Mat::context);
 
-	if (mat.uploaded)
+	for (size_t offset = 0; offset < length; offset += step)
 	{
-		fun(mat.g_buffer, ans.g_buffer);
+		const size_t width = std::min(step, length - offset);
+		const size_t n = width * size;
+
+		Mat::launch("Permutation::apply_", get_kernel, n, mat.g_buffer, strip, g_indices, cl_uint(mat.cols), cl_uint(offset), cl_uint(width), cl_uint(axis));
+		Mat::launch("Permutation::apply_", put_kernel, n, mat.g_buffer, strip, cl_uint(mat.cols), cl_uint(offset), cl_uint(width), cl_uint(axis));
 	}
-	else
+}
+
+Mat lav::shuffle(Mat& mat)
+{
+	mat.upload();
+	const auto& temp = mat;
+	return shuffle(temp);
+}
+
+Mat lav::shuffle(const Mat& mat)
+{
+	return Permutation(mat.rows * mat.cols).gather(mat, mat.rows * mat.cols, 1, true);
+}
+
+Mat lav::shuffle(Mat& mat, bool axis, bool same_as_last_time)
+{
+	mat.upload();
+	const auto& temp = mat;
+	return shuffle(temp, axis, same_as_last_time);
+}
+
+Mat lav::shuffle(const Mat& mat, bool axis, bool same_as_last_time)
+{
+	thread_local Permutation last;
+
+	const size_t size = axis ? mat.rows : mat.cols;
+
+	if (not same_as_last_time || last.size != size)
 	{
-		decltype(mat.g_buffer) t_g_buffer(mat.c_buffer.begin(), mat.c_buffer.end(), Mat::queue);
-		fun(t_g_buffer, ans.g_buffer);
+		last = Permutation(size);
 	}
 
-	return std::move(ans);
+	return last.apply(mat, axis);
 }
\ No newline at end of file
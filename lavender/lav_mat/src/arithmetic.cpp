@@ -18,7 +18,7 @@
  * Author        : (Rihothy)
  * File name     : arithmetic.cpp
  * Version       : 1.0
- * Last modified : 2020-4-10
+ * Last modified : 2026-10-18
  *
  * See https://github.com/rihothy/lav_mat to get source code.
  * ************************************************************************/
@@ -31,10 +31,40 @@
 using namespace lav;
 namespace boc = boost::compute;
 
+Mat Mat::broadcast(const Mat& mat, size_t rows, size_t cols)
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global float* input, __global float* output, uint cols, uint column)
+		{
+			const uint i = get_global_id(0);
+
+			output[i] = input[column ? i / cols : i % cols];
+		}
+	);
+
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+	if (mat.lazy)
+	{
+		return Full(rows, cols, mat.constant, true);
+	}
+
+	Mat ans(rows, cols, true);
+	Use use{ mat, ans };
+
+	if (rows * cols)
+	{
+		Mat::launch("broadcast", fun_kernel, rows * cols, mat.device_buffer(), ans.g_buffer, cl_uint(cols), cl_uint(mat.rows == rows && mat.cols == 1));
+	}
+
+	return std::move(ans);
+}
+
+//The operands are not moved beforehand: the const mul decides its side once, by the cost of the GEMM.
 Mat lav::mul(Mat& a, Mat& b, bool trans_a, bool trans_b)
 {
-	a.upload();
-	b.upload();
 	const auto& ta = a;
 	const auto& tb = b;
 	return mul(ta, tb, trans_a, trans_b);
@@ -42,14 +72,12 @@ Mat lav::mul(Mat& a, Mat& b, bool trans_a, bool trans_b)
 
 Mat lav::mul(Mat& a, const Mat& b, bool trans_a, bool trans_b)
 {
-	a.upload();
 	const auto& ta = a;
 	return mul(ta, b, trans_a, trans_b);
 }
 
 Mat lav::mul(const Mat& a, Mat& b, bool trans_a, bool trans_b)
 {
-	b.upload();
 	const auto& tb = b;
 	return mul(a, tb, trans_a, trans_b);
 }
@@ -68,46 +96,75 @@ Mat lav::mul(const Mat& a, const Mat& b, bool trans_a, bool trans_b)
 		std::swap(r_b, c_b);
 	}
 	
-	if (c_a == r_b)
+	if (c_a == r_b && Dispatcher::on_host(r_a * c_a * c_b, { a, b }, true))
+	{
+		Mat ans(r_a, c_b, false);
+
+		Mat::Use use{ a, b, ans };
+
+		const float* a_data = a.host_buffer().data();
+		const float* b_data = b.host_buffer().data();
+		const size_t a_row = trans_a ? 1 : a.cols, a_col = trans_a ? a.cols : 1;
+		const size_t b_row = trans_b ? 1 : b.cols, b_col = trans_b ? b.cols : 1;
+
+		for (size_t i = 0; i < r_a; ++i)
+		{
+			for (size_t k = 0; k < c_a; ++k)
+			{
+				const float x = a_data[i * a_row + k * a_col];
+
+				for (size_t j = 0; j < c_b; ++j)
+				{
+					ans.c_buffer[i * c_b + j] += x * b_data[k * b_row + j * b_col];
+				}
+			}
+		}
+
+		return std::move(ans);
+	}
+	else if (c_a == r_b)
 	{
 		Mat ans(r_a, c_b, true);
 
-		auto&& fun = [&](auto& a_g_buffer, auto& b_g_buffer)
+		Mat::Use use{ a, b, ans };
+
+		const boc::buffer a_g_buffer = a.device_buffer().get_buffer();
+		const boc::buffer b_g_buffer = b.device_buffer().get_buffer();
+		const boc::buffer ans_g_buffer = ans.g_buffer.get_buffer();
+		const size_t lda = a.cols, ldb = b.cols, ldc = ans.cols;
+
+		auto&& fun = [=](cl_event* event)
 		{
 			clblasSgemm
 			(
 				clblasRowMajor, trans_a ? clblasTrans : clblasNoTrans, trans_b ? clblasTrans : clblasNoTrans,
 				r_a, c_b, c_a, 1,
-				a_g_buffer, 0, a.cols,
-				b_g_buffer, 0, b.cols,
-				0, ans.g_buffer.get_buffer().get(), 0, ans.cols, 1,
-				&Mat::queue.get(), 0, nullptr, &Mat::event.get()
+				a_g_buffer.get(), 0, lda,
+				b_g_buffer.get(), 0, ldb,
+				0, ans_g_buffer.get(), 0, ldc, 1,
+				&Mat::queue.get(), 0, nullptr, event
 			);
 		};
 
-		if (!a.uploaded && !b.uploaded)
-		{
-			decltype(a.g_buffer) a_g_buffer(a.c_buffer.begin(), a.c_buffer.end(), Mat::queue);
-			decltype(b.g_buffer) b_g_buffer(b.c_buffer.begin(), b.c_buffer.end(), Mat::queue);
-			fun(a_g_buffer.get_buffer().get(), b_g_buffer.get_buffer().get());
-		}
-		else if (!a.uploaded)
-		{
-			decltype(a.g_buffer) a_g_buffer(a.c_buffer.begin(), a.c_buffer.end(), Mat::queue);
-			fun(a_g_buffer.get_buffer().get(), b.g_buffer.get_buffer().get());
-		}
-		else if (!b.uploaded)
+		fun(&Mat::event.get());
+
+		clWaitForEvents(1, &Mat::event.get());
+		Stats::count_gemm();
+
+		if (Graph::capturing())
 		{
-			decltype(b.g_buffer) b_g_buffer(b.c_buffer.begin(), b.c_buffer.end(), Mat::queue);
-			fun(a.g_buffer.get_buffer().get(), b_g_buffer.get_buffer().get());
+			Graph::record([fun]
+			{
+				fun(nullptr);
+				Stats::count_gemm();
+			});
 		}
-		else
+
+		if (Profiler::enabled())
 		{
-			fun(a.g_buffer.get_buffer().get(), b.g_buffer.get_buffer().get());
+			Profiler::record("mul", "gemm", std::to_string(r_a) + "x" + std::to_string(c_a) + "x" + std::to_string(c_b), (r_a * c_a + c_a * c_b + r_a * c_b) * sizeof(float), Mat::event);
 		}
 
-		clWaitForEvents(1, &Mat::event.get());
-
 		return std::move(ans);
 	}
 	else
@@ -118,7 +175,7 @@ Mat lav::mul(const Mat& a, const Mat& b, bool trans_a, bool trans_b)
 
 Mat lav::operator-(Mat& mat)
 {
-	mat.upload();
+	mat.offload();
 	return Mat::unary_op(mat, 0 - boc::lambda::_1);
 }
 
@@ -139,7 +196,7 @@ Mat lav::operator+(const float& th, const Mat& mat)
 
 Mat lav::operator+(Mat& mat, const float& th)
 {
-	mat.upload();
+	mat.offload();
 	return Mat::unary_op(mat, boc::lambda::_1 + th);
 }
 
@@ -150,20 +207,20 @@ Mat lav::operator+(const Mat& mat, const float& th)
 
 Mat lav::operator+(Mat& a, Mat& b)
 {
-	a.upload();
-	b.upload();
+	a.offload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 + boc::lambda::_2);
 }
 
 Mat lav::operator+(Mat& a, const Mat& b)
 {
-	a.upload();
+	a.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 + boc::lambda::_2);
 }
 
 Mat lav::operator+(const Mat& a, Mat& b)
 {
-	b.upload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 + boc::lambda::_2);
 }
 
@@ -174,7 +231,7 @@ Mat lav::operator+(const Mat& a, const Mat& b)
 
 Mat lav::operator-(const float& th, Mat& mat)
 {
-	mat.upload();
+	mat.offload();
 	return Mat::unary_op(mat, th - boc::lambda::_1);
 }
 
@@ -185,7 +242,7 @@ Mat lav::operator-(const float& th, const Mat& mat)
 
 Mat lav::operator-(Mat& mat, const float& th)
 {
-	mat.upload();
+	mat.offload();
 	return Mat::unary_op(mat, boc::lambda::_1 - th);
 }
 
@@ -196,20 +253,20 @@ Mat lav::operator-(const Mat& mat, const float& th)
 
 Mat lav::operator-(Mat& a, Mat& b)
 {
-	a.upload();
-	b.upload();
+	a.offload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 - boc::lambda::_2);
 }
 
 Mat lav::operator-(Mat& a, const Mat& b)
 {
-	a.upload();
+	a.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 - boc::lambda::_2);
 }
 
 Mat lav::operator-(const Mat& a, Mat& b)
 {
-	b.upload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 - boc::lambda::_2);
 }
 
@@ -220,7 +277,7 @@ Mat lav::operator-(const Mat& a, const Mat& b)
 
 Mat lav::operator*(const float& th, Mat& mat)
 {
-	mat.upload();
+	mat.offload();
 	return mat * th;
 }
 
@@ -231,7 +288,7 @@ Mat lav::operator*(const float& th, const Mat& mat)
 
 Mat lav::operator*(Mat& mat, const float& th)
 {
-	mat.upload();
+	mat.offload();
 	return Mat::unary_op(mat, boc::lambda::_1 * th);
 }
 
@@ -242,20 +299,20 @@ Mat lav::operator*(const Mat& mat, const float& th)
 
 Mat lav::operator*(Mat& a, Mat& b)
 {
-	a.upload();
-	b.upload();
+	a.offload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 * boc::lambda::_2);
 }
 
 Mat lav::operator*(Mat& a, const Mat& b)
 {
-	a.upload();
+	a.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 * boc::lambda::_2);
 }
 
 Mat lav::operator*(const Mat& a, Mat& b)
 {
-	b.upload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 * boc::lambda::_2);
 }
 
@@ -266,7 +323,7 @@ Mat lav::operator*(const Mat& a, const Mat& b)
 
 Mat lav::operator/(const float& th, Mat& mat)
 {
-	mat.upload();
+	mat.offload();
 	return Mat::unary_op(mat, th / boc::lambda::_1);
 }
 
@@ -277,7 +334,7 @@ Mat lav::operator/(const float& th, const Mat& mat)
 
 Mat lav::operator/(Mat& mat, const float& th)
 {
-	mat.upload();
+	mat.offload();
 	return Mat::unary_op(mat, boc::lambda::_1 / th);
 }
 
@@ -288,20 +345,20 @@ Mat lav::operator/(const Mat& mat, const float& th)
 
 Mat lav::operator/(Mat& a, Mat& b)
 {
-	a.upload();
-	b.upload();
+	a.offload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 / boc::lambda::_2);
 }
 
 Mat lav::operator/(Mat& a, const Mat& b)
 {
-	a.upload();
+	a.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 / boc::lambda::_2);
 }
 
 Mat lav::operator/(const Mat& a, Mat& b)
 {
-	b.upload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 / boc::lambda::_2);
 }
 
@@ -392,7 +449,7 @@ Mat lav::operator<=(const Mat& a, const Mat& b)
 
 Mat lav::operator>(const float& th, Mat& mat)
 {
-	mat.upload();
+	mat.offload();
 	return Mat::unary_op(mat, th > boc::lambda::_1);
 }
 
@@ -403,7 +460,7 @@ Mat lav::operator>(const float& th, const Mat& mat)
 
 Mat lav::operator>(Mat& mat, const float& th)
 {
-	mat.upload();
+	mat.offload();
 	return Mat::unary_op(mat, boc::lambda::_1 > th);
 }
 
@@ -414,20 +471,20 @@ Mat lav::operator>(const Mat& mat, const float& th)
 
 Mat lav::operator>(Mat& a, Mat& b)
 {
-	a.upload();
-	b.upload();
+	a.offload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 > boc::lambda::_2);
 }
 
 Mat lav::operator>(Mat& a, const Mat& b)
 {
-	a.upload();
+	a.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 > boc::lambda::_2);
 }
 
 Mat lav::operator>(const Mat& a, Mat& b)
 {
-	b.upload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 > boc::lambda::_2);
 }
 
@@ -438,7 +495,7 @@ Mat lav::operator>(const Mat& a, const Mat& b)
 
 Mat lav::operator>=(const float& th, Mat& mat)
 {
-	mat.upload();
+	mat.offload();
 	return Mat::unary_op(mat, th >= boc::lambda::_1);
 }
 
@@ -449,7 +506,7 @@ Mat lav::operator>=(const float& th, const Mat& mat)
 
 Mat lav::operator>=(Mat& mat, const float& th)
 {
-	mat.upload();
+	mat.offload();
 	return Mat::unary_op(mat, boc::lambda::_1 >= th);
 }
 
@@ -460,20 +517,20 @@ Mat lav::operator>=(const Mat& mat, const float& th)
 
 Mat lav::operator>=(Mat& a, Mat& b)
 {
-	a.upload();
-	b.upload();
+	a.offload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 >= boc::lambda::_2);
 }
 
 Mat lav::operator>=(Mat& a, const Mat& b)
 {
-	a.upload();
+	a.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 >= boc::lambda::_2);
 }
 
 Mat lav::operator>=(const Mat& a, Mat& b)
 {
-	b.upload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 >= boc::lambda::_2);
 }
 
@@ -494,7 +551,7 @@ Mat lav::operator==(const float& th, const Mat& mat)
 
 Mat lav::operator==(Mat& mat, const float& th)
 {
-	mat.upload();
+	mat.offload();
 	return Mat::unary_op(mat, boc::lambda::_1 == th);
 }
 
@@ -505,20 +562,20 @@ Mat lav::operator==(const Mat& mat, const float& th)
 
 Mat lav::operator==(Mat& a, Mat& b)
 {
-	a.upload();
-	b.upload();
+	a.offload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 == boc::lambda::_2);
 }
 
 Mat lav::operator==(Mat& a, const Mat& b)
 {
-	a.upload();
+	a.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 == boc::lambda::_2);
 }
 
 Mat lav::operator==(const Mat& a, Mat& b)
 {
-	b.upload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 == boc::lambda::_2);
 }
 
@@ -539,7 +596,7 @@ Mat lav::operator!=(const float& th, const Mat& mat)
 
 Mat lav::operator!=(Mat& mat, const float& th)
 {
-	mat.upload();
+	mat.offload();
 
 	return Mat::unary_op(mat, boc::lambda::_1 != th);
 }
@@ -551,24 +608,39 @@ Mat lav::operator!=(const Mat& mat, const float& th)
 
 Mat lav::operator!=(Mat& a, Mat& b)
 {
-	a.upload();
-	b.upload();
+	a.offload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 != boc::lambda::_2);
 }
 
 Mat lav::operator!=(Mat& a, const Mat& b)
 {
-	a.upload();
+	a.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 != boc::lambda::_2);
 }
 
 Mat lav::operator!=(const Mat& a, Mat& b)
 {
-	b.upload();
+	b.offload();
 	return Mat::binary_op(a, b, boc::lambda::_1 != boc::lambda::_2);
 }
 
 Mat lav::operator!=(const Mat& a, const Mat& b)
 {
 	return Mat::binary_op(a, b, boc::lambda::_1 != boc::lambda::_2);
+}
+
+Mat lav::operator&(const Mat& a, const Mat& b)
+{
+	return Mat::binary_op(a, b, boc::lambda::_1 != 0 && boc::lambda::_2 != 0);
+}
+
+Mat lav::operator|(const Mat& a, const Mat& b)
+{
+	return Mat::binary_op(a, b, boc::lambda::_1 != 0 || boc::lambda::_2 != 0);
+}
+
+Mat lav::operator!(const Mat& mat)
+{
+	return Mat::unary_op(mat, boc::lambda::_1 == 0);
 }
\ No newline at end of file
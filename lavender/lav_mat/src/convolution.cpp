@@ -18,7 +18,7 @@
  * Author        : (Rihothy)
  * File name     : convolution.cpp
  * Version       : 1.0
- * Last modified : 2020-4-21
+ * Last modified : 2026-10-18
  * Describe      : size[0]: f's width
  *                 size[1]: f's height
  *                 size[2]: f's channel
@@ -57,10 +57,48 @@ Mat lav::conv4d(const Mat& f, Mat& g, std::vector<size_t> size, const size_t& st
 }
 
 Mat lav::conv4d(const Mat& f, const Mat& g, std::vector<size_t> size, const size_t& stride, const std::string padding)
+{
+	bool valid_padding = padding == "valid";
+
+	if (valid_padding || padding == "same")
+	{
+		if (size.size() <= 5)
+		{
+			if (size.size() < 5)
+			{
+				size.insert(size.end(), 5 - size.size(), 1);
+			}
+
+			if (size[3] % 2 == 0)
+			{
+				throw std::runtime_error("Conv4d: Side length of filter must be odd!");
+			}
+
+			if (size[0] * size[1] * size[4] == f.rows && size[2] == f.cols && size[3] * size[3] * size[2] == g.rows)
+			{
+				return lav::mul(Mat::im2col(f, size, stride, valid_padding), g);
+			}
+			else
+			{
+				throw std::runtime_error("Conv4d: The size of matrices f and g must match the value of vector size!");
+			}
+		}
+		else
+		{
+			throw std::runtime_error("Conv4d: Size vector must have 5 dimensions, which is width, height, channel, filter size and batch size!");
+		}
+	}
+	else
+	{
+		throw std::runtime_error("Conv4d: The value of padding can only be \"valid\" or \"same\"!");
+	}
+}
+
+Mat Mat::im2col(const Mat& f, const std::vector<size_t>& size, size_t stride, bool valid_padding)
 {
 	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
 	(
-		__kernel void fun(__global float* input, __global float* output, size_t w, size_t h, size_t channel, size_t nw, size_t f, size_t s, int valid_padding, size_t group_r, size_t group_c)
+		__kernel void fun(__global float* input, __global float* output, uint w, uint h, uint channel, uint nw, uint f, uint s, int valid_padding, uint group_r, uint group_c)
 		{
 			const int r = get_global_id(0);
 			const int c = get_global_id(1);
@@ -99,74 +137,82 @@ Mat lav::conv4d(const Mat& f, const Mat& g, std::vector<size_t> size, const size
 		}
 	);
 
-	static boc::program fun_program = boc::program::build_with_source(source, Mat::context);
-	static boc::kernel fun_kernel(fun_program, "fun");
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
 
-	bool valid_padding = padding == "valid";
+	const size_t nw = valid_padding ? (size[0] - size[3]) / stride + 1 : (size[0] + stride - 1) / stride;
+	const size_t nh = valid_padding ? (size[1] - size[3]) / stride + 1 : (size[1] + stride - 1) / stride;
 
-	if (valid_padding || padding == "same")
-	{
-		if (size.size() <= 5)
+	Mat temp(nw * nh * size[4], size[3] * size[3] * size[2], true);
+
+	Mat::Use use{ f, temp };
+
+	Mat::launch("conv4d", fun_kernel, { temp.rows, temp.cols }, f.device_buffer(), temp.g_buffer, cl_uint(size[0]), cl_uint(size[1]), cl_uint(size[2]), cl_uint(nw), cl_uint(size[3]), cl_uint(stride), int(valid_padding), cl_uint(nw * nh), cl_uint(size[3] * size[3]));
+
+	return std::move(temp);
+}
+
+Mat Mat::col2im(const Mat& cols, const std::vector<size_t>& size, size_t stride, bool valid_padding)
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global float* input, __global float* output, uint w, uint h, uint channel, uint nw, uint nh, uint f, uint s, int valid_padding)
 		{
-			if (size.size() < 5)
-			{
-				size.insert(size.end(), 5 - size.size(), 1);
-			}
+			const int r = get_global_id(0);
+			const int c = get_global_id(1);
+			const int side = f;
+			const int step = s;
+			const int pad = valid_padding ? 0 : side / 2;
 
-			if (size[3] % 2 == 0)
-			{
-				throw std::runtime_error("Conv4d: Side length of filter must be odd!");
-			}
+			const int b_id = r / (w * h);
+			const int or = r % (w * h) / w;
+			const int oc = r % w;
 
-			if (size[0] * size[1] * size[4] == f.rows && size[2] == f.cols && size[3] * size[3] * size[2] == g.rows)
-			{
-				size_t nw = valid_padding ? (size[0] - size[3]) / stride + 1 : (size[0] + stride - 1) / stride;
-				size_t nh = valid_padding ? (size[1] - size[3]) / stride + 1 : (size[1] + stride - 1) / stride;
+			float sum = 0;
 
-				Mat temp(nw * nh * size[4], g.rows, true);
+			//Gathers every patch element that was read from this pixel, instead of scattering with atomics.
+			for (int fr = 0; fr < side; ++fr)
+			{
+				const int tr = or + pad - fr;
 
-				auto fun = [&](auto& f_g_buffer, auto& temp_g_buffer)
+				if (tr < 0 || tr % step || tr / step >= (int)nh)
 				{
-					fun_kernel.set_arg(0, f_g_buffer);
-					fun_kernel.set_arg(1, temp_g_buffer);
-					fun_kernel.set_arg(2, size[0]);
-					fun_kernel.set_arg(3, size[1]);
-					fun_kernel.set_arg(4, size[2]);
-					fun_kernel.set_arg(5, nw);
-					fun_kernel.set_arg(6, size[3]);
-					fun_kernel.set_arg(7, stride);
-					fun_kernel.set_arg(8, int(valid_padding));
-					fun_kernel.set_arg(9, nw * nh);
-					fun_kernel.set_arg(10, size[3] * size[3]);
-
-					auto event = Mat::queue.enqueue_nd_range_kernel(fun_kernel, boc::extents<2>({ 0, 0 }), boc::extents<2>({ nw * nh * size[4], g.rows }), boc::extents<2>({ 1, 1 }));
-					event.wait();
-				};
-
-				if (f.uploaded)
-				{
-					fun(f.g_buffer, temp.g_buffer);
+					continue;
 				}
-				else
+
+				for (int fc = 0; fc < side; ++fc)
 				{
-					decltype(f.g_buffer) t_f_g_buffer(f.c_buffer.begin(), f.c_buffer.end(), Mat::queue);
-					fun(t_f_g_buffer, temp.g_buffer);
-				}
+					const int tc = oc + pad - fc;
 
-				return lav::mul(temp, g);
-			}
-			else
-			{
-				throw std::runtime_error("Conv4d: The size of matrices f and g must match the value of vector size!");
+					if (tc < 0 || tc % step || tc / step >= (int)nw)
+					{
+						continue;
+					}
+
+					sum += input[(b_id * nw * nh + tr / step * nw + tc / step) * channel * f * f + c * f * f + fr * f + fc];
+				}
 			}
+
+			output[r * channel + c] = sum;
 		}
-		else
-		{
-			throw std::runtime_error("Conv4d: Size vector must have 5 dimensions, which is width, height, channel, filter size and batch size!");
-		}
-	}
-	else
+	);
+
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+	const size_t nw = valid_padding ? (size[0] - size[3]) / stride + 1 : (size[0] + stride - 1) / stride;
+	const size_t nh = valid_padding ? (size[1] - size[3]) / stride + 1 : (size[1] + stride - 1) / stride;
+
+	if (cols.rows != nw * nh * size[4] || cols.cols != size[3] * size[3] * size[2])
 	{
-		throw std::runtime_error("Conv4d: The value of padding can only be \"valid\" or \"same\"!");
+		throw std::runtime_error("Col2im: The size of the patches must match the value of vector size!");
 	}
+
+	Mat ans(size[0] * size[1] * size[4], size[2], true);
+
+	Mat::Use use{ cols, ans };
+
+	Mat::launch("col2im", fun_kernel, { ans.rows, ans.cols }, cols.device_buffer(), ans.g_buffer, cl_uint(size[0]), cl_uint(size[1]), cl_uint(size[2]), cl_uint(nw), cl_uint(nh), cl_uint(size[3]), cl_uint(stride), int(valid_padding));
+
+	return std::move(ans);
 }
\ No newline at end of file
@@ -0,0 +1,271 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : dispatcher.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : The model is measured with the OpenCL calls themselves,
+ *                 not through the ops of lav_mat, so the calibration shows
+ *                 neither in Stats nor in the profiler: an empty kernel for
+ *                 the launch, a 4 MB buffer each way for the copies, a sum
+ *                 of two such buffers for the elementwise throughput and a
+ *                 256 x 256 clBLAS GEMM; on the host the same sum and a
+ *                 64 x 64 product in the loop order of mul. Each one keeps
+ *                 its fastest of a few runs.
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat/lav_mat.h>
+
+#include <algorithm>
+#include <clBLAS.h>
+#include <chrono>
+
+using namespace lav;
+namespace boc = boost::compute;
+
+static int policy_of_environment(void)
+{
+	const char* value = std::getenv("LAV_MAT_DISPATCH");
+	const std::string policy = value ? value : "";
+
+	if (policy == "host")
+	{
+		return int(Dispatcher::Policy::host);
+	}
+	else if (policy == "device")
+	{
+		return int(Dispatcher::Policy::device);
+	}
+	else
+	{
+		return int(Dispatcher::Policy::automatic);
+	}
+}
+
+std::atomic<int> Dispatcher::mode(policy_of_environment());
+
+struct Calibration
+{
+	std::mutex mutex;
+	Dispatcher::Model model;
+	bool ready = false;
+};
+
+//Never destroyed, like the residency registry.
+static Calibration& calibration(void)
+{
+	static Calibration* calibration = new Calibration;
+	return *calibration;
+}
+
+template<typename T>
+static double fastest(T&& fun)
+{
+	double ans = 1e300;
+
+	//The first run is a warm up.
+	for (size_t i = 0; i < 6; ++i)
+	{
+		const auto start = std::chrono::steady_clock::now();
+
+		fun();
+
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if (i)
+		{
+			ans = std::min(ans, seconds);
+		}
+	}
+
+	return std::max(ans, 1e-9);
+}
+
+void Dispatcher::set_policy(Policy policy)
+{
+	mode = int(policy);
+}
+
+Dispatcher::Policy Dispatcher::policy(void)
+{
+	return Policy(mode.load());
+}
+
+void Dispatcher::set_model(const Model& model)
+{
+	std::lock_guard<std::mutex> lock(calibration().mutex);
+
+	calibration().model = model;
+	calibration().ready = true;
+}
+
+Dispatcher::Model Dispatcher::model(void)
+{
+	std::lock_guard<std::mutex> lock(calibration().mutex);
+
+	if (!calibration().ready)
+	{
+		calibration().model = calibrate();
+		calibration().ready = true;
+	}
+
+	return calibration().model;
+}
+
+Dispatcher::Model Dispatcher::calibrate(void)
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void empty(__global float* output)
+		{
+
+		}
+
+		__kernel void add(__global float* a, __global float* b, __global float* output)
+		{
+			const uint i = get_global_id(0);
+
+			output[i] = a[i] + b[i];
+		}
+	);
+
+	const size_t n = 1 << 20;
+	const size_t side = 256;
+	const size_t host_side = 64;
+
+	boc::program program = boc::program::build_with_source(source, Mat::context);
+	boc::kernel empty(program, "empty");
+	boc::kernel add(program, "add");
+
+	boc::vector<float> a(n, Mat::context), b(n, Mat::context), c(n, Mat::context);
+	std::vector<float> host_a(n, 1), host_b(n, 2), host_c(n);
+
+	empty.set_args(c);
+	add.set_args(a, b, c);
+
+	Model model;
+
+	model.launch = fastest([&]
+	{
+		Mat::queue.enqueue_1d_range_kernel(empty, 0, 1, 0).wait();
+	});
+
+	model.upload = n * sizeof(float) / fastest([&]
+	{
+		Mat::queue.enqueue_write_buffer(a.get_buffer(), 0, n * sizeof(float), host_a.data());
+	});
+
+	model.download = n * sizeof(float) / fastest([&]
+	{
+		Mat::queue.enqueue_read_buffer(a.get_buffer(), 0, n * sizeof(float), host_c.data());
+	});
+
+	model.device_rate = n / std::max(fastest([&]
+	{
+		Mat::queue.enqueue_1d_range_kernel(add, 0, n, 0).wait();
+	}) - model.launch, 1e-9);
+
+	model.device_flops = side * side * side / std::max(fastest([&]
+	{
+		clblasSgemm
+		(
+			clblasRowMajor, clblasNoTrans, clblasNoTrans,
+			side, side, side, 1,
+			a.get_buffer().get(), 0, side,
+			b.get_buffer().get(), 0, side,
+			0, c.get_buffer().get(), 0, side, 1,
+			&Mat::queue.get(), 0, nullptr, &Mat::event.get()
+		);
+
+		clWaitForEvents(1, &Mat::event.get());
+	}) - model.launch, 1e-9);
+
+	model.host_rate = n / fastest([&]
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			host_c[i] = host_a[i] + host_b[i];
+		}
+	});
+
+	model.host_flops = host_side * host_side * host_side / fastest([&]
+	{
+		std::fill(host_c.begin(), host_c.begin() + host_side * host_side, 0.0f);
+
+		for (size_t i = 0; i < host_side; ++i)
+		{
+			for (size_t k = 0; k < host_side; ++k)
+			{
+				const float x = host_a[i * host_side + k];
+
+				for (size_t j = 0; j < host_side; ++j)
+				{
+					host_c[i * host_side + j] += x * host_b[k * host_side + j];
+				}
+			}
+		}
+	});
+
+	volatile float sink = host_c[0];//Keeps the host loops.
+	(void)sink;
+
+	return model;
+}
+
+bool Dispatcher::on_host(size_t work, std::initializer_list<std::reference_wrapper<const Mat>> mats, bool gemm)
+{
+	//A graph only records the device, constants alone may still be folded on the host.
+	if (Graph::capturing() && mats.size())
+	{
+		return false;
+	}
+
+	if (policy() != Policy::automatic)
+	{
+		return policy() == Policy::host;
+	}
+
+	const Model model = Dispatcher::model();
+
+	double host = work / (gemm ? model.host_flops : model.host_rate);
+	double device = model.launch + work / (gemm ? model.device_flops : model.device_rate);
+
+	for (const Mat& mat : mats)
+	{
+		const double bytes = double(mat.rows * mat.cols * sizeof(float));
+
+		//A lazy matrix is only a constant, either side fills it for nothing.
+		if (mat.lazy || mat.mirrored)
+		{
+			continue;
+		}
+
+		if (mat.uploaded)
+		{
+			host += bytes / model.download;
+		}
+		else
+		{
+			device += bytes / model.upload;
+		}
+	}
+
+	return host < device;
+}
\ No newline at end of file
@@ -0,0 +1,190 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : graph.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : Capturing runs the step for real, with the dispatcher held
+ *                 on the video RAM, so every op takes its usual path and the
+ *                 outputs of the capture are already right. Mat::launch, mul,
+ *                 unary_op, binary_op and the device copies and fills record
+ *                 a command next to what they send; each kernel command owns
+ *                 a kernel object with all its arguments set once, and its
+ *                 local size is looked up once. A replay only enqueues them
+ *                 in order on the in-order queue and waits at the end.
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat/lav_mat.h>
+
+using namespace lav;
+namespace boc = boost::compute;
+
+thread_local Graph* Graph::current = nullptr;
+
+Graph::Graph(const std::vector<Mat>& inputs, const std::function<std::vector<Mat>(const std::vector<Mat>&)>& step)
+{
+	if (current)
+	{
+		throw std::runtime_error("Graph: Captures cannot be nested!");
+	}
+
+	for (auto& input : inputs)
+	{
+		arguments.emplace_back(input);
+		arguments.back().upload();
+	}
+
+	//Pinned for good, the commands are bound to these very buffers.
+	for (auto& argument : arguments)
+	{
+		uses.emplace_back(new Mat::Use{ argument });
+	}
+
+	current = this;
+
+	try
+	{
+		results = step(arguments);
+	}
+	catch (...)
+	{
+		current = nullptr;
+		throw;
+	}
+
+	current = nullptr;
+
+	for (auto& result : results)
+	{
+		result.upload();
+		uses.emplace_back(new Mat::Use{ result });
+	}
+
+	Mat::queue.finish();
+}
+
+const std::vector<Mat>& Graph::replay(const std::vector<Mat>& inputs)
+{
+	if (inputs.size() != arguments.size())
+	{
+		throw std::runtime_error("Replay: The number of inputs differs from the capture!");
+	}
+
+	Profiler::Span span("Graph::replay", commands.size());
+
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		const Mat& input = inputs[i];
+		Mat& argument = arguments[i];
+
+		if (input.rows != argument.rows || input.cols != argument.cols)
+		{
+			throw std::runtime_error("Replay: Size mismatch with the inputs of the capture!");
+		}
+
+		Mat::Use use{ input };
+
+		argument.invalidate();
+
+		if (input.uploaded)
+		{
+			Mat::queue.enqueue_copy_buffer(input.g_buffer.get_buffer(), argument.g_buffer.get_buffer(), 0, 0, input.g_buffer.size() * sizeof(float));
+		}
+		else
+		{
+			Mat::write(argument.g_buffer, input.c_buffer.data(), input.c_buffer.size());
+		}
+	}
+
+	for (auto& command : commands)
+	{
+		command();
+	}
+
+	Mat::queue.finish();
+
+	for (auto& result : results)
+	{
+		result.invalidate();
+	}
+
+	return results;
+}
+
+const std::vector<Mat>& Graph::outputs(void) const
+{
+	return results;
+}
+
+size_t Graph::size(void) const
+{
+	return commands.size();
+}
+
+bool Graph::capturing(void)
+{
+	return current != nullptr;
+}
+
+void Graph::unsupported(const char* name)
+{
+	if (capturing())
+	{
+		throw std::runtime_error(std::string("Graph: ") + name + " cannot be captured!");
+	}
+}
+
+void Graph::record(const std::function<void(void)>& command)
+{
+	if (capturing())
+	{
+		current->commands.push_back(command);
+	}
+}
+
+void Graph::record_copy(const boc::vector<float>& src, size_t src_offset, const boc::vector<float>& dst, size_t dst_offset, size_t n)
+{
+	if (capturing() && n)
+	{
+		const boc::buffer from = src.get_buffer();
+		const boc::buffer to = dst.get_buffer();
+
+		current->commands.push_back([=]
+		{
+			Mat::queue.enqueue_copy_buffer(from, to, src_offset * sizeof(float), dst_offset * sizeof(float), n * sizeof(float));
+		});
+	}
+}
+
+void Graph::record_fill(const boc::vector<float>& dst, float value)
+{
+	if (capturing() && dst.size())
+	{
+		const auto first = boc::make_buffer_iterator<float>(dst.get_buffer(), 0);
+		const auto last = boc::make_buffer_iterator<float>(dst.get_buffer(), dst.size());
+
+		current->commands.push_back([=]
+		{
+			boc::fill(first, last, value, Mat::queue);
+		});
+	}
+}
\ No newline at end of file
@@ -18,7 +18,7 @@
  * Author        : (Rihothy)
  * File name     : init.cpp
  * Version       : 1.0
- * Last modified : 2020-4-10
+ * Last modified : 2026-10-18
  *
  * See https://github.com/rihothy/lav_mat to get source code.
  * ************************************************************************/
@@ -38,10 +38,12 @@ std::function<void(void)> Mat::init = []
 {
     Mat::device = boc::system::default_device();
     Mat::context = boc::context(Mat::device);
-    Mat::queue = boc::command_queue(Mat::context, Mat::device);
+    Mat::queue = boc::command_queue(Mat::context, Mat::device);//Profiler::enable recreates it with profiling.
+
+    Tuner::load(Tuner::default_path());
 };
 
-boc::event Mat::event;
+thread_local boc::event Mat::event;
 boc::device Mat::device;
 boc::context Mat::context;
 boc::command_queue Mat::queue;
@@ -49,8 +51,8 @@ boc::command_queue Mat::queue;
 Mat::Mat(const size_t& rows, const size_t& cols, const std::vector<float>& vec, bool upload_flag) :
 	rows(rows), cols(cols)
 {
-    Mat::init();
-    Mat::init = [] {};
+    static std::once_flag once;
+    std::call_once(once, Mat::init);
 
     uploaded = upload_flag;
     g_buffer = boc::vector<float>(Mat::context);
@@ -59,11 +61,13 @@ Mat::Mat(const size_t& rows, const size_t& cols, const std::vector<float>& vec,
     {
         if (upload_flag)
         {
-            g_buffer.assign(vec.begin(), vec.end(), Mat::queue);
+            allocate(vec.size());
+            write(g_buffer, vec.data(), vec.size());
         }
         else
         {
             c_buffer.assign(vec.begin(), vec.end());
+            track();
         }
     }
     else if (vec.empty())
@@ -72,11 +76,12 @@ Mat::Mat(const size_t& rows, const size_t& cols, const std::vector<float>& vec,
         {
             if (upload_flag)
             {
-                g_buffer.resize(rows * cols, Mat::queue);
+                allocate(rows * cols);
             }
             else
             {
                 c_buffer.resize(rows * cols);
+                track();
             }
         }
     }
@@ -86,44 +91,10 @@ Mat::Mat(const size_t& rows, const size_t& cols, const std::vector<float>& vec,
     }
 }
 
-Mat::Mat(const std::string& path, char delimiter, bool upload_flag)
+Mat::Mat(const std::string& path, char delimiter, bool upload_flag) :
+    Mat(load_txt(path, delimiter, 0, {}, upload_flag))
 {
-    std::ifstream istrm(path);
-
-    if (istrm)
-    {
-        size_t rows = 0;
-        size_t cols = 0;
-        std::string line;
-        std::vector<float> vec;
-
-        while (std::getline(istrm, line) && line != "")
-        {
-            std::string data;
-            size_t t_cols = 0;
-            std::stringstream sstrm(line);
-
-            while (std::getline(sstrm, data, delimiter))
-            {
-                ++t_cols;
-                vec.push_back(atof(data.c_str()));
-            }
-
-            if (cols && t_cols != cols)
-            {
-                throw std::runtime_error("Constructor: File " + path + " is not a matrix!");
-            }
 
-            ++rows;
-            cols = t_cols;
-        }
-
-        new (this)Mat(rows, cols, vec);
-    }
-    else
-    {
-        throw std::runtime_error("Constructor: Could not find file named " + path);
-    }
 }
 
 Mat::Mat(const std::initializer_list<float>& vec, bool upload_flag) :
@@ -139,9 +110,21 @@ Mat::Mat(const size_t& rows, const size_t& cols, bool upload_flag) :
 }
 
 Mat::Mat(Mat&& another) noexcept :
-    Mat(another.rows, another.cols)
+    Mat(0, 0)
 {
+    rows = another.rows;
+    cols = another.cols;
     uploaded = another.uploaded;
+    evicted = another.evicted;
+    lazy = another.lazy;
+    constant = another.constant;
+
+    another.mirrored = false;
+
+    if (another.lazy)
+    {
+        return;
+    }
 
     if (another.uploaded)
     {
@@ -151,20 +134,36 @@ Mat::Mat(Mat&& another) noexcept :
     {
         c_buffer = std::move(another.c_buffer);
     }
+
+    track();
+    another.track();
 }
 
 Mat::Mat(const Mat& another) :
-    Mat(another.rows, another.cols)
+    Mat(0, 0)
 {
+    rows = another.rows;
+    cols = another.cols;
     uploaded = another.uploaded;
+    evicted = another.evicted;
+    lazy = another.lazy;
+    constant = another.constant;
+
+    if (another.lazy)
+    {
+        return;
+    }
 
     if (another.uploaded)
     {
-        g_buffer.assign(another.g_buffer.begin(), another.g_buffer.end(), Mat::queue);
+        allocate(another.g_buffer.size());
+        boc::copy(another.g_buffer.begin(), another.g_buffer.end(), g_buffer.begin(), Mat::queue);
+        Graph::record_copy(another.g_buffer, 0, g_buffer, 0, g_buffer.size());
     }
     else
     {
         c_buffer.assign(another.c_buffer.begin(), another.c_buffer.end());
+        track();
     }
 }
 
@@ -174,76 +173,147 @@ Mat::Mat(void) :
 
 }
 
+Mat::~Mat(void)
+{
+    untrack();
+}
+
 Mat lav::Eyes(const size_t& n, bool upload_flag)
 {
-    std::vector<float> vec(n * n, 0);
+    Mat mat = Full(n, n, 0, upload_flag);
 
-    for (size_t i = 0; i < vec.size(); i += n + 1)
-    {
-        vec[i] = 1;
-    }
+    set_diag_(mat, 1);
 
-    return Mat(n, n, vec, upload_flag);
+    return std::move(mat);
 }
 
 Mat lav::Ones(const size_t& rows, const size_t& cols, bool upload_flag)
 {
-    return Mat(rows, cols, std::vector<float>(rows * cols, 1), upload_flag);
+    return Full(rows, cols, 1, upload_flag);
 }
 
 Mat lav::Zeros(const size_t& rows, const size_t& cols, bool upload_flag)
 {
-    return Mat(rows, cols, std::vector<float>(rows * cols, 0), upload_flag);
+    return Full(rows, cols, 0, upload_flag);
 }
 
-Mat lav::randn(const size_t& rows, const size_t& cols, bool upload_flag)
+Mat lav::Full(const size_t& rows, const size_t& cols, float value, bool upload_flag)
 {
-    return randn(rows, cols, 0, 1, upload_flag);
+    Mat mat(0, 0, upload_flag);
+
+    mat.rows = rows;
+    mat.cols = cols;
+
+    fill_(mat, value);
+
+    return std::move(mat);
 }
 
-Mat lav::randu(const size_t& rows, const size_t& cols, bool upload_flag)
+void lav::fill_(Mat& mat, float value)
 {
-    return randu(rows, cols, 0, 1, upload_flag);
+    mat.invalidate();
+    mat.lazy = true;
+    mat.constant = value;
 }
 
-Mat lav::randn(const size_t& rows, const size_t& cols, float mean, float sigma, bool upload_flag)
+void lav::iota_(Mat& mat, float start, float step)
 {
-    Mat mat(rows, cols, upload_flag);
+    static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+    (
+        __kernel void fun(__global float* output, float start, float step)
+        {
+            const uint i = get_global_id(0);
+
+            output[i] = start + i * step;
+        }
+    );
 
-    static boc::default_random_engine g_e(Mat::queue, time(nullptr));
-    static std::default_random_engine c_e(time(nullptr));
+    static boc::program fun_program = Mat::build(source);
+    thread_local boc::kernel fun_kernel(fun_program, "fun");
 
-    if (upload_flag)
+    Mat::Use use({ mat }, false);
+
+    mat.invalidate();
+
+    if (mat.rows * mat.cols == 0)
+    {
+        return;
+    }
+
+    if (mat.uploaded)
     {
-        boc::normal_distribution<float> rand_float(mean, sigma);
-        rand_float.generate(mat.g_buffer.begin(), mat.g_buffer.end(), g_e, Mat::queue);
+        Mat::launch("iota_", fun_kernel, mat.rows * mat.cols, mat.g_buffer, start, step);
     }
     else
     {
-        std::normal_distribution<float> rand_float(mean, sigma);
-        std::generate(mat.c_buffer.begin(), mat.c_buffer.end(), [&]() {return rand_float(c_e); });
+        for (size_t i = 0; i < mat.c_buffer.size(); ++i)
+        {
+            mat.c_buffer[i] = start + i * step;
+        }
     }
-
-    return std::move(mat);
 }
 
-Mat lav::randu(const size_t& rows, const size_t& cols, float lower, float upper, bool upload_flag)
+void lav::set_diag_(Mat& mat, float value)
 {
-    Mat mat(rows, cols, upload_flag);
+    static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+    (
+        __kernel void fun(__global float* output, float value, uint cols)
+        {
+            output[get_global_id(0) * (cols + 1)] = value;
+        }
+    );
+
+    static boc::program fun_program = Mat::build(source);
+    thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+    const size_t n = std::min(mat.rows, mat.cols);
 
-    static boc::default_random_engine g_e(Mat::queue, time(nullptr));
-    static std::default_random_engine c_e(time(nullptr));
-    
-    if (upload_flag)
+    Mat::Use use{ mat };
+
+    mat.invalidate();
+
+    if (n == 0)
     {
-        boc::uniform_real_distribution<float> rand_float(lower, upper);
-        rand_float.generate(mat.g_buffer.begin(), mat.g_buffer.end(), g_e, Mat::queue);
+        return;
+    }
+
+    if (mat.uploaded)
+    {
+        Mat::launch("set_diag_", fun_kernel, n, mat.g_buffer, value, cl_uint(mat.cols));
     }
     else
     {
-        std::uniform_real_distribution<float> rand_float(lower, upper);
-        std::generate(mat.c_buffer.begin(), mat.c_buffer.end(), [&]() {return rand_float(c_e); });
+        for (size_t i = 0; i < n; ++i)
+        {
+            mat.c_buffer[i * (mat.cols + 1)] = value;
+        }
     }
+}
+
+Mat lav::randn(const size_t& rows, const size_t& cols, bool upload_flag)
+{
+    return randn(rows, cols, 0, 1, upload_flag);
+}
+
+Mat lav::randu(const size_t& rows, const size_t& cols, bool upload_flag)
+{
+    return randu(rows, cols, 0, 1, upload_flag);
+}
+
+Mat lav::randn(const size_t& rows, const size_t& cols, float mean, float sigma, bool upload_flag)
+{
+    Mat mat(rows, cols, upload_flag);
+
+    fill_randn_(mat, mean, sigma);
+
+    return std::move(mat);
+}
+
+Mat lav::randu(const size_t& rows, const size_t& cols, float lower, float upper, bool upload_flag)
+{
+    Mat mat(rows, cols, upload_flag);
+
+    fill_randu_(mat, lower, upper);
 
     return std::move(mat);
 }
\ No newline at end of file
@@ -0,0 +1,1361 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : io.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : The text loader reads the whole file with one read, cuts
+ *                 it into chunks on newline boundaries and parses every
+ *                 chunk on its own thread with std::from_chars straight into
+ *                 the matrix buffer. The first empty line ends the matrix,
+ *                 the same as the old stream based loader.
+ *                 The text writer formats with std::to_chars into large
+ *                 buffers and never flushes per row. A matrix on the video
+ *                 RAM is downloaded in row chunks, the next chunk is read
+ *                 back while the current one is being formatted.
+ *                 The binary format is 8 bytes of magic, rows and cols as
+ *                 64-bit integers and then the datas as float32. Together
+ *                 with the text format it can be streamed by BatchReader.
+ *                 .npy files and the arrays of uncompressed .npz files are
+ *                 memory mapped, float32 payloads go to the video RAM
+ *                 straight from the mapping. Other dtypes are converted to
+ *                 float32 while they are copied.
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat/lav_mat.h>
+
+#include <algorithm>
+#include <exception>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <random>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+using namespace lav;
+namespace boc = boost::compute;
+
+static size_t worker_count(size_t bytes)
+{
+	const size_t grain = 1 << 20;//Chunks smaller than this are not worth a thread.
+	const size_t hardware = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+	return std::max<size_t>(std::min(hardware, bytes / grain), 1);
+}
+
+static const char* line_end(const char* first, const char* last)
+{
+	auto p = static_cast<const char*>(std::memchr(first, '\n', last - first));
+	return p ? p : last;
+}
+
+//The end of the fields of the line [first, last): a '\r' and then a delimiter ending the line are no
+//part of them, like the getline based loader, which did not read a field after a trailing delimiter.
+static const char* fields_end(const char* first, const char* last, char delimiter)
+{
+	if (last > first && last[-1] == '\r')
+	{
+		--last;
+	}
+
+	if (last > first && last[-1] == delimiter)
+	{
+		--last;
+	}
+
+	return last;
+}
+
+static size_t count_fields(const char* first, const char* last, char delimiter)
+{
+	last = fields_end(first, last, delimiter);
+
+	return std::count(first, last, delimiter) + 1;
+}
+
+//Parses the line [first, last) and writes the selected fields to out.
+//Returns the number of fields in the line, or -1 if a field is not a number.
+static ptrdiff_t parse_line(const char* first, const char* last, char delimiter, const std::vector<ptrdiff_t>& select, float* out)
+{
+	last = fields_end(first, last, delimiter);
+
+	size_t field = 0;
+
+	for (const char* p = first; ; ++field)
+	{
+		auto q = static_cast<const char*>(std::memchr(p, delimiter, last - p));
+		q = q ? q : last;
+
+		ptrdiff_t index = field < select.size() ? select[field] : -1;
+
+		if (index >= 0)
+		{
+			const char* s = p;
+			float value = 0;
+
+			while (s < q && (*s == ' ' || *s == '\t'))
+			{
+				++s;
+			}
+
+			s += s < q && *s == '+';
+
+			if (s < q)
+			{
+				auto [end, ec] = std::from_chars(s, q, value);
+
+				while (end < q && (*end == ' ' || *end == '\t'))
+				{
+					++end;
+				}
+
+				if (ec != std::errc() || end != q)
+				{
+					return -1;
+				}
+			}
+
+			out[index] = value;
+		}
+
+		if (q == last)
+		{
+			return field + 1;
+		}
+
+		p = q + 1;
+	}
+}
+
+Mat lav::load_txt(const std::string& path, char delimiter, size_t skip_rows, const std::vector<size_t>& usecols, bool upload_flag)
+{
+	std::ifstream istrm(path, std::ios::binary | std::ios::ate);
+
+	if (!istrm)
+	{
+		throw std::runtime_error("Load_txt: Could not find file named " + path);
+	}
+
+	std::vector<char> text(size_t(istrm.tellg()));
+	istrm.seekg(0);
+	istrm.read(text.data(), text.size());
+
+	const char* first = text.data();
+	const char* last = text.data() + text.size();
+
+	for (size_t i = 0; i < skip_rows && first < last; ++i)
+	{
+		first = std::min(line_end(first, last) + 1, last);
+	}
+
+	//Cut the text into chunks, every chunk starts at the beginning of a line.
+	std::vector<const char*> bounds = { first };
+	size_t workers = worker_count(last - first);
+
+	for (size_t i = 1; i < workers; ++i)
+	{
+		const char* p = std::max(first + (last - first) * i / workers, bounds.back());
+
+		if (p < last && p != first)
+		{
+			p = std::min(line_end(p - 1, last) + 1, last);
+		}
+
+		bounds.push_back(p);
+	}
+
+	bounds.push_back(last);
+	workers = bounds.size() - 1;
+
+	//Pass 1: count the lines of every chunk and find the first empty one.
+	std::vector<size_t> lines(workers, 0);
+	std::vector<size_t> empty(workers, SIZE_MAX);
+	std::vector<std::thread> threads;
+
+	for (size_t k = 0; k < workers; ++k)
+	{
+		threads.emplace_back([&, k]
+		{
+			for (const char* p = bounds[k]; p < bounds[k + 1]; ++lines[k])
+			{
+				const char* q = line_end(p, bounds[k + 1]);
+
+				if (q == p || (q == p + 1 && *p == '\r'))
+				{
+					empty[k] = lines[k];
+					break;
+				}
+
+				p = q + 1;
+			}
+		});
+	}
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	std::vector<size_t> offsets(workers + 1, 0);
+
+	for (size_t k = 0; k < workers; ++k)
+	{
+		if (empty[k] != SIZE_MAX)
+		{
+			lines[k] = empty[k];
+			offsets[k + 1] = offsets[k] + lines[k];
+			std::fill(lines.begin() + k + 1, lines.end(), 0);
+			std::fill(offsets.begin() + k + 2, offsets.end(), offsets[k + 1]);
+			break;
+		}
+
+		offsets[k + 1] = offsets[k] + lines[k];
+	}
+
+	size_t rows = offsets.back();
+	size_t file_cols = rows ? count_fields(first, line_end(first, last), delimiter) : 0;
+	size_t cols = usecols.empty() ? file_cols : usecols.size();
+	std::vector<ptrdiff_t> select(file_cols, -1);
+
+	for (size_t i = 0; i < cols; ++i)
+	{
+		size_t col = usecols.empty() ? i : usecols[i];
+
+		if (col >= file_cols)
+		{
+			throw std::runtime_error("Load_txt: Column " + std::to_string(col) + " is out of range in file " + path + "!");
+		}
+
+		if (select[col] != -1)
+		{
+			throw std::runtime_error("Load_txt: Column " + std::to_string(col) + " is given more than once in usecols!");
+		}
+
+		select[col] = i;
+	}
+
+	//Pass 2: parse every chunk into its own rows, and upload it once it is done.
+	Mat ans(rows, cols, upload_flag);
+	std::vector<float> staging(upload_flag ? rows * cols : 0);
+	std::vector<boc::event> events(workers);
+	std::vector<std::exception_ptr> errors(workers);
+
+	float* data = upload_flag ? staging.data() : ans.c_buffer.data();
+	threads.clear();
+
+	for (size_t k = 0; k < workers; ++k)
+	{
+		threads.emplace_back([&, k]
+		{
+			try
+			{
+				const char* p = bounds[k];
+
+				for (size_t i = offsets[k]; i < offsets[k + 1]; ++i)
+				{
+					const char* q = line_end(p, bounds[k + 1]);
+					ptrdiff_t fields = parse_line(p, q, delimiter, select, data + i * cols);
+
+					if (fields < 0)
+					{
+						throw std::runtime_error("Load_txt: Line " + std::to_string(i + skip_rows + 1) + " of file " + path + " contains a field that is not a number!");
+					}
+
+					if (size_t(fields) != file_cols)
+					{
+						throw std::runtime_error("Load_txt: File " + path + " is not a matrix, line " + std::to_string(i + skip_rows + 1) + " has " + std::to_string(fields) + " columns but " + std::to_string(file_cols) + " are expected!");
+					}
+
+					p = q + 1;
+				}
+
+				if (upload_flag && offsets[k + 1] > offsets[k])
+				{
+					size_t offset = offsets[k] * cols * sizeof(float);
+					size_t bytes = (offsets[k + 1] - offsets[k]) * cols * sizeof(float);
+
+					events[k] = Mat::queue.enqueue_write_buffer_async(ans.g_buffer.get_buffer(), offset, bytes, data + offsets[k] * cols);
+					Stats::count_transfer(true, bytes);
+				}
+			}
+			catch (...)
+			{
+				errors[k] = std::current_exception();
+			}
+		});
+	}
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	for (auto& event : events)
+	{
+		if (event.get())
+		{
+			event.wait();
+		}
+	}
+
+	for (auto& error : errors)
+	{
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+
+	return std::move(ans);
+}
+
+void lav::save_txt(std::ostream& out, const Mat& mat, char delimiter)
+{
+	const size_t max_chars = 16;//Longest shortest-round-trip float, plus the delimiter.
+	const size_t chunk_rows = std::max<size_t>((1 << 20) / std::max<size_t>(mat.cols, 1), 1);
+
+	Mat::Use use{ mat };
+
+	std::vector<char> text(std::min(chunk_rows, mat.rows) * mat.cols * max_chars + 1);
+
+	auto&& format = [&](const float* data, size_t rows)
+	{
+		char* p = text.data();
+
+		for (size_t i = 0; i < rows; ++i)
+		{
+			for (size_t j = 0; j < mat.cols; ++j)
+			{
+				p = std::to_chars(p, p + max_chars, data[i * mat.cols + j]).ptr;
+				*p++ = j == mat.cols - 1 ? '\n' : delimiter;
+			}
+		}
+
+		out.write(text.data(), p - text.data());
+	};
+
+	if (!mat.uploaded)
+	{
+		for (size_t row = 0; row < mat.rows; row += chunk_rows)
+		{
+			format(mat.c_buffer.data() + row * mat.cols, std::min(chunk_rows, mat.rows - row));
+		}
+	}
+	else
+	{
+		//Download the next chunk while the current one is being formatted.
+		std::vector<float> host[2];
+		boc::event events[2];
+
+		auto&& download = [&](size_t row)
+		{
+			auto& buffer = host[row / chunk_rows % 2];
+			size_t count = std::min(chunk_rows, mat.rows - row) * mat.cols;
+
+			buffer.resize(count);
+			events[row / chunk_rows % 2] = Mat::queue.enqueue_read_buffer_async(mat.g_buffer.get_buffer(), row * mat.cols * sizeof(float), count * sizeof(float), buffer.data());
+		};
+
+		if (mat.rows * mat.cols)
+		{
+			download(0);
+		}
+
+		for (size_t row = 0; row < mat.rows && mat.cols; row += chunk_rows)
+		{
+			if (row + chunk_rows < mat.rows)
+			{
+				download(row + chunk_rows);
+			}
+
+			events[row / chunk_rows % 2].wait();
+			format(host[row / chunk_rows % 2].data(), std::min(chunk_rows, mat.rows - row));
+		}
+	}
+}
+
+void lav::save_txt(const std::string& path, const Mat& mat, char delimiter)
+{
+	std::ofstream ostrm(path, std::ios::binary);
+
+	if (ostrm)
+	{
+		save_txt(ostrm, mat, delimiter);
+	}
+	else
+	{
+		throw std::runtime_error("Save_txt: Could not open file named " + path);
+	}
+}
+
+static const char bin_magic[8] = { 'L', 'A', 'V', 'M', 'A', 'T', '0', '1' };
+
+Mat lav::load_bin(const std::string& path, bool upload_flag)
+{
+	std::ifstream istrm(path, std::ios::binary);
+
+	if (!istrm)
+	{
+		throw std::runtime_error("Load_bin: Could not find file named " + path);
+	}
+
+	char magic[8] = {};
+	uint64_t shape[2] = {};
+
+	if (!istrm.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), bin_magic) || !istrm.read(reinterpret_cast<char*>(shape), sizeof(shape)))
+	{
+		throw std::runtime_error("Load_bin: File " + path + " is not a binary matrix file!");
+	}
+
+	Mat ans(shape[0], shape[1], false);
+
+	if (!istrm.read(reinterpret_cast<char*>(ans.c_buffer.data()), ans.c_buffer.size() * sizeof(float)))
+	{
+		throw std::runtime_error("Load_bin: File " + path + " is truncated!");
+	}
+
+	if (upload_flag)
+	{
+		ans.upload();
+	}
+
+	return std::move(ans);
+}
+
+void lav::save_bin(const std::string& path, const Mat& mat)
+{
+	std::ofstream ostrm(path, std::ios::binary);
+
+	if (!ostrm)
+	{
+		throw std::runtime_error("Save_bin: Could not open file named " + path);
+	}
+
+	std::vector<float> vec;
+	uint64_t shape[2] = { mat.rows, mat.cols };
+
+	Mat::Use use{ mat };
+
+	if (mat.uploaded)
+	{
+		vec.resize(mat.g_buffer.size());
+		Mat::read(mat.g_buffer, vec.data(), vec.size());
+	}
+
+	const auto& data = mat.uploaded ? vec : mat.c_buffer;
+
+	ostrm.write(bin_magic, sizeof(bin_magic));
+	ostrm.write(reinterpret_cast<const char*>(shape), sizeof(shape));
+	ostrm.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(float));
+}
+
+//Read only memory map of a whole file, the loaders read array payloads from it in place.
+class MappedFile
+{
+public:
+
+	const char* data = nullptr;
+	size_t size = 0;
+
+	explicit MappedFile(const std::string& path)
+	{
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			throw std::runtime_error("MappedFile: Could not find file named " + path);
+		}
+
+		LARGE_INTEGER length;
+		GetFileSizeEx(file, &length);
+		size = size_t(length.QuadPart);
+
+		if (size)
+		{
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			data = mapping ? static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+		}
+#else
+		fd = open(path.c_str(), O_RDONLY);
+
+		if (fd < 0)
+		{
+			throw std::runtime_error("MappedFile: Could not find file named " + path);
+		}
+
+		struct stat st;
+		fstat(fd, &st);
+		size = size_t(st.st_size);
+
+		if (size)
+		{
+			void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			data = p == MAP_FAILED ? nullptr : static_cast<const char*>(p);
+		}
+#endif
+		if (size && !data)
+		{
+			release();
+			throw std::runtime_error("MappedFile: Could not map file named " + path);
+		}
+	}
+
+	MappedFile(const MappedFile& another) = delete;
+	MappedFile& operator=(const MappedFile& another) = delete;
+
+	~MappedFile(void)
+	{
+		release();
+	}
+
+private:
+
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+
+	void release(void)
+	{
+#ifdef _WIN32
+		if (data)
+		{
+			UnmapViewOfFile(data);
+		}
+
+		if (mapping)
+		{
+			CloseHandle(mapping);
+		}
+
+		CloseHandle(file);
+#else
+		if (data)
+		{
+			munmap(const_cast<char*>(data), size);
+		}
+
+		close(fd);
+#endif
+	}
+};
+
+struct NpyHeader
+{
+	char kind = 0;//'f', 'i', 'u' or 'b', as in numpy's dtype.kind.
+	size_t itemsize = 0;
+	size_t offset = 0;//Where the payload starts.
+	size_t rows = 0;
+	size_t cols = 0;
+};
+
+//Parses the header of an .npy image. A 1-D array becomes one row and the trailing
+//dimensions of an N-D array are flattened into the columns.
+static NpyHeader parse_npy_header(const char* data, size_t size, const std::string& name)
+{
+	NpyHeader header;
+
+	if (size < 10 || std::memcmp(data, "\x93NUMPY", 6))
+	{
+		throw std::runtime_error("Npy: " + name + " is not an npy file!");
+	}
+
+	size_t length = 0, start = data[6] == 1 ? 10 : 12;
+
+	for (size_t i = start - 1; i >= 8; --i)
+	{
+		length = length << 8 | uint8_t(data[i]);
+	}
+
+	if (start + length > size)
+	{
+		throw std::runtime_error("Npy: The header of " + name + " is truncated!");
+	}
+
+	std::string dict(data + start, length);
+	header.offset = start + length;
+
+	auto&& value = [&](const std::string& key)
+	{
+		size_t pos = dict.find("'" + key + "'");
+
+		if (pos == std::string::npos)
+		{
+			throw std::runtime_error("Npy: The header of " + name + " has no " + key + "!");
+		}
+
+		pos = dict.find(':', pos);
+		return dict.c_str() + dict.find_first_not_of(' ', pos + 1);
+	};
+
+	std::string descr(value("descr") + 1, 3);
+	const char* order = value("fortran_order");
+	const char* shape = value("shape");
+
+	if ((descr[0] != '<' && descr[0] != '|' && descr[0] != '=') || !std::strchr("fiub", descr[1]) || descr[2] < '1' || descr[2] > '8')
+	{
+		throw std::runtime_error("Npy: The dtype " + descr + " of " + name + " is not supported!");
+	}
+
+	header.kind = descr[1];
+	header.itemsize = descr[2] - '0';
+
+	if (header.kind == 'f' && header.itemsize != 4 && header.itemsize != 8)
+	{
+		throw std::runtime_error("Npy: The dtype " + descr + " of " + name + " is not supported!");
+	}
+
+	std::vector<size_t> dims;
+
+	for (const char* p = shape + 1; *p && *p != ')'; ++p)
+	{
+		if (*p >= '0' && *p <= '9')
+		{
+			size_t dim = 0;
+			p = std::from_chars(p, p + 20, dim).ptr - 1;
+			dims.push_back(dim);
+		}
+	}
+
+	if (std::strncmp(order, "True", 4) == 0 && dims.size() > 1)
+	{
+		throw std::runtime_error("Npy: " + name + " is stored in Fortran order, only C order arrays can be loaded!");
+	}
+
+	header.rows = dims.size() > 1 ? dims[0] : 1;
+	header.cols = std::accumulate(dims.begin() + (dims.size() > 1), dims.end(), size_t(1), std::multiplies<size_t>());
+
+	return header;
+}
+
+template<typename T>
+static void convert(const char* src, float* dst, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		T value;
+		std::memcpy(&value, src + i * sizeof(T), sizeof(T));
+		dst[i] = float(value);
+	}
+}
+
+Mat Mat::from_npy(const char* data, size_t size, const std::string& name, bool upload_flag)
+{
+	NpyHeader header = parse_npy_header(data, size, name);
+
+	const char* payload = data + header.offset;
+	size_t n = header.rows * header.cols;
+
+	if (header.offset + n * header.itemsize > size)
+	{
+		throw std::runtime_error("Npy: The datas of " + name + " are truncated!");
+	}
+
+	Mat ans(header.rows, header.cols, upload_flag && header.kind == 'f' && header.itemsize == 4);
+	std::vector<float> vec;
+
+	if (header.kind == 'f' && header.itemsize == 4)
+	{
+		if (upload_flag)
+		{
+			Mat::write(ans.g_buffer, reinterpret_cast<const float*>(payload), n);
+		}
+		else
+		{
+			std::memcpy(ans.c_buffer.data(), payload, n * sizeof(float));
+		}
+
+		return std::move(ans);
+	}
+
+	float* dst = ans.c_buffer.data();
+
+	switch (header.kind * 16 + header.itemsize)
+	{
+	case 'f' * 16 + 8: convert<double>(payload, dst, n); break;
+	case 'i' * 16 + 1: convert<int8_t>(payload, dst, n); break;
+	case 'i' * 16 + 2: convert<int16_t>(payload, dst, n); break;
+	case 'i' * 16 + 4: convert<int32_t>(payload, dst, n); break;
+	case 'i' * 16 + 8: convert<int64_t>(payload, dst, n); break;
+	case 'u' * 16 + 1: convert<uint8_t>(payload, dst, n); break;
+	case 'b' * 16 + 1: convert<uint8_t>(payload, dst, n); break;
+	case 'u' * 16 + 2: convert<uint16_t>(payload, dst, n); break;
+	case 'u' * 16 + 4: convert<uint32_t>(payload, dst, n); break;
+	case 'u' * 16 + 8: convert<uint64_t>(payload, dst, n); break;
+	default: throw std::runtime_error("Npy: The dtype of " + name + " is not supported!");
+	}
+
+	if (upload_flag)
+	{
+		ans.upload();
+	}
+
+	return std::move(ans);
+}
+
+//Builds the .npy header of a float32 C order matrix, padded so that the datas are 64 bytes aligned.
+static std::string npy_header(const Mat& mat)
+{
+	std::string dict = "{'descr': '<f4', 'fortran_order': False, 'shape': (" + std::to_string(mat.rows) + ", " + std::to_string(mat.cols) + "), }";
+	dict.append(63 - (10 + dict.size()) % 64, ' ');
+	dict.push_back('\n');
+
+	std::string header("\x93NUMPY\x01\x00", 8);
+	header.push_back(char(dict.size() & 0xFF));
+	header.push_back(char(dict.size() >> 8));
+
+	return header + dict;
+}
+
+Mat lav::load_npy(const std::string& path, bool upload_flag)
+{
+	MappedFile file(path);
+	return Mat::from_npy(file.data, file.size, path, upload_flag);
+}
+
+void lav::save_npy(const std::string& path, const Mat& mat)
+{
+	std::ofstream ostrm(path, std::ios::binary);
+
+	if (!ostrm)
+	{
+		throw std::runtime_error("Save_npy: Could not open file named " + path);
+	}
+
+	std::string header = npy_header(mat);
+	std::vector<float> vec;
+
+	Mat::Use use{ mat };
+
+	if (mat.uploaded)
+	{
+		vec.resize(mat.g_buffer.size());
+		Mat::read(mat.g_buffer, vec.data(), vec.size());
+	}
+
+	const auto& data = mat.uploaded ? vec : mat.c_buffer;
+
+	ostrm.write(header.data(), header.size());
+	ostrm.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(float));
+}
+
+static uint32_t crc32(uint32_t crc, const char* data, size_t size)
+{
+	static const auto table = []
+	{
+		std::vector<uint32_t> table(256);
+
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t c = i;
+
+			for (int k = 0; k < 8; ++k)
+			{
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			}
+
+			table[i] = c;
+		}
+
+		return table;
+	}();
+
+	crc = ~crc;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		crc = table[(crc ^ uint8_t(data[i])) & 0xFF] ^ (crc >> 8);
+	}
+
+	return ~crc;
+}
+
+template<typename T>
+static T read_le(const char* p)
+{
+	T value = 0;
+
+	for (size_t i = 0; i < sizeof(T); ++i)
+	{
+		value |= T(uint8_t(p[i])) << (8 * i);
+	}
+
+	return value;
+}
+
+template<typename T>
+static void write_le(std::string& out, T value)
+{
+	for (size_t i = 0; i < sizeof(T); ++i)
+	{
+		out.push_back(char(uint64_t(value) >> (8 * i) & 0xFF));
+	}
+}
+
+std::map<std::string, Mat> lav::load_npz(const std::string& path, bool upload_flag)
+{
+	MappedFile file(path);
+	const char* data = file.data;
+
+	//Find the end of central directory record, it is followed by a comment of at most 64 KB.
+	size_t eocd = file.size >= 22 ? file.size - 22 : SIZE_MAX;
+
+	while (eocd != SIZE_MAX && read_le<uint32_t>(data + eocd) != 0x06054b50)
+	{
+		eocd = eocd && file.size - eocd < 22 + 0xFFFF ? eocd - 1 : SIZE_MAX;
+	}
+
+	if (eocd == SIZE_MAX)
+	{
+		throw std::runtime_error("Load_npz: " + path + " is not a zip file!");
+	}
+
+	uint64_t entries = read_le<uint16_t>(data + eocd + 10);
+	uint64_t cd = read_le<uint32_t>(data + eocd + 16);
+
+	if ((entries == 0xFFFF || cd == 0xFFFFFFFF) && eocd >= 20 && read_le<uint32_t>(data + eocd - 20) == 0x07064b50)
+	{
+		uint64_t eocd64 = read_le<uint64_t>(data + eocd - 12);
+
+		if (eocd64 + 56 > file.size || read_le<uint32_t>(data + eocd64) != 0x06064b50)
+		{
+			throw std::runtime_error("Load_npz: The zip64 directory of " + path + " is broken!");
+		}
+
+		entries = read_le<uint64_t>(data + eocd64 + 32);
+		cd = read_le<uint64_t>(data + eocd64 + 48);
+	}
+
+	std::map<std::string, Mat> ans;
+
+	for (uint64_t i = 0, p = cd; i < entries; ++i)
+	{
+		if (p + 46 > file.size || read_le<uint32_t>(data + p) != 0x02014b50)
+		{
+			throw std::runtime_error("Load_npz: The central directory of " + path + " is broken!");
+		}
+
+		uint16_t method = read_le<uint16_t>(data + p + 10);
+		uint64_t size = read_le<uint32_t>(data + p + 24);
+		uint64_t local = read_le<uint32_t>(data + p + 42);
+		uint16_t name_length = read_le<uint16_t>(data + p + 28);
+		uint16_t extra_length = read_le<uint16_t>(data + p + 30);
+		uint16_t comment_length = read_le<uint16_t>(data + p + 32);
+		std::string name(data + p + 46, name_length);
+
+		//Sizes and offsets that do not fit in 32 bits are moved to the zip64 extra field.
+		for (const char* e = data + p + 46 + name_length; e + 4 <= data + p + 46 + name_length + extra_length; e += 4 + read_le<uint16_t>(e + 2))
+		{
+			if (read_le<uint16_t>(e) == 0x0001)
+			{
+				const char* q = e + 4;
+
+				if (size == 0xFFFFFFFF)
+				{
+					size = read_le<uint64_t>(q);
+					q += 8;
+				}
+
+				if (read_le<uint32_t>(data + p + 20) == 0xFFFFFFFF)
+				{
+					q += 8;
+				}
+
+				if (local == 0xFFFFFFFF)
+				{
+					local = read_le<uint64_t>(q);
+				}
+			}
+		}
+
+		if (method != 0)
+		{
+			throw std::runtime_error("Load_npz: " + name + " in " + path + " is compressed, only files written by numpy.savez can be loaded!");
+		}
+
+		if (local + 30 > file.size || read_le<uint32_t>(data + local) != 0x04034b50)
+		{
+			throw std::runtime_error("Load_npz: The local header of " + name + " in " + path + " is broken!");
+		}
+
+		uint64_t offset = local + 30 + read_le<uint16_t>(data + local + 26) + read_le<uint16_t>(data + local + 28);
+
+		if (offset + size > file.size)
+		{
+			throw std::runtime_error("Load_npz: " + name + " in " + path + " is truncated!");
+		}
+
+		if (name.size() > 4 && name.compare(name.size() - 4, 4, ".npy") == 0)
+		{
+			name.resize(name.size() - 4);
+		}
+
+		ans.emplace(name, Mat::from_npy(data + offset, size, path + ":" + name, upload_flag));
+		p += 46 + name_length + extra_length + comment_length;
+	}
+
+	return ans;
+}
+
+void lav::save_npz(const std::string& path, const std::map<std::string, Mat>& mats)
+{
+	std::ofstream ostrm(path, std::ios::binary);
+
+	if (!ostrm)
+	{
+		throw std::runtime_error("Save_npz: Could not open file named " + path);
+	}
+
+	std::string directory;
+	uint64_t offset = 0;
+
+	for (const auto& [key, mat] : mats)
+	{
+		std::string name = key + ".npy";
+		std::string header = npy_header(mat);
+		std::vector<float> vec;
+
+		Mat::Use use{ mat };
+
+		if (mat.uploaded)
+		{
+			vec.resize(mat.g_buffer.size());
+			Mat::read(mat.g_buffer, vec.data(), vec.size());
+		}
+
+		const auto& data = mat.uploaded ? vec : mat.c_buffer;
+		uint64_t size = header.size() + data.size() * sizeof(float);
+		uint32_t crc = crc32(crc32(0, header.data(), header.size()), reinterpret_cast<const char*>(data.data()), data.size() * sizeof(float));
+
+		if (size >= 0xFFFFFFFF || offset >= 0xFFFFFFFF)
+		{
+			throw std::runtime_error("Save_npz: " + path + " would need zip64, save arrays this large with save_npy!");
+		}
+
+		//The local header and the central directory entry share everything from the version on.
+		std::string common;
+		write_le<uint16_t>(common, 20);//Version needed to extract.
+		write_le<uint16_t>(common, 0);//Flags.
+		write_le<uint16_t>(common, 0);//Stored.
+		write_le<uint16_t>(common, 0);//Time.
+		write_le<uint16_t>(common, 0x21);//Date, 1980-1-1.
+		write_le<uint32_t>(common, crc);
+		write_le<uint32_t>(common, uint32_t(size));
+		write_le<uint32_t>(common, uint32_t(size));
+		write_le<uint16_t>(common, uint16_t(name.size()));
+		write_le<uint16_t>(common, 0);//Extra field length.
+
+		std::string local;
+		write_le<uint32_t>(local, 0x04034b50);
+		local += common + name + header;
+
+		write_le<uint32_t>(directory, 0x02014b50);
+		write_le<uint16_t>(directory, 20);//Version made by.
+		directory += common;
+		write_le<uint16_t>(directory, 0);//Comment length.
+		write_le<uint16_t>(directory, 0);//Disk number.
+		write_le<uint16_t>(directory, 0);//Internal attributes.
+		write_le<uint32_t>(directory, 0);//External attributes.
+		write_le<uint32_t>(directory, uint32_t(offset));
+		directory += name;
+
+		ostrm.write(local.data(), local.size());
+		ostrm.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(float));
+		offset += local.size() + data.size() * sizeof(float);
+	}
+
+	std::string end;
+	write_le<uint32_t>(end, 0x06054b50);
+	write_le<uint16_t>(end, 0);
+	write_le<uint16_t>(end, 0);
+	write_le<uint16_t>(end, uint16_t(mats.size()));
+	write_le<uint16_t>(end, uint16_t(mats.size()));
+	write_le<uint32_t>(end, uint32_t(directory.size()));
+	write_le<uint32_t>(end, uint32_t(offset));
+	write_le<uint16_t>(end, 0);
+
+	ostrm.write(directory.data(), directory.size());
+	ostrm.write(end.data(), end.size());
+}
+
+BatchReader::BatchReader(const std::string& path, size_t batch_rows, char delimiter, bool upload_flag, bool shuffle_flag, size_t depth) :
+	rows(0), cols(0), batch_rows(batch_rows), path(path), delimiter(delimiter), binary(false), upload_flag(upload_flag), shuffle_flag(shuffle_flag), slots(std::max<size_t>(depth, 1))
+{
+	if (!batch_rows)
+	{
+		throw std::runtime_error("BatchReader: Batch size must be greater than 0!");
+	}
+
+	std::ifstream istrm(path, std::ios::binary);
+
+	if (!istrm)
+	{
+		throw std::runtime_error("BatchReader: Could not find file named " + path);
+	}
+
+	char magic[8] = {};
+	uint64_t shape[2] = {};
+	offsets.push_back(0);
+
+	if (istrm.read(magic, sizeof(magic)) && std::equal(magic, magic + sizeof(magic), bin_magic) && istrm.read(reinterpret_cast<char*>(shape), sizeof(shape)))
+	{
+		binary = true;
+		rows = shape[0];
+		cols = shape[1];
+		offsets[0] = sizeof(magic) + sizeof(shape);
+	}
+	else if (std::memcmp(magic, "\x93NUMPY", 6) == 0)
+	{
+		std::vector<char> text(1 << 16);
+		istrm.clear();
+		istrm.seekg(0);
+		istrm.read(text.data(), text.size());
+
+		NpyHeader header = parse_npy_header(text.data(), istrm.gcount(), path);
+
+		if (header.kind != 'f' || header.itemsize != 4)
+		{
+			throw std::runtime_error("BatchReader: Only float32 npy files can be streamed, " + path + " is not!");
+		}
+
+		binary = true;
+		rows = header.rows;
+		cols = header.cols;
+		offsets[0] = header.offset;
+	}
+	else
+	{
+		//Index the text once, so that any batch can be read without scanning the file again.
+		std::string line;
+		istrm.clear();
+		istrm.seekg(0);
+		std::getline(istrm, line);
+		cols = line.empty() || line == "\r" ? 0 : count_fields(line.data(), line.data() + line.size(), delimiter);
+
+		std::vector<char> block(1 << 22);
+		size_t start = 0, base = 0;
+		bool done = false;
+		char prev = '\n';
+
+		istrm.clear();
+		istrm.seekg(0);
+
+		while (!done)
+		{
+			istrm.read(block.data(), block.size());
+			size_t n = istrm.gcount();
+
+			for (size_t i = 0; i < n && !done; ++i)
+			{
+				if (block[i] == '\n')
+				{
+					size_t end = base + i;
+					done = end == start || (end == start + 1 && prev == '\r');
+
+					if (!done && ++rows % batch_rows == 0)
+					{
+						offsets.push_back(end + 1);
+					}
+
+					start = done ? start : end + 1;
+				}
+
+				prev = block[i];
+			}
+
+			if (!n)
+			{
+				break;
+			}
+
+			base += n;
+		}
+
+		if (!done && base > start)
+		{
+			++rows;
+			start = base;
+		}
+
+		if (offsets.back() != start)
+		{
+			offsets.push_back(start);
+		}
+	}
+
+	for (size_t row = batch_rows; binary && row < rows + batch_rows; row += batch_rows)
+	{
+		offsets.push_back(offsets[0] + std::min(row, rows) * cols * sizeof(float));
+	}
+
+	for (auto& slot : slots)
+	{
+		size_t bytes = batch_rows * cols * sizeof(float);
+
+		if (upload_flag && bytes)
+		{
+			slot.pinned = boc::buffer(Mat::context, bytes, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR);
+			slot.data = static_cast<float*>(Mat::queue.enqueue_map_buffer(slot.pinned, CL_MAP_READ | CL_MAP_WRITE, 0, bytes));
+		}
+		else
+		{
+			slot.buffer.resize(batch_rows * cols);
+			slot.data = slot.buffer.data();
+		}
+	}
+
+	order.resize(offsets.size() - 1);
+	std::iota(order.begin(), order.end(), 0);
+	transfer = boc::command_queue(Mat::context, Mat::device);
+
+	start();
+}
+
+BatchReader::~BatchReader(void)
+{
+	finish();
+
+	for (auto& slot : slots)
+	{
+		if (slot.pinned.get())
+		{
+			Mat::queue.enqueue_unmap_buffer(slot.pinned, slot.data).wait();
+		}
+	}
+}
+
+size_t BatchReader::batches(void) const
+{
+	return order.size();
+}
+
+bool BatchReader::next(Mat& batch)
+{
+	if (consumed == order.size())
+	{
+		return false;
+	}
+
+	if (prefetched)
+	{
+		if (pending_event.get())
+		{
+			pending_event.wait();
+		}
+
+		batch = std::move(pending);
+		prefetched = false;
+	}
+	else
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [&] { return produced > consumed || error; });
+
+			if (produced <= consumed)
+			{
+				std::rethrow_exception(error);
+			}
+		}
+
+		auto& slot = slots[consumed % slots.size()];
+		batch = Mat(slot.rows, cols, upload_flag);
+
+		if (upload_flag && slot.rows * cols)
+		{
+			transfer.enqueue_write_buffer(batch.g_buffer.get_buffer(), 0, slot.rows * cols * sizeof(float), slot.data);
+			Stats::count_transfer(true, slot.rows * cols * sizeof(float));
+		}
+		else if (!upload_flag)
+		{
+			std::copy(slot.data, slot.data + slot.rows * cols, batch.c_buffer.begin());
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		++consumed;
+	}
+
+	cv.notify_all();
+	prefetch();
+
+	return true;
+}
+
+void BatchReader::reset(void)
+{
+	finish();
+	start();
+}
+
+void BatchReader::start(void)
+{
+	if (shuffle_flag)
+	{
+		//Seeded from the global generator, so that the batch order follows manual_seed.
+		auto& generator = Generator::global();
+		const auto r = Generator::philox(generator.seed(), generator.advance(1), 0);
+		std::mt19937_64 e(uint64_t(r[1]) << 32 | r[0]);
+
+		std::shuffle(order.begin(), order.end(), e);
+	}
+
+	stop = false;
+	error = nullptr;
+	produced = consumed = 0;
+	reader = std::thread(&BatchReader::read, this);
+}
+
+void BatchReader::finish(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+
+	cv.notify_all();
+
+	if (reader.joinable())
+	{
+		reader.join();
+	}
+
+	if (prefetched && pending_event.get())
+	{
+		pending_event.wait();
+	}
+
+	prefetched = false;
+}
+
+void BatchReader::read(void)
+{
+	try
+	{
+		std::ifstream istrm(path, std::ios::binary);
+		std::vector<ptrdiff_t> select(cols);
+		std::vector<char> text;
+
+		std::iota(select.begin(), select.end(), 0);
+
+		for (size_t pos = 0; pos < order.size(); ++pos)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&] { return stop || pos - consumed < slots.size(); });
+
+				if (stop)
+				{
+					return;
+				}
+			}
+
+			auto& slot = slots[pos % slots.size()];
+			size_t batch = order[pos];
+
+			slot.rows = std::min(batch_rows, rows - batch * batch_rows);
+			istrm.seekg(offsets[batch]);
+
+			if (binary)
+			{
+				istrm.read(reinterpret_cast<char*>(slot.data), offsets[batch + 1] - offsets[batch]);
+			}
+			else
+			{
+				text.resize(offsets[batch + 1] - offsets[batch]);
+				istrm.read(text.data(), text.size());
+
+				const char* p = text.data();
+				const char* last = text.data() + text.size();
+
+				for (size_t i = 0; i < slot.rows; ++i)
+				{
+					const char* q = line_end(p, last);
+
+					if (size_t(parse_line(p, q, delimiter, select, slot.data + i * cols)) != cols)
+					{
+						throw std::runtime_error("BatchReader: Line " + std::to_string(batch * batch_rows + i + 1) + " of file " + path + " is not a row of " + std::to_string(cols) + " numbers!");
+					}
+
+					p = q + 1;
+				}
+			}
+
+			if (!istrm)
+			{
+				throw std::runtime_error("BatchReader: Failed to read file " + path + "!");
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				produced = pos + 1;
+			}
+
+			cv.notify_all();
+		}
+	}
+	catch (...)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			error = std::current_exception();
+		}
+
+		cv.notify_all();
+	}
+}
+
+void BatchReader::prefetch(void)
+{
+	if (!upload_flag || consumed == order.size())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (produced <= consumed)
+		{
+			return;//Not read yet, next() will upload it when it gets there.
+		}
+	}
+
+	auto& slot = slots[consumed % slots.size()];
+
+	pending = Mat(slot.rows, cols, true);
+	pending_event = slot.rows * cols ? transfer.enqueue_write_buffer_async(pending.g_buffer.get_buffer(), 0, slot.rows * cols * sizeof(float), slot.data) : boc::event();
+	Stats::count_transfer(true, slot.rows * cols * sizeof(float));
+	prefetched = true;
+}
\ No newline at end of file
@@ -0,0 +1,339 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : mask.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : A mask is a matrix read as nonzero or zero, like the
+ *                 ones the comparison operators give back. any and all
+ *                 share one kernel that raises a flag at the first match
+ *                 and whose work items stop once it is raised, so only a
+ *                 single int is read back; count_nonzero sums in local
+ *                 memory and adds one partial count per work group.
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat/lav_mat.h>
+
+#include <algorithm>
+
+using namespace lav;
+namespace boc = boost::compute;
+
+//Enough work groups to fill the device, each walking the matrix with the global stride.
+static size_t groups_of(size_t n, size_t local)
+{
+	return std::max<size_t>(1, std::min((n + local - 1) / local, size_t(Mat::device.compute_units()) * 4));
+}
+
+Mat Mat::select(const Mat& mask, const Mat* a, float a_value, const Mat* b, float b_value)
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global float* mask, __global float* a, __global float* b, __global float* output, float a_value, float b_value, uint a_constant, uint b_constant)
+		{
+			const uint i = get_global_id(0);
+
+			output[i] = mask[i] != 0 ? (a_constant ? a_value : a[i]) : (b_constant ? b_value : b[i]);
+		}
+	);
+
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+	if ((a && (a->rows != mask.rows || a->cols != mask.cols)) || (b && (b->rows != mask.rows || b->cols != mask.cols)))
+	{
+		throw std::runtime_error("Where: Size mismatch between the mask and the matrices!");
+	}
+
+	//A lazy operand is read as its constant, it is never filled.
+	const bool a_constant = !a || a->lazy;
+	const bool b_constant = !b || b->lazy;
+
+	a_value = a && a->lazy ? a->constant : a_value;
+	b_value = b && b->lazy ? b->constant : b_value;
+
+	if (mask.lazy)
+	{
+		const bool take_a = mask.constant != 0;
+
+		if (take_a ? a_constant : b_constant)
+		{
+			return Full(mask.rows, mask.cols, take_a ? a_value : b_value, true);
+		}
+
+		return Mat(take_a ? *a : *b);
+	}
+
+	if (a_constant && b_constant && a_value == b_value)
+	{
+		return Full(mask.rows, mask.cols, a_value, true);
+	}
+
+	const Mat& a_mat = a_constant ? mask : *a;
+	const Mat& b_mat = b_constant ? mask : *b;
+
+	if (Dispatcher::on_host(mask.rows * mask.cols, { mask, a_mat, b_mat }))
+	{
+		Mat ans(mask.rows, mask.cols, false);
+		Use use{ mask, a_mat, b_mat, ans };
+		Profiler::Span span("where", mask.rows, mask.cols);
+
+		const auto& m = mask.host_buffer();
+		const float* a_data = a_mat.host_buffer().data();
+		const float* b_data = b_mat.host_buffer().data();
+
+		for (size_t i = 0; i < m.size(); ++i)
+		{
+			ans.c_buffer[i] = m[i] != 0 ? (a_constant ? a_value : a_data[i]) : (b_constant ? b_value : b_data[i]);
+		}
+
+		return std::move(ans);
+	}
+
+	Mat ans(mask.rows, mask.cols, true);
+	Use use{ mask, a_mat, b_mat, ans };
+
+	if (ans.rows * ans.cols)
+	{
+		Mat::launch("where", fun_kernel, ans.rows * ans.cols, mask.device_buffer(), a_mat.device_buffer(), b_mat.device_buffer(), ans.g_buffer, a_value, b_value, cl_uint(a_constant), cl_uint(b_constant));
+	}
+
+	return std::move(ans);
+}
+
+Mat lav::where(const Mat& mask, const Mat& a, const Mat& b)
+{
+	return Mat::select(mask, &a, 0, &b, 0);
+}
+
+Mat lav::where(const Mat& mask, const Mat& a, float b)
+{
+	return Mat::select(mask, &a, 0, nullptr, b);
+}
+
+Mat lav::where(const Mat& mask, float a, const Mat& b)
+{
+	return Mat::select(mask, nullptr, a, &b, 0);
+}
+
+void lav::masked_fill_(Mat& mat, const Mat& mask, float value)
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global float* output, __global float* mask, float value)
+		{
+			const uint i = get_global_id(0);
+
+			if (mask[i] != 0)
+			{
+				output[i] = value;
+			}
+		}
+	);
+
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+	if (mat.rows != mask.rows || mat.cols != mask.cols)
+	{
+		throw std::runtime_error("Masked_fill_: Size mismatch between the matrix and the mask!");
+	}
+
+	if (mask.lazy)
+	{
+		if (mask.constant != 0)
+		{
+			fill_(mat, value);
+		}
+
+		return;
+	}
+
+	Mat::Use use{ mat, mask };
+
+	mat.invalidate();
+
+	if (mat.rows * mat.cols == 0)
+	{
+		return;
+	}
+
+	if (mat.uploaded)
+	{
+		Mat::launch("masked_fill_", fun_kernel, mat.rows * mat.cols, mat.g_buffer, mask.device_buffer(), value);
+	}
+	else
+	{
+		const auto& m = mask.host_buffer();
+
+		for (size_t i = 0; i < m.size(); ++i)
+		{
+			if (m[i] != 0)
+			{
+				mat.c_buffer[i] = value;
+			}
+		}
+	}
+}
+
+bool Mat::find(const Mat& mat, bool zero)
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global float* input, volatile __global int* flag, uint n, uint zero)
+		{
+			for (uint i = get_global_id(0); i < n; i += get_global_size(0))
+			{
+				if (*flag)
+				{
+					return;
+				}
+
+				if ((input[i] == 0) == zero)
+				{
+					*flag = 1;
+					return;
+				}
+			}
+		}
+	);
+
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+	const size_t n = mat.rows * mat.cols;
+
+	if (mat.lazy)
+	{
+		return n && (mat.constant == 0) == zero;
+	}
+
+	Graph::unsupported(zero ? "All" : "Any");
+
+	Use use{ mat };
+
+	if (Dispatcher::on_host(n, { mat }))
+	{
+		Profiler::Span span(zero ? "all" : "any", mat.rows, mat.cols);
+		const auto& input = mat.host_buffer();
+
+		return std::find_if(input.begin(), input.end(), [&](float x) { return (x == 0) == zero; }) != input.end();
+	}
+
+	if (n == 0)
+	{
+		return false;
+	}
+
+	boc::vector<cl_int> flag(size_t(1), cl_int(0), Mat::queue);
+	cl_int value = 0;
+
+	Mat::launch(zero ? "all" : "any", fun_kernel, groups_of(n, 256) * 256, mat.device_buffer(), flag, cl_uint(n), cl_uint(zero));
+
+	boc::copy_n(flag.begin(), 1, &value, Mat::queue);
+
+	return value != 0;
+}
+
+bool lav::any(const Mat& mat)
+{
+	return Mat::find(mat, false);
+}
+
+bool lav::all(const Mat& mat)
+{
+	return !Mat::find(mat, true);
+}
+
+size_t lav::count_nonzero(const Mat& mat)
+{
+	static const char source[] = "#define GROUP 256\n" BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global float* input, __global uint* total, uint n)
+		{
+			__local uint cache[GROUP];
+
+			const uint l = get_local_id(0);
+
+			uint count = 0;
+
+			for (uint i = get_global_id(0); i < n; i += get_global_size(0))
+			{
+				count += input[i] != 0;
+			}
+
+			cache[l] = count;
+
+			barrier(CLK_LOCAL_MEM_FENCE);
+
+			for (uint half = get_local_size(0) / 2; half > 0; half /= 2)
+			{
+				if (l < half)
+				{
+					cache[l] += cache[l + half];
+				}
+
+				barrier(CLK_LOCAL_MEM_FENCE);
+			}
+
+			if (l == 0)
+			{
+				atomic_add(total, cache[0]);
+			}
+		}
+	);
+
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+	const size_t n = mat.rows * mat.cols;
+
+	if (mat.lazy)
+	{
+		return mat.constant != 0 ? n : 0;
+	}
+
+	Graph::unsupported("Count_nonzero");
+
+	Mat::Use use{ mat };
+
+	if (Dispatcher::on_host(n, { mat }))
+	{
+		Profiler::Span span("count_nonzero", mat.rows, mat.cols);
+		const auto& input = mat.host_buffer();
+
+		return input.size() - std::count(input.begin(), input.end(), 0.0f);
+	}
+
+	if (n == 0)
+	{
+		return 0;
+	}
+
+	const size_t local = Mat::group_size(fun_kernel);
+	boc::vector<cl_uint> total(size_t(1), cl_uint(0), Mat::queue);
+	cl_uint value = 0;
+
+	Mat::launch_groups("count_nonzero", fun_kernel, groups_of(n, local), local, mat.device_buffer(), total, cl_uint(n));
+
+	boc::copy_n(total.begin(), 1, &value, Mat::queue);
+
+	return value;
+}
\ No newline at end of file
@@ -18,7 +18,10 @@
  * Author        : (Rihothy)
  * File name     : math.cpp
  * Version       : 1.0
- * Last modified : 2020-4-10
+ * Last modified : 2026-10-18
+ * Describe      : The activations run as one kernel each, forward and
+ *                 backward, instead of being composed from exp and the
+ *                 operators with a launch and a temporary per step.
  *
  * See https://github.com/rihothy/lav_mat to get source code.
  * ************************************************************************/
@@ -28,6 +31,36 @@
 using namespace lav;
 namespace boc = boost::compute;
 
+float Mat::host_op(const boc::exp<float>&, float a, float)
+{
+	return std::exp(a);
+}
+
+float Mat::host_op(const boc::fabs<float>&, float a, float)
+{
+	return std::fabs(a);
+}
+
+float Mat::host_op(const boc::log<float>&, float a, float)
+{
+	return std::log(a);
+}
+
+float Mat::host_op(const boc::log2<float>&, float a, float)
+{
+	return std::log2(a);
+}
+
+float Mat::host_op(const boc::log10<float>&, float a, float)
+{
+	return std::log10(a);
+}
+
+float Mat::host_op(const boc::sqrt<float>&, float a, float)
+{
+	return std::sqrt(a);
+}
+
 Mat lav::exp(const Mat& mat)
 {
 	return Mat::unary_op(mat, boc::exp<float>());
@@ -61,4 +94,292 @@ Mat lav::sqrt(const Mat& mat)
 Mat lav::pow(const Mat& mat, const float& th)
 {
 	return Mat::unary_op(mat, boc::lambda::pow(boc::lambda::_1, th));
+}
+
+static const char* const activation_names[] = { "relu", "leaky_relu", "elu", "sigmoid", "tanh", "gelu", "softplus", "swish" };
+static const char* const activation_backward_names[] = { "relu_backward", "leaky_relu_backward", "elu_backward", "sigmoid_backward", "tanh_backward", "gelu_backward", "softplus_backward", "swish_backward" };
+
+static const char activation_source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+(
+	float sigmoid(float x)
+	{
+		return x >= 0 ? 1 / (1 + exp(-x)) : exp(x) / (1 + exp(x));
+	}
+
+	float activate(uint type, float x, float alpha)
+	{
+		switch (type)
+		{
+		case 0:
+			return max(x, 0.0f);
+		case 1:
+			return x > 0 ? x : alpha * x;
+		case 2:
+			return x > 0 ? x : alpha * expm1(x);
+		case 3:
+			return sigmoid(x);
+		case 4:
+			return tanh(x);
+		case 5:
+			return 0.5f * x * (1 + tanh(0.7978845608f * (x + 0.044715f * x * x * x)));
+		case 6:
+			return max(x, 0.0f) + log1p(exp(-fabs(x)));
+		default:
+			return x * sigmoid(x);
+		}
+	}
+
+	//Sigmoid and tanh are given their output y, the others their input x.
+	float derive(uint type, float x, float alpha)
+	{
+		switch (type)
+		{
+		case 0:
+			return x > 0;
+		case 1:
+			return x > 0 ? 1 : alpha;
+		case 2:
+			return x > 0 ? 1 : alpha * exp(x);
+		case 3:
+			return x * (1 - x);
+		case 4:
+			return 1 - x * x;
+		case 5:
+		{
+			const float t = tanh(0.7978845608f * (x + 0.044715f * x * x * x));
+			return 0.5f * (1 + t) + 0.5f * x * (1 - t * t) * 0.7978845608f * (1 + 0.134145f * x * x);
+		}
+		case 6:
+			return sigmoid(x);
+		default:
+		{
+			const float s = sigmoid(x);
+			return s + x * s * (1 - s);
+		}
+		}
+	}
+
+	__kernel void forward(__global float* input, __global float* output, uint type, float alpha)
+	{
+		const uint i = get_global_id(0);
+
+		output[i] = activate(type, input[i], alpha);
+	}
+
+	__kernel void backward(__global float* grad, __global float* input, __global float* output, uint type, float alpha)
+	{
+		const uint i = get_global_id(0);
+
+		output[i] = grad[i] * derive(type, input[i], alpha);
+	}
+);
+
+static float host_sigmoid(float x)
+{
+	return x >= 0 ? 1 / (1 + std::exp(-x)) : std::exp(x) / (1 + std::exp(x));
+}
+
+static float host_activate(size_t type, float x, float alpha)
+{
+	switch (type)
+	{
+	case 0:
+		return std::max(x, 0.0f);
+	case 1:
+		return x > 0 ? x : alpha * x;
+	case 2:
+		return x > 0 ? x : alpha * std::expm1(x);
+	case 3:
+		return host_sigmoid(x);
+	case 4:
+		return std::tanh(x);
+	case 5:
+		return 0.5f * x * (1 + std::tanh(0.7978845608f * (x + 0.044715f * x * x * x)));
+	case 6:
+		return std::max(x, 0.0f) + std::log1p(std::exp(-std::fabs(x)));
+	default:
+		return x * host_sigmoid(x);
+	}
+}
+
+static float host_derive(size_t type, float x, float alpha)
+{
+	switch (type)
+	{
+	case 0:
+		return float(x > 0);
+	case 1:
+		return x > 0 ? 1 : alpha;
+	case 2:
+		return x > 0 ? 1 : alpha * std::exp(x);
+	case 3:
+		return x * (1 - x);
+	case 4:
+		return 1 - x * x;
+	case 5:
+	{
+		const float t = std::tanh(0.7978845608f * (x + 0.044715f * x * x * x));
+		return 0.5f * (1 + t) + 0.5f * x * (1 - t * t) * 0.7978845608f * (1 + 0.134145f * x * x);
+	}
+	case 6:
+		return host_sigmoid(x);
+	default:
+	{
+		const float s = host_sigmoid(x);
+		return s + x * s * (1 - s);
+	}
+	}
+}
+
+Mat Mat::activate(const Mat& mat, size_t type, float alpha)
+{
+	static boc::program fun_program = Mat::build(activation_source);
+	thread_local boc::kernel fun_kernel(fun_program, "forward");
+
+	if (mat.lazy)
+	{
+		return Full(mat.rows, mat.cols, host_activate(type, mat.constant, alpha), true);
+	}
+
+	if (Dispatcher::on_host(mat.rows * mat.cols, { mat }))
+	{
+		Mat ans(mat.rows, mat.cols, false);
+		Use use{ mat, ans };
+		Profiler::Span span(activation_names[type], mat.rows, mat.cols);
+		const auto& input = mat.host_buffer();
+
+		for (size_t i = 0; i < input.size(); ++i)
+		{
+			ans.c_buffer[i] = host_activate(type, input[i], alpha);
+		}
+
+		return std::move(ans);
+	}
+
+	Mat ans(mat.rows, mat.cols, true);
+	Use use{ mat, ans };
+
+	if (ans.rows * ans.cols)
+	{
+		Mat::launch(activation_names[type], fun_kernel, ans.rows * ans.cols, mat.device_buffer(), ans.g_buffer, cl_uint(type), alpha);
+	}
+
+	return std::move(ans);
+}
+
+Mat Mat::activate_backward(const Mat& grad, const Mat& mat, size_t type, float alpha)
+{
+	static boc::program fun_program = Mat::build(activation_source);
+	thread_local boc::kernel fun_kernel(fun_program, "backward");
+
+	if (grad.rows != mat.rows || grad.cols != mat.cols)
+	{
+		throw std::runtime_error(std::string(activation_backward_names[type]) + ": Size mismatch between two matrices!");
+	}
+
+	if (Dispatcher::on_host(grad.rows * grad.cols, { grad, mat }))
+	{
+		Mat ans(grad.rows, grad.cols, false);
+		Use use{ grad, mat, ans };
+		Profiler::Span span(activation_backward_names[type], grad.rows, grad.cols);
+		const auto& g = grad.host_buffer();
+		const auto& input = mat.host_buffer();
+
+		for (size_t i = 0; i < input.size(); ++i)
+		{
+			ans.c_buffer[i] = g[i] * host_derive(type, input[i], alpha);
+		}
+
+		return std::move(ans);
+	}
+
+	Mat ans(grad.rows, grad.cols, true);
+	Use use{ grad, mat, ans };
+
+	if (ans.rows * ans.cols)
+	{
+		Mat::launch(activation_backward_names[type], fun_kernel, ans.rows * ans.cols, grad.device_buffer(), mat.device_buffer(), ans.g_buffer, cl_uint(type), alpha);
+	}
+
+	return std::move(ans);
+}
+
+Mat lav::relu(const Mat& mat)
+{
+	return Mat::activate(mat, 0, 0);
+}
+
+Mat lav::leaky_relu(const Mat& mat, float alpha)
+{
+	return Mat::activate(mat, 1, alpha);
+}
+
+Mat lav::elu(const Mat& mat, float alpha)
+{
+	return Mat::activate(mat, 2, alpha);
+}
+
+Mat lav::sigmoid(const Mat& mat)
+{
+	return Mat::activate(mat, 3, 0);
+}
+
+Mat lav::tanh(const Mat& mat)
+{
+	return Mat::activate(mat, 4, 0);
+}
+
+Mat lav::gelu(const Mat& mat)
+{
+	return Mat::activate(mat, 5, 0);
+}
+
+Mat lav::softplus(const Mat& mat)
+{
+	return Mat::activate(mat, 6, 0);
+}
+
+Mat lav::swish(const Mat& mat)
+{
+	return Mat::activate(mat, 7, 0);
+}
+
+Mat lav::relu_backward(const Mat& grad, const Mat& x)
+{
+	return Mat::activate_backward(grad, x, 0, 0);
+}
+
+Mat lav::leaky_relu_backward(const Mat& grad, const Mat& x, float alpha)
+{
+	return Mat::activate_backward(grad, x, 1, alpha);
+}
+
+Mat lav::elu_backward(const Mat& grad, const Mat& x, float alpha)
+{
+	return Mat::activate_backward(grad, x, 2, alpha);
+}
+
+Mat lav::sigmoid_backward(const Mat& grad, const Mat& y)
+{
+	return Mat::activate_backward(grad, y, 3, 0);
+}
+
+Mat lav::tanh_backward(const Mat& grad, const Mat& y)
+{
+	return Mat::activate_backward(grad, y, 4, 0);
+}
+
+Mat lav::gelu_backward(const Mat& grad, const Mat& x)
+{
+	return Mat::activate_backward(grad, x, 5, 0);
+}
+
+Mat lav::softplus_backward(const Mat& grad, const Mat& x)
+{
+	return Mat::activate_backward(grad, x, 6, 0);
+}
+
+Mat lav::swish_backward(const Mat& grad, const Mat& x)
+{
+	return Mat::activate_backward(grad, x, 7, 0);
 }
\ No newline at end of file
@@ -0,0 +1,791 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : norm.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : One work group per row for layer_norm and rms_norm.
+ *                 Each work item keeps the Welford count, mean and sum of
+ *                 squared deviations of its share of the row and the
+ *                 triples are merged in local memory, so the statistics
+ *                 take a single read and do not cancel like the sum of
+ *                 squares minus the square of the sum. The normalized row
+ *                 is written by the same launch.
+ *                 Columns, for batch_norm and the gamma and beta sums, are
+ *                 cut into tiles of rows instead: a work item folds one
+ *                 column of a tile, so neighbouring work items read
+ *                 neighbouring floats, and a second small pass merges the
+ *                 tiles of each column in order.
+ *                 The backward kernels recompute the statistics from x
+ *                 instead of keeping them, one more read of x against
+ *                 nothing to carry between the two passes.
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat/lav_mat.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace lav;
+namespace boc = boost::compute;
+
+static const char source[] = "#define GROUP 256\n" BOOST_COMPUTE_STRINGIZE_SOURCE
+(
+	void welford(__global float* input, uint base, uint n, uint step, __local float* cs, __local float* ms, __local float* vs, float* mean, float* m2)
+	{
+		const uint l = get_local_id(0);
+
+		float c = 0;
+		float m = 0;
+		float v = 0;
+
+		for (uint k = l; k < n; k += get_local_size(0))
+		{
+			const float x = input[base + k * step];
+			const float d = x - m;
+
+			c += 1;
+			m += d / c;
+			v += d * (x - m);
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		cs[l] = c;
+		ms[l] = m;
+		vs[l] = v;
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (uint half = get_local_size(0) / 2; half > 0; half /= 2)
+		{
+			if (l < half && cs[l + half] > 0)
+			{
+				const float ca = cs[l];
+				const float cb = cs[l + half];
+				const float cc = ca + cb;
+				const float d = ms[l + half] - ms[l];
+
+				ms[l] += d * cb / cc;
+				vs[l] += vs[l + half] + d * d * ca * cb / cc;
+				cs[l] = cc;
+			}
+
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+
+		*mean = ms[0];
+		*m2 = vs[0];
+	}
+
+	float total(float value, __local float* cache)
+	{
+		const uint l = get_local_id(0);
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		cache[l] = value;
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (uint half = get_local_size(0) / 2; half > 0; half /= 2)
+		{
+			if (l < half)
+			{
+				cache[l] += cache[l + half];
+			}
+
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+
+		return cache[0];
+	}
+
+	//The mean and rstd of a row, where rms_norm takes the mean as zero.
+	void row_stats(__global float* input, uint base, uint n, float eps, uint rms, __local float* cs, __local float* ms, __local float* vs, float* mean, float* rstd)
+	{
+		if (rms)
+		{
+			float s = 0;
+
+			for (uint k = get_local_id(0); k < n; k += get_local_size(0))
+			{
+				s += input[base + k] * input[base + k];
+			}
+
+			*mean = 0;
+			*rstd = rsqrt(total(s, vs) / n + eps);
+		}
+		else
+		{
+			float m2;
+			welford(input, base, n, 1, cs, ms, vs, mean, &m2);
+			*rstd = rsqrt(m2 / n + eps);
+		}
+	}
+
+	__kernel void mean_var(__global float* input, __global float* mean, __global float* var, uint n, uint step, uint group_step)
+	{
+		__local float cs[GROUP];
+		__local float ms[GROUP];
+		__local float vs[GROUP];
+
+		float m, m2;
+		welford(input, get_group_id(0) * group_step, n, step, cs, ms, vs, &m, &m2);
+
+		if (get_local_id(0) == 0)
+		{
+			mean[get_group_id(0)] = m;
+			var[get_group_id(0)] = m2 / n;
+		}
+	}
+
+	__kernel void layer_norm(__global float* input, __global float* output, __global float* gamma, __global float* beta, uint n, float eps, uint rms)
+	{
+		__local float cs[GROUP];
+		__local float ms[GROUP];
+		__local float vs[GROUP];
+
+		const uint base = get_group_id(0) * n;
+
+		float mean, rstd;
+		row_stats(input, base, n, eps, rms, cs, ms, vs, &mean, &rstd);
+
+		for (uint k = get_local_id(0); k < n; k += get_local_size(0))
+		{
+			output[base + k] = (input[base + k] - mean) * rstd * gamma[k] + (rms ? 0 : beta[k]);
+		}
+	}
+
+	__kernel void layer_norm_backward(__global float* dy, __global float* input, __global float* gamma, __global float* dx, __global float* means, __global float* rstds, uint n, float eps, uint rms)
+	{
+		__local float cs[GROUP];
+		__local float ms[GROUP];
+		__local float vs[GROUP];
+
+		const uint r = get_group_id(0);
+		const uint base = r * n;
+
+		float mean, rstd;
+		row_stats(input, base, n, eps, rms, cs, ms, vs, &mean, &rstd);
+
+		float a = 0;
+		float b = 0;
+
+		for (uint k = get_local_id(0); k < n; k += get_local_size(0))
+		{
+			const float g = dy[base + k] * gamma[k];
+
+			a += g;
+			b += g * (input[base + k] - mean) * rstd;
+		}
+
+		a = rms ? 0 : total(a, ms) / n;
+		b = total(b, vs) / n;
+
+		for (uint k = get_local_id(0); k < n; k += get_local_size(0))
+		{
+			const float xhat = (input[base + k] - mean) * rstd;
+
+			dx[base + k] = rstd * (dy[base + k] * gamma[k] - a - xhat * b);
+		}
+
+		//The column sums for gamma and beta need the statistics of every row.
+		if (get_local_id(0) == 0)
+		{
+			means[r] = mean;
+			rstds[r] = rstd;
+		}
+	}
+
+	//Pass one of the column reductions: work item (c, t) folds the rows of tile t of column c, so
+	//neighbouring work items read neighbouring floats. partial holds two planes of tiles x cols.
+	__kernel void column_welford(__global float* input, __global float* partial, uint rows, uint cols, uint tile, uint tiles)
+	{
+		const uint c = get_global_id(0);
+		const uint t = get_global_id(1);
+		const uint end = min(rows, (t + 1) * tile);
+
+		float k = 0;
+		float m = 0;
+		float v = 0;
+
+		for (uint r = t * tile; r < end; ++r)
+		{
+			const float x = input[r * cols + c];
+			const float d = x - m;
+
+			k += 1;
+			m += d / k;
+			v += d * (x - m);
+		}
+
+		partial[t * cols + c] = m;
+		partial[(tiles + t) * cols + c] = v;
+	}
+
+	//Pass two: merges the tiles of a column in order, into its mean and its variance, or its rstd.
+	__kernel void column_stats(__global float* partial, __global float* mean, __global float* spread, uint rows, uint cols, uint tile, uint tiles, float eps, uint rstd)
+	{
+		const uint c = get_global_id(0);
+
+		float n = 0;
+		float m = 0;
+		float v = 0;
+
+		for (uint t = 0; t < tiles; ++t)
+		{
+			const float nb = min(tile, rows - t * tile);
+			const float nn = n + nb;
+			const float d = partial[t * cols + c] - m;
+
+			m += d * nb / nn;
+			v += partial[(tiles + t) * cols + c] + d * d * n * nb / nn;
+			n = nn;
+		}
+
+		mean[c] = m;
+		spread[c] = rstd ? rsqrt(v / rows + eps) : v / rows;
+	}
+
+	//The sums of dy and of dy * xhat over the rows of a tile, with the statistics of each row for
+	//layer_norm or of each column for batch_norm.
+	__kernel void column_sums(__global float* dy, __global float* input, __global float* mean, __global float* rstd, __global float* partial, uint rows, uint cols, uint tile, uint tiles, uint per_row)
+	{
+		const uint c = get_global_id(0);
+		const uint t = get_global_id(1);
+		const uint end = min(rows, (t + 1) * tile);
+
+		float a = 0;
+		float b = 0;
+
+		for (uint r = t * tile; r < end; ++r)
+		{
+			const uint i = r * cols + c;
+			const uint s = per_row ? r : c;
+
+			a += dy[i];
+			b += dy[i] * (input[i] - mean[s]) * rstd[s];
+		}
+
+		partial[t * cols + c] = a;
+		partial[(tiles + t) * cols + c] = b;
+	}
+
+	__kernel void column_totals(__global float* partial, __global float* dgamma, __global float* dbeta, uint cols, uint tiles)
+	{
+		const uint c = get_global_id(0);
+
+		float a = 0;
+		float b = 0;
+
+		for (uint t = 0; t < tiles; ++t)
+		{
+			a += partial[t * cols + c];
+			b += partial[(tiles + t) * cols + c];
+		}
+
+		dgamma[c] = b;
+		dbeta[c] = a;
+	}
+
+	//While training mean and var are the batch statistics, and the work items of the first row also
+	//move the running ones; otherwise they are the running ones.
+	__kernel void batch_norm(__global float* input, __global float* output, __global float* gamma, __global float* beta, __global float* mean, __global float* var, __global float* running_mean, __global float* running_var, uint n, uint cols, float momentum, float eps, uint training)
+	{
+		const uint i = get_global_id(0);
+		const uint c = i % cols;
+
+		output[i] = (input[i] - mean[c]) * rsqrt(var[c] + eps) * gamma[c] + beta[c];
+
+		if (training && i < cols)
+		{
+			running_mean[c] = (1 - momentum) * running_mean[c] + momentum * mean[c];
+			running_var[c] = (1 - momentum) * running_var[c] + momentum * (n > 1 ? var[c] * n / (n - 1) : var[c]);
+		}
+	}
+
+	__kernel void batch_norm_backward(__global float* dy, __global float* input, __global float* gamma, __global float* mean, __global float* rstd, __global float* dgamma, __global float* dbeta, __global float* dx, uint n, uint cols)
+	{
+		const uint i = get_global_id(0);
+		const uint c = i % cols;
+		const float xhat = (input[i] - mean[c]) * rstd[c];
+
+		dx[i] = gamma[c] * rstd[c] * (dy[i] - dbeta[c] / n - xhat * dgamma[c] / n);
+	}
+);
+
+static void host_welford(const float* input, size_t n, size_t step, float& mean, float& m2)
+{
+	mean = 0;
+	m2 = 0;
+
+	for (size_t k = 0; k < n; ++k)
+	{
+		const float x = input[k * step];
+		const float d = x - mean;
+
+		mean += d / (k + 1);
+		m2 += d * (x - mean);
+	}
+}
+
+static void host_row_stats(const float* input, size_t n, float eps, bool rms, float& mean, float& rstd)
+{
+	float m2 = 0;
+
+	if (rms)
+	{
+		mean = 0;
+
+		for (size_t k = 0; k < n; ++k)
+		{
+			m2 += input[k] * input[k];
+		}
+	}
+	else
+	{
+		host_welford(input, n, 1, mean, m2);
+	}
+
+	rstd = 1 / std::sqrt(m2 / n + eps);
+}
+
+static void check_features(const char* name, const Mat& x, const Mat& param)
+{
+	if (param.rows * param.cols != x.cols)
+	{
+		throw std::runtime_error(std::string(name) + ": Parameters must have one value per column of x!");
+	}
+}
+
+Mat lav::mean_var(const Mat& mat, Mat& var, bool axis)
+{
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "mean_var");
+	thread_local boc::kernel welford_kernel(fun_program, "column_welford");
+	thread_local boc::kernel stats_kernel(fun_program, "column_stats");
+
+	const size_t count = axis ? mat.rows : mat.cols;
+	const size_t n = axis ? mat.cols : mat.rows;
+	const size_t step = axis ? 1 : mat.cols;
+	const size_t group_step = axis ? mat.cols : 1;
+	const size_t out_rows = axis ? count : 1;
+	const size_t out_cols = axis ? 1 : count;
+
+	if (mat.lazy)
+	{
+		var = Full(out_rows, out_cols, 0, true);
+		return Full(out_rows, out_cols, mat.constant, true);
+	}
+
+	if (Dispatcher::on_host(2 * mat.rows * mat.cols, { mat }))
+	{
+		Mat mean(out_rows, out_cols, false);
+		Mat v(out_rows, out_cols, false);
+		Mat::Use use{ mat, mean, v };
+		Profiler::Span span("mean_var", mat.rows, mat.cols);
+		const float* input = mat.host_buffer().data();
+
+		for (size_t g = 0; g < count; ++g)
+		{
+			float m2;
+			host_welford(input + g * group_step, n, step, mean.c_buffer[g], m2);
+			v.c_buffer[g] = m2 / n;
+		}
+
+		var = std::move(v);
+
+		return std::move(mean);
+	}
+
+	Mat mean(out_rows, out_cols, true);
+	Mat v(out_rows, out_cols, true);
+	Mat::Use use{ mat, mean, v };
+
+	//Columns are folded by tiles of rows, a group per column would read them with a stride. Empty
+	//columns keep the group kernel, which gives them the NaN variance of the host path.
+	if (count && (axis || n == 0))
+	{
+		Mat::launch_groups("mean_var", fun_kernel, count, Mat::group_size(fun_kernel), mat.device_buffer(), mean.g_buffer, v.g_buffer, cl_uint(n), cl_uint(step), cl_uint(group_step));
+	}
+	else if (count)
+	{
+		const size_t tile = Mat::tile_rows(n, count);
+		const size_t tiles = (n + tile - 1) / tile;
+		boc::vector<float> partial(2 * tiles * count, Mat::context);
+
+		Mat::launch("mean_var", welford_kernel, { count, tiles }, mat.device_buffer(), partial, cl_uint(n), cl_uint(count), cl_uint(tile), cl_uint(tiles));
+		Mat::launch("mean_var", stats_kernel, count, partial, mean.g_buffer, v.g_buffer, cl_uint(n), cl_uint(count), cl_uint(tile), cl_uint(tiles), 0.0f, cl_uint(0));
+	}
+
+	var = std::move(v);
+
+	return std::move(mean);
+}
+
+Mat Mat::layer_norm_op(const Mat& x, const Mat& gamma, const Mat* beta, float eps)
+{
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "layer_norm");
+
+	const bool rms = !beta;
+	const char* name = rms ? "rms_norm" : "layer_norm";
+
+	check_features(rms ? "Rms_norm" : "Layer_norm", x, gamma);
+
+	if (beta)
+	{
+		check_features("Layer_norm", x, *beta);
+	}
+
+	const Mat& b = beta ? *beta : gamma;
+
+	if (Dispatcher::on_host(4 * x.rows * x.cols, { x, gamma, b }))
+	{
+		Mat ans(x.rows, x.cols, false);
+		Use use{ x, gamma, b, ans };
+		Profiler::Span span(name, x.rows, x.cols);
+		const float* input = x.host_buffer().data();
+		const float* g = gamma.host_buffer().data();
+		const float* bias = b.host_buffer().data();
+
+		for (size_t r = 0; r < x.rows; ++r)
+		{
+			const float* line = input + r * x.cols;
+
+			float mean, rstd;
+			host_row_stats(line, x.cols, eps, rms, mean, rstd);
+
+			for (size_t k = 0; k < x.cols; ++k)
+			{
+				ans.c_buffer[r * x.cols + k] = (line[k] - mean) * rstd * g[k] + (rms ? 0 : bias[k]);
+			}
+		}
+
+		return std::move(ans);
+	}
+
+	Mat ans(x.rows, x.cols, true);
+	Use use{ x, gamma, b, ans };
+
+	if (ans.rows * ans.cols)
+	{
+		//rms_norm has no beta, gamma stands in for it and is not read.
+		Mat::launch_groups(name, fun_kernel, x.rows, Mat::group_size(fun_kernel), x.device_buffer(), ans.g_buffer, gamma.device_buffer(), b.device_buffer(), cl_uint(x.cols), eps, cl_uint(rms));
+	}
+
+	return std::move(ans);
+}
+
+Mat Mat::layer_norm_backward_op(const Mat& dy, const Mat& x, const Mat& gamma, Mat& dgamma, Mat* dbeta, float eps)
+{
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "layer_norm_backward");
+	thread_local boc::kernel sums_kernel(fun_program, "column_sums");
+	thread_local boc::kernel totals_kernel(fun_program, "column_totals");
+
+	const bool rms = !dbeta;
+	const char* name = rms ? "rms_norm_backward" : "layer_norm_backward";
+
+	check_features(rms ? "Rms_norm_backward" : "Layer_norm_backward", x, gamma);
+
+	if (dy.rows != x.rows || dy.cols != x.cols)
+	{
+		throw std::runtime_error(std::string(rms ? "Rms_norm_backward" : "Layer_norm_backward") + ": Size mismatch between dy and x!");
+	}
+
+	if (Dispatcher::on_host(8 * x.rows * x.cols, { dy, x, gamma }))
+	{
+		Mat dx(x.rows, x.cols, false);
+		Mat dg(1, x.cols, std::vector<float>(x.cols, 0), false);
+		Mat db(1, x.cols, std::vector<float>(x.cols, 0), false);
+		Use use{ dy, x, gamma, dx, dg, db };
+		Profiler::Span span(name, x.rows, x.cols);
+		const float* d = dy.host_buffer().data();
+		const float* input = x.host_buffer().data();
+		const float* g = gamma.host_buffer().data();
+
+		for (size_t r = 0; r < x.rows; ++r)
+		{
+			const float* line = input + r * x.cols;
+			const float* grad = d + r * x.cols;
+
+			float mean, rstd, a = 0, b = 0;
+			host_row_stats(line, x.cols, eps, rms, mean, rstd);
+
+			for (size_t k = 0; k < x.cols; ++k)
+			{
+				const float xhat = (line[k] - mean) * rstd;
+
+				a += grad[k] * g[k];
+				b += grad[k] * g[k] * xhat;
+				dg.c_buffer[k] += grad[k] * xhat;
+				db.c_buffer[k] += grad[k];
+			}
+
+			a = rms ? 0 : a / x.cols;
+			b /= x.cols;
+
+			for (size_t k = 0; k < x.cols; ++k)
+			{
+				dx.c_buffer[r * x.cols + k] = rstd * (grad[k] * g[k] - a - (line[k] - mean) * rstd * b);
+			}
+		}
+
+		dgamma = std::move(dg);
+
+		if (dbeta)
+		{
+			*dbeta = std::move(db);
+		}
+
+		return std::move(dx);
+	}
+
+	Mat dx(x.rows, x.cols, true);
+	Mat dg(1, x.cols, true);
+	Mat db(1, x.cols, true);
+	Use use{ dy, x, gamma, dx, dg, db };
+
+	if (x.rows * x.cols)
+	{
+		const size_t tile = Mat::tile_rows(x.rows, x.cols);
+		const size_t tiles = (x.rows + tile - 1) / tile;
+		boc::vector<float> means(x.rows, Mat::context);
+		boc::vector<float> rstds(x.rows, Mat::context);
+		boc::vector<float> partial(2 * tiles * x.cols, Mat::context);
+
+		Mat::launch_groups(name, fun_kernel, x.rows, Mat::group_size(fun_kernel), dy.device_buffer(), x.device_buffer(), gamma.device_buffer(), dx.g_buffer, means, rstds, cl_uint(x.cols), eps, cl_uint(rms));
+		Mat::launch(name, sums_kernel, { x.cols, tiles }, dy.device_buffer(), x.device_buffer(), means, rstds, partial, cl_uint(x.rows), cl_uint(x.cols), cl_uint(tile), cl_uint(tiles), cl_uint(1));
+		Mat::launch(name, totals_kernel, x.cols, partial, dg.g_buffer, db.g_buffer, cl_uint(x.cols), cl_uint(tiles));
+	}
+	else
+	{
+		fill_(dg, 0);
+		fill_(db, 0);
+	}
+
+	dgamma = std::move(dg);
+
+	if (dbeta)
+	{
+		*dbeta = std::move(db);
+	}
+
+	return std::move(dx);
+}
+
+Mat lav::layer_norm(const Mat& x, const Mat& gamma, const Mat& beta, float eps)
+{
+	return Mat::layer_norm_op(x, gamma, &beta, eps);
+}
+
+Mat lav::layer_norm_backward(const Mat& dy, const Mat& x, const Mat& gamma, Mat& dgamma, Mat& dbeta, float eps)
+{
+	return Mat::layer_norm_backward_op(dy, x, gamma, dgamma, &dbeta, eps);
+}
+
+Mat lav::rms_norm(const Mat& x, const Mat& gamma, float eps)
+{
+	return Mat::layer_norm_op(x, gamma, nullptr, eps);
+}
+
+Mat lav::rms_norm_backward(const Mat& dy, const Mat& x, const Mat& gamma, Mat& dgamma, float eps)
+{
+	return Mat::layer_norm_backward_op(dy, x, gamma, dgamma, nullptr, eps);
+}
+
+Mat lav::batch_norm(const Mat& x, const Mat& gamma, const Mat& beta, Mat& running_mean, Mat& running_var, bool training, float momentum, float eps)
+{
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "batch_norm");
+	thread_local boc::kernel welford_kernel(fun_program, "column_welford");
+	thread_local boc::kernel stats_kernel(fun_program, "column_stats");
+
+	check_features("Batch_norm", x, gamma);
+	check_features("Batch_norm", x, beta);
+	check_features("Batch_norm", x, running_mean);
+	check_features("Batch_norm", x, running_var);
+
+	if (Dispatcher::on_host(4 * x.rows * x.cols, { x, gamma, beta, running_mean, running_var }))
+	{
+		Mat ans(x.rows, x.cols, false);
+		Mat::Use use{ x, gamma, beta, running_mean, running_var, ans };
+		Profiler::Span span("batch_norm", x.rows, x.cols);
+		const float* input = x.host_buffer().data();
+		const float* g = gamma.host_buffer().data();
+		const float* b = beta.host_buffer().data();
+
+		if (training)
+		{
+			running_mean.download();
+			running_var.download();
+			running_mean.invalidate();
+			running_var.invalidate();
+		}
+
+		const float* rm = running_mean.host_buffer().data();
+		const float* rv = running_var.host_buffer().data();
+
+		for (size_t c = 0; c < x.cols; ++c)
+		{
+			float mean = rm[c], var = rv[c];
+
+			if (training)
+			{
+				float m2;
+				host_welford(input + c, x.rows, x.cols, mean, m2);
+				var = m2 / x.rows;
+
+				running_mean.c_buffer[c] = (1 - momentum) * rm[c] + momentum * mean;
+				running_var.c_buffer[c] = (1 - momentum) * rv[c] + momentum * (x.rows > 1 ? m2 / (x.rows - 1) : var);
+			}
+
+			const float scale = g[c] / std::sqrt(var + eps);
+
+			for (size_t k = 0; k < x.rows; ++k)
+			{
+				ans.c_buffer[c + k * x.cols] = (input[c + k * x.cols] - mean) * scale + b[c];
+			}
+		}
+
+		return std::move(ans);
+	}
+
+	Mat ans(x.rows, x.cols, true);
+	Mat::Use use{ x, gamma, beta, running_mean, running_var, ans };
+
+	if (training)
+	{
+		running_mean.upload();
+		running_var.upload();
+		running_mean.invalidate();
+		running_var.invalidate();
+	}
+
+	if (ans.rows * ans.cols && training)
+	{
+		const size_t tile = Mat::tile_rows(x.rows, x.cols);
+		const size_t tiles = (x.rows + tile - 1) / tile;
+		boc::vector<float> mean(x.cols, Mat::context);
+		boc::vector<float> var(x.cols, Mat::context);
+		boc::vector<float> partial(2 * tiles * x.cols, Mat::context);
+
+		Mat::launch("batch_norm", welford_kernel, { x.cols, tiles }, x.device_buffer(), partial, cl_uint(x.rows), cl_uint(x.cols), cl_uint(tile), cl_uint(tiles));
+		Mat::launch("batch_norm", stats_kernel, x.cols, partial, mean, var, cl_uint(x.rows), cl_uint(x.cols), cl_uint(tile), cl_uint(tiles), 0.0f, cl_uint(0));
+		Mat::launch("batch_norm", fun_kernel, x.rows * x.cols, x.device_buffer(), ans.g_buffer, gamma.device_buffer(), beta.device_buffer(), mean, var, running_mean.device_buffer(), running_var.device_buffer(), cl_uint(x.rows), cl_uint(x.cols), momentum, eps, cl_uint(1));
+	}
+	else if (ans.rows * ans.cols)
+	{
+		Mat::launch("batch_norm", fun_kernel, x.rows * x.cols, x.device_buffer(), ans.g_buffer, gamma.device_buffer(), beta.device_buffer(), running_mean.device_buffer(), running_var.device_buffer(), running_mean.device_buffer(), running_var.device_buffer(), cl_uint(x.rows), cl_uint(x.cols), momentum, eps, cl_uint(0));
+	}
+
+	return std::move(ans);
+}
+
+Mat lav::batch_norm_backward(const Mat& dy, const Mat& x, const Mat& gamma, Mat& dgamma, Mat& dbeta, float eps)
+{
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "batch_norm_backward");
+	thread_local boc::kernel welford_kernel(fun_program, "column_welford");
+	thread_local boc::kernel stats_kernel(fun_program, "column_stats");
+	thread_local boc::kernel sums_kernel(fun_program, "column_sums");
+	thread_local boc::kernel totals_kernel(fun_program, "column_totals");
+
+	check_features("Batch_norm_backward", x, gamma);
+
+	if (dy.rows != x.rows || dy.cols != x.cols)
+	{
+		throw std::runtime_error("Batch_norm_backward: Size mismatch between dy and x!");
+	}
+
+	if (Dispatcher::on_host(6 * x.rows * x.cols, { dy, x, gamma }))
+	{
+		Mat dx(x.rows, x.cols, false);
+		Mat dg(1, x.cols, false);
+		Mat db(1, x.cols, false);
+		Mat::Use use{ dy, x, gamma, dx, dg, db };
+		Profiler::Span span("batch_norm_backward", x.rows, x.cols);
+		const float* d = dy.host_buffer().data();
+		const float* input = x.host_buffer().data();
+		const float* g = gamma.host_buffer().data();
+		const size_t n = x.rows;
+
+		for (size_t c = 0; c < x.cols; ++c)
+		{
+			float mean, m2, a = 0, b = 0;
+			host_welford(input + c, n, x.cols, mean, m2);
+
+			const float rstd = 1 / std::sqrt(m2 / n + eps);
+
+			for (size_t k = 0; k < n; ++k)
+			{
+				a += d[c + k * x.cols];
+				b += d[c + k * x.cols] * (input[c + k * x.cols] - mean) * rstd;
+			}
+
+			dg.c_buffer[c] = b;
+			db.c_buffer[c] = a;
+
+			for (size_t k = 0; k < n; ++k)
+			{
+				const float xhat = (input[c + k * x.cols] - mean) * rstd;
+
+				dx.c_buffer[c + k * x.cols] = g[c] * rstd * (d[c + k * x.cols] - a / n - xhat * b / n);
+			}
+		}
+
+		dgamma = std::move(dg);
+		dbeta = std::move(db);
+
+		return std::move(dx);
+	}
+
+	Mat dx(x.rows, x.cols, true);
+	Mat dg(1, x.cols, true);
+	Mat db(1, x.cols, true);
+	Mat::Use use{ dy, x, gamma, dx, dg, db };
+
+	if (x.rows * x.cols)
+	{
+		const size_t tile = Mat::tile_rows(x.rows, x.cols);
+		const size_t tiles = (x.rows + tile - 1) / tile;
+		boc::vector<float> mean(x.cols, Mat::context);
+		boc::vector<float> rstd(x.cols, Mat::context);
+		boc::vector<float> partial(2 * tiles * x.cols, Mat::context);
+
+		Mat::launch("batch_norm_backward", welford_kernel, { x.cols, tiles }, x.device_buffer(), partial, cl_uint(x.rows), cl_uint(x.cols), cl_uint(tile), cl_uint(tiles));
+		Mat::launch("batch_norm_backward", stats_kernel, x.cols, partial, mean, rstd, cl_uint(x.rows), cl_uint(x.cols), cl_uint(tile), cl_uint(tiles), eps, cl_uint(1));
+		Mat::launch("batch_norm_backward", sums_kernel, { x.cols, tiles }, dy.device_buffer(), x.device_buffer(), mean, rstd, partial, cl_uint(x.rows), cl_uint(x.cols), cl_uint(tile), cl_uint(tiles), cl_uint(0));
+		Mat::launch("batch_norm_backward", totals_kernel, x.cols, partial, dg.g_buffer, db.g_buffer, cl_uint(x.cols), cl_uint(tiles));
+		Mat::launch("batch_norm_backward", fun_kernel, x.rows * x.cols, dy.device_buffer(), x.device_buffer(), gamma.device_buffer(), mean, rstd, dg.g_buffer, db.g_buffer, dx.g_buffer, cl_uint(x.rows), cl_uint(x.cols));
+	}
+	else if (x.cols)
+	{
+		fill_(dg, 0);
+		fill_(db, 0);
+	}
+
+	dgamma = std::move(dg);
+	dbeta = std::move(db);
+
+	return std::move(dx);
+}
\ No newline at end of file
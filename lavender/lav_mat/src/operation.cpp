@@ -18,7 +18,7 @@
  * Author        : (Rihothy)
  * File name     : operation.cpp
  * Version       : 1.0
- * Last modified : 2020-4-10
+ * Last modified : 2026-10-18
  *
  * See https://github.com/rihothy/lav_mat to get source code.
  * ************************************************************************/
@@ -30,11 +30,20 @@ namespace boc = boost::compute;
 
 void Mat::upload(void)
 {
-    if (!uploaded && !c_buffer.empty())
+    if (lazy)
+    {
+        uploaded = true;
+        return;
+    }
+
+    evicted = false;
+
+    if (!uploaded && !mirrored && !c_buffer.empty())
     {
         try
         {
-            g_buffer.assign(c_buffer.begin(), c_buffer.end(), Mat::queue);
+            allocate(c_buffer.size());
+            write(g_buffer, c_buffer.data(), c_buffer.size());
         }
         catch (...)
         {
@@ -42,20 +51,128 @@ void Mat::upload(void)
         }
     }
 
+    mirrored = mirrored || !uploaded;//c_buffer is kept, it still holds the same datas.
     uploaded = true;
 }
 
 void Mat::download(void)
 {
-    if (uploaded)
+    if (lazy)
+    {
+        uploaded = false;
+        return;
+    }
+
+    evicted = false;
+
+    if (uploaded && !mirrored)
     {
         c_buffer.resize(g_buffer.size());
-        boc::copy(g_buffer.begin(), g_buffer.end(), c_buffer.begin(), Mat::queue);
+        read(g_buffer, c_buffer.data(), g_buffer.size());
+        track();
     }
 
+    mirrored = mirrored || uploaded;//g_buffer is kept as well.
     uploaded = false;
 }
 
+void Mat::offload(void)
+{
+    if (!Dispatcher::on_host(rows * cols, { *this }))
+    {
+        upload();
+    }
+}
+
+void Mat::invalidate(void) const
+{
+    mirrored = false;
+}
+
+void Mat::materialize(bool fill) const
+{
+    if (lazy)
+    {
+        if (uploaded)
+        {
+            allocate(rows * cols);
+
+            if (fill && rows * cols)
+            {
+                boc::fill(g_buffer.begin(), g_buffer.end(), constant, Mat::queue);
+                Graph::record_fill(g_buffer, constant);
+            }
+        }
+        else
+        {
+            fill ? c_buffer.assign(rows * cols, constant) : c_buffer.resize(rows * cols);
+            track();
+        }
+
+        lazy = false;
+    }
+}
+
+void Mat::allocate(size_t size) const
+{
+    //boc::vector::resize() leaves room for half as much again, which only pays off for buffers that grow.
+    if (g_buffer.capacity() < size)
+    {
+        make_room(size * sizeof(float), this);
+
+        try
+        {
+            g_buffer = boc::vector<float>(size, Mat::context);
+        }
+        catch (...)
+        {
+            make_room(SIZE_MAX / 2, this);//The budget was too optimistic, evict whatever is idle and try once more.
+            g_buffer = boc::vector<float>(size, Mat::context);
+        }
+
+        track();
+    }
+    else
+    {
+        g_buffer.resize(size, Mat::queue);
+    }
+}
+
+void Mat::grow(size_t size)
+{
+    if (g_buffer.capacity() < size)
+    {
+        make_room(size * sizeof(float) * 3 / 2);
+    }
+
+    g_buffer.resize(size, Mat::queue);
+    track();
+}
+
+void Mat::reserve(size_t rows, size_t cols)
+{
+    Graph::unsupported("Reserve");
+
+    Use use{ *this };
+
+    if (!uploaded)
+    {
+        c_buffer.reserve(rows * cols);
+        track();
+    }
+    else if (g_buffer.capacity() < rows * cols)
+    {
+        make_room(rows * cols * sizeof(float));
+
+        boc::vector<float> temp(rows * cols, Mat::context);
+
+        boc::copy(g_buffer.begin(), g_buffer.end(), temp.begin(), Mat::queue);
+        temp.resize(g_buffer.size(), Mat::queue);
+        g_buffer = std::move(temp);
+        track();
+    }
+}
+
 Mat Mat::row(size_t row)
 {
     upload();
@@ -67,7 +184,13 @@ Mat Mat::row(size_t row) const
 {
     if (row < rows)
     {
+        if (lazy)
+        {
+            return Full(1, cols, constant, true);
+        }
+
         Mat ans(1, cols, true);
+        Use use{ *this, ans };
 
         if (uploaded)
         {
@@ -75,7 +198,7 @@ Mat Mat::row(size_t row) const
         }
         else
         {
-            ans.g_buffer.assign(c_buffer.begin() + row * cols, c_buffer.begin() + (row + 1) * cols, Mat::queue);
+            write(ans.g_buffer, c_buffer.data() + row * cols, cols);
         }
 
         return std::move(ans);
@@ -113,30 +236,47 @@ Mat& Mat::reshape(size_t rows, size_t cols)
 
 void Mat::push_back(const Mat& another)
 {
+    Graph::unsupported("Push_back");
+
     if (!cols || another.cols == cols)
     {
-        cols = another.cols;
-        rows += another.rows;
+        Use use{ *this, another };
+
+        const size_t size = rows * cols;
+        const size_t n = another.rows * another.cols;
 
         if (another.uploaded)
         {
             upload();
+        }
 
-            g_buffer.insert(g_buffer.end(), another.g_buffer.begin(), another.g_buffer.end(), Mat::queue);
+        cols = another.cols;
+        rows += another.rows;
 
-            uploaded = true;
-        }
-        else
+        //Both buffers grow geometrically, so a stream of appends costs amortized O(1) per element.
+        if (uploaded)
         {
-            if (uploaded)
+            grow(size + n);
+
+            if (another.uploaded)
             {
-                g_buffer.insert(g_buffer.end(), another.c_buffer.begin(), another.c_buffer.end(), Mat::queue);
+                boc::copy(another.g_buffer.begin(), another.g_buffer.begin() + n, g_buffer.begin() + size, Mat::queue);
             }
             else
             {
-                c_buffer.insert(c_buffer.end(), another.c_buffer.begin(), another.c_buffer.end());
+                boc::copy(another.c_buffer.begin(), another.c_buffer.begin() + n, g_buffer.begin() + size, Mat::queue);
+                Stats::count_transfer(true, n * sizeof(float));
             }
         }
+        else
+        {
+            c_buffer.resize(size + n);
+            std::copy(another.c_buffer.begin(), another.c_buffer.begin() + n, c_buffer.begin() + size);
+            track();
+        }
+
+        //After the upload, which marks c_buffer as a mirror: only one side has the appended rows.
+        invalidate();
     }
     else
     {
@@ -148,16 +288,25 @@ void Mat::push_back(const std::initializer_list<float>& vec)
 {
     if (!cols || vec.size() == cols)
     {
+        Use use{ *this };
+
+        invalidate();
+
+        const size_t size = rows * cols;
+
         cols = vec.size();
         ++rows;
 
         if (uploaded)
         {
-            g_buffer.insert(g_buffer.end(), vec.begin(), vec.end(), Mat::queue);
+            grow(size + vec.size());
+            boc::copy(vec.begin(), vec.end(), g_buffer.begin() + size, Mat::queue);
+            Stats::count_transfer(true, vec.size() * sizeof(float));
         }
         else
         {
             c_buffer.insert(c_buffer.end(), vec.begin(), vec.end());
+            track();
         }
     }
     else
@@ -166,13 +315,175 @@ void Mat::push_back(const std::initializer_list<float>& vec)
     }
 }
 
+void Mat::push_right(const Mat& another)
+{
+    if (!rows || another.rows == rows)
+    {
+        Use use{ *this, another };
+
+        invalidate();
+
+        if (uploaded || another.uploaded)
+        {
+            //Rows are stored contiguously, so the matrix is rewritten once into a buffer of the new width.
+            *this = stack({ this, &another }, false);
+        }
+        else
+        {
+            const size_t n = another.cols;
+
+            rows = another.rows;
+            c_buffer.resize(rows * (cols + n));
+
+            //In place from the last row to the first, no row is overwritten before it has been moved.
+            for (size_t i = rows - 1; i < rows; --i)
+            {
+                std::copy_backward(c_buffer.begin() + i * cols, c_buffer.begin() + (i + 1) * cols, c_buffer.begin() + i * (cols + n) + cols);
+                std::copy(another.c_buffer.begin() + i * n, another.c_buffer.begin() + (i + 1) * n, c_buffer.begin() + i * (cols + n) + cols);
+            }
+
+            cols += n;
+            track();
+        }
+    }
+    else
+    {
+        throw std::runtime_error("Push_right: The number of rows of two matrices must be the same!");
+    }
+}
+
+void Mat::push_right(const std::initializer_list<float>& vec)
+{
+    push_right(Mat(vec.size(), 1, vec, uploaded));
+}
+
+Mat Mat::stack(const std::vector<const Mat*>& mats, bool axis)
+{
+    static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+    (
+        __kernel void fun(__global const float* input, __global float* output, uint cols, uint total, uint offset)
+        {
+            const uint i = get_global_id(0);
+
+            output[i / cols * total + offset + i % cols] = input[i];
+        }
+    );
+
+    static boc::program fun_program = Mat::build(source);
+    thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+    size_t rows = 0, cols = 0, length = 0;
+    bool upload_flag = false;
+
+    for (auto mat : mats)
+    {
+        if (mat->rows * mat->cols == 0)
+        {
+            continue;
+        }
+
+        if ((axis ? cols : rows) && (axis ? mat->cols != cols : mat->rows != rows))
+        {
+            throw std::runtime_error(axis ? "Concat: The number of columns of all matrices must be the same!" : "Concat: The number of rows of all matrices must be the same!");
+        }
+
+        rows = mat->rows;
+        cols = mat->cols;
+        length += axis ? mat->rows : mat->cols;
+        upload_flag = upload_flag || mat->uploaded;
+    }
+
+    Mat ans(axis ? length : rows, axis ? cols : length, upload_flag);
+    Use use{ ans };
+
+    size_t offset = 0;
+
+    for (auto mat : mats)
+    {
+        const size_t n = mat->rows * mat->cols;
+
+        if (n == 0)
+        {
+            continue;
+        }
+
+        Use mat_use{ *mat };
+
+        if (axis && upload_flag)
+        {
+            if (mat->uploaded)
+            {
+                boc::copy(mat->g_buffer.begin(), mat->g_buffer.begin() + n, ans.g_buffer.begin() + offset * cols, Mat::queue);
+                Graph::record_copy(mat->g_buffer, 0, ans.g_buffer, offset * cols, n);
+            }
+            else
+            {
+                boc::copy(mat->c_buffer.begin(), mat->c_buffer.end(), ans.g_buffer.begin() + offset * cols, Mat::queue);
+                Stats::count_transfer(true, n * sizeof(float));
+            }
+        }
+        else if (axis)
+        {
+            std::copy(mat->c_buffer.begin(), mat->c_buffer.end(), ans.c_buffer.begin() + offset * cols);
+        }
+        else if (upload_flag)
+        {
+            Mat::launch("stack", fun_kernel, n, mat->device_buffer(), ans.g_buffer, cl_uint(mat->cols), cl_uint(ans.cols), cl_uint(offset));
+        }
+        else
+        {
+            for (size_t i = 0; i < rows; ++i)
+            {
+                std::copy(mat->c_buffer.begin() + i * mat->cols, mat->c_buffer.begin() + (i + 1) * mat->cols, ans.c_buffer.begin() + i * ans.cols + offset);
+            }
+        }
+
+        offset += axis ? mat->rows : mat->cols;
+    }
+
+    return std::move(ans);
+}
+
+Mat lav::vstack(const std::vector<Mat>& mats)
+{
+    return concat(mats, true);
+}
+
+Mat lav::hstack(const std::vector<Mat>& mats)
+{
+    return concat(mats, false);
+}
+
+Mat lav::concat(const std::vector<Mat>& mats, bool axis)
+{
+    std::vector<const Mat*> temp;
+
+    for (const auto& mat : mats)
+    {
+        temp.push_back(&mat);
+    }
+
+    return Mat::stack(temp, axis);
+}
+
 Mat& Mat::operator=(Mat&& another) noexcept
 {
     if (this != &another)
     {
+        another.mirrored = false;
+
         rows = another.rows;
         cols = another.cols;
         uploaded = another.uploaded;
+        evicted = another.evicted;
+        mirrored = false;
+        lazy = another.lazy;
+        constant = another.constant;
+
+        if (another.lazy)
+        {
+            return *this;
+        }
 
         if (another.uploaded)
         {
@@ -182,6 +493,9 @@ Mat& Mat::operator=(Mat&& another) noexcept
         {
             c_buffer = std::move(another.c_buffer);
         }
+
+        track();
+        another.track();
     }
 
     return *this;
@@ -194,14 +508,26 @@ Mat& Mat::operator=(const Mat& another)
         rows = another.rows;
         cols = another.cols;
         uploaded = another.uploaded;
+        evicted = another.evicted;
+        mirrored = false;
+        lazy = another.lazy;
+        constant = another.constant;
+
+        if (another.lazy)
+        {
+            return *this;
+        }
 
         if (another.uploaded)
         {
-            g_buffer.assign(another.g_buffer.begin(), another.g_buffer.end(), Mat::queue);
+            allocate(another.g_buffer.size());
+            boc::copy(another.g_buffer.begin(), another.g_buffer.end(), g_buffer.begin(), Mat::queue);
+            Graph::record_copy(another.g_buffer, 0, g_buffer, 0, g_buffer.size());
         }
         else
         {
             c_buffer.assign(another.c_buffer.begin(), another.c_buffer.end());
+            track();
         }
     }
 
@@ -211,12 +537,18 @@ Mat& Mat::operator=(const Mat& another)
 float& Mat::operator()(const size_t& row, const size_t& col)
 {
     download();
+    materialize();
+    invalidate();
     return c_buffer[row * cols + col];
 }
 
 float Mat::operator()(const size_t& row, const size_t& col) const
 {
-    if (!uploaded)
+    if (lazy)
+    {
+        return constant;
+    }
+    else if (!uploaded)
     {
         return c_buffer[row * cols + col];
     }
@@ -237,7 +569,7 @@ Mat Mat::operator()(size_t first_row, size_t last_row, size_t first_col, size_t
 {
     static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
     (
-        __kernel void fun(__global float* input, __global float* output, size_t first_row, size_t last_row, size_t first_col, size_t last_col, size_t cols)
+        __kernel void fun(__global float* input, __global float* output, uint first_row, uint last_row, uint first_col, uint last_col, uint cols)
         {
             const uint i = get_global_id(0);
             uint r = i / cols;
@@ -252,8 +584,8 @@ Mat Mat::operator()(size_t first_row, size_t last_row, size_t first_col, size_t
         }
     );
 
-    static boc::program fun_program = boc::program::build_with_source(source, Mat::context);
-    static boc::kernel fun_kernel(fun_program, "fun");
+    static boc::program fun_program = Mat::build(source);
+    thread_local boc::kernel fun_kernel(fun_program, "fun");
 
     if (first_row == last_row && !first_row)
     {
@@ -267,31 +599,20 @@ Mat Mat::operator()(size_t first_row, size_t last_row, size_t first_col, size_t
 
     if (!(last_row > rows || last_col > cols || first_row >= last_row || first_col >= last_col))
     {
+        if (lazy)
+        {
+            return Full(last_row - first_row, last_col - first_col, constant, true);
+        }
+
         Mat ans(last_row - first_row, last_col - first_col, true);
+        Use use{ *this, ans };
 
         auto&& fun = [&](auto& input, auto& output)
         {
-            fun_kernel.set_arg(0, input);
-            fun_kernel.set_arg(1, output);
-            fun_kernel.set_arg(2, first_row);
-            fun_kernel.set_arg(3, last_row);
-            fun_kernel.set_arg(4, first_col);
-            fun_kernel.set_arg(5, last_col);
-            fun_kernel.set_arg(6, cols);
-
-            auto event = Mat::queue.enqueue_1d_range_kernel(fun_kernel, 0, input.size(), 0);
-            event.wait();
+            Mat::launch("operator()", fun_kernel, input.size(), input, output, cl_uint(first_row), cl_uint(last_row), cl_uint(first_col), cl_uint(last_col), cl_uint(cols));
         };
 
-        if (uploaded)
-        {
-            fun(g_buffer, ans.g_buffer);
-        }
-        else
-        {
-            decltype(g_buffer) t_g_buffer(c_buffer.begin(), c_buffer.end(), Mat::queue);
-            fun(t_g_buffer, ans.g_buffer);
-        }
+        fun(device_buffer(), ans.g_buffer);
 
         return std::move(ans);
     }
@@ -312,10 +633,12 @@ std::ostream& lav::operator<<(std::ostream& cout, const Mat& mat)
 {
     std::vector<float> vec;
 
+    Mat::Use use{ mat };
+
     if (mat.uploaded)
     {
         vec.resize(mat.g_buffer.size());
-        boc::copy(mat.g_buffer.begin(), mat.g_buffer.end(), vec.begin(), Mat::queue);
+        Mat::read(mat.g_buffer, vec.data(), vec.size());
     }
 
     cout << std::setiosflags(std::ios::fixed) << std::setprecision(4) << "[";
@@ -344,31 +667,12 @@ std::ostream& lav::operator<<(std::ostream& cout, const Mat& mat)
 
 std::ofstream& lav::operator<<(std::ofstream& out, Mat& mat)
 {
-    mat.download();
     const auto& temp = mat;
     return out << temp;
 }
 
 std::ofstream& lav::operator<<(std::ofstream& out, const Mat& mat)
 {
-    std::vector<float> vec;
-
-    if (mat.uploaded)
-    {
-        vec.resize(mat.g_buffer.size());
-        boc::copy(mat.g_buffer.begin(), mat.g_buffer.end(), vec.begin(), Mat::queue);
-    }
-
-    for (size_t i = 0; i < mat.rows; ++i)
-    {
-        for (size_t j = 0; j < mat.cols; ++j)
-        {
-            auto data = (mat.uploaded ? vec : mat.c_buffer)[i * mat.cols + j];
-            out << data << (j == mat.cols - 1 ? "" : ",");
-        }
-
-        out << std::endl;
-    }
-
+    save_txt(out, mat, ',');
     return out;
 }
\ No newline at end of file
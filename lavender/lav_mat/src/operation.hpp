@@ -18,17 +18,16 @@
  * Author        : (Rihothy)
  * File name     : operation.hpp
  * Version       : 1.0
- * Last modified : 2020-4-10
+ * Last modified : 2026-10-18
  * Describe      : The unary_op function applies the op operation to every
  *                 element of the matrix.
  *                 The unary_op function will perform op operation on two
  *                 matrices and return the new matrix formed by this operation.
  *                 It supports broadcasting. Of course, for coding efficiency,
  *                 I used inefficient broadcasting mechanism.
- *                 These functions will upload data to video RAM. So, when the
- *                 number of data is very small, the performance is not good
- *                 on the CPU. When the amount of data is large, there is a
- *                 lot of time wasted on data transmission.
+ *                 The Dispatcher decides whether they run on the video RAM
+ *                 or on the RAM, where the op is evaluated by HostContext,
+ *                 so small matrices no longer pay for a launch and a copy.
  *
  * See https://github.com/rihothy/lav_mat to get source code.
  * ************************************************************************/
@@ -38,58 +37,358 @@
 
 #include <lav_mat/lav_mat.h>
 
+namespace lav
+{
+    //Evaluates a lambda expression of Boost.Compute on the host: _1 and _2 are the two operands,
+    //the operators are the ones of C++ and the functions of the lambda map to the standard ones.
+    struct HostContext : boost::proto::callable_context<const HostContext>
+    {
+        typedef float result_type;
+
+        float a, b;
+
+        HostContext(float a, float b) :
+            a(a), b(b)
+        {
+
+        }
+
+        float operator()(boost::proto::tag::terminal, boost::compute::lambda::placeholder<0>) const
+        {
+            return a;
+        }
+
+        float operator()(boost::proto::tag::terminal, boost::compute::lambda::placeholder<1>) const
+        {
+            return b;
+        }
+
+        template<typename T>
+        float operator()(boost::proto::tag::terminal, const T& value) const
+        {
+            return float(value);
+        }
+
+        template<typename F, typename A, typename B>
+        float operator()(boost::proto::tag::function, const F& fun, const A& a, const B& b) const
+        {
+            return apply(boost::proto::value(fun), boost::proto::eval(a, *this), boost::proto::eval(b, *this));
+        }
+
+        static float apply(boost::compute::lambda::detail::max_func, float a, float b)
+        {
+            return std::max(a, b);
+        }
+
+        static float apply(boost::compute::lambda::detail::min_func, float a, float b)
+        {
+            return std::min(a, b);
+        }
+
+        static float apply(boost::compute::lambda::detail::pow_func, float a, float b)
+        {
+            return std::pow(a, b);
+        }
+    };
+}
+
 template<typename T>
-static lav::Mat lav::Mat::unary_op(const lav::Mat& mat, T&& op)
+float lav::Mat::host_op(const T& op, float a, float b)
 {
-    Mat ans(mat.rows, mat.cols, true);
+    return boost::proto::eval(op, HostContext(a, b));
+}
 
-    if (ans.rows * ans.cols)
+template<typename T>
+float lav::Mat::constant_op(T&& op, float a)
+{
+    if (Dispatcher::on_host(1, {}))
+    {
+        return host_op(op, a);
+    }
+
+    boost::compute::vector<float> value(size_t(1), a, Mat::queue);
+
+    boost::compute::transform(value.begin(), value.end(), value.begin(), op, Mat::queue);
+    boost::compute::copy_n(value.begin(), 1, &a, Mat::queue);
+
+    return a;
+}
+
+template<typename T>
+float lav::Mat::constant_op(T&& op, float a, float b)
+{
+    if (Dispatcher::on_host(1, {}))
+    {
+        return host_op(op, a, b);
+    }
+
+    float host[2] = { a, b };
+    boost::compute::vector<float> value(host, host + 2, Mat::queue);
+
+    boost::compute::transform(value.begin(), value.begin() + 1, value.begin() + 1, value.begin(), op, Mat::queue);
+    boost::compute::copy_n(value.begin(), 1, &a, Mat::queue);
+
+    return a;
+}
+
+template<typename T>
+size_t lav::Mat::bytes_of(const T&)
+{
+    return 0;
+}
+
+template<typename T>
+size_t lav::Mat::bytes_of(const boost::compute::vector<T>& arg)
+{
+    return arg.size() * sizeof(T);
+}
+
+template<typename... Args>
+void lav::Mat::launch(const char* name, boost::compute::kernel& kernel, size_t global, const Args&... args)
+{
+    size_t index = 0;
+
+    (kernel.set_arg(index++, args), ...);
+
+    if (Graph::capturing())
     {
-        if (mat.uploaded)
+        Graph::record(name, kernel, 1, &global, nullptr, args...);
+    }
+
+    enqueue(name, kernel, 1, &global, (bytes_of(args) + ... + size_t(0)));
+}
+
+template<typename... Args>
+void lav::Mat::launch(const char* name, boost::compute::kernel& kernel, const std::array<size_t, 2>& global, const Args&... args)
+{
+    size_t index = 0;
+
+    (kernel.set_arg(index++, args), ...);
+
+    if (Graph::capturing())
+    {
+        Graph::record(name, kernel, 2, global.data(), nullptr, args...);
+    }
+
+    enqueue(name, kernel, 2, global.data(), (bytes_of(args) + ... + size_t(0)));
+}
+
+template<typename... Args>
+void lav::Mat::launch_groups(const char* name, boost::compute::kernel& kernel, size_t groups, size_t local, const Args&... args)
+{
+    const size_t global = groups * local;
+    size_t index = 0;
+
+    (kernel.set_arg(index++, args), ...);
+
+    if (Graph::capturing())
+    {
+        Graph::record(name, kernel, 1, &global, &local, args...);
+    }
+
+    enqueue(name, kernel, 1, &global, (bytes_of(args) + ... + size_t(0)), &local);
+}
+
+template<typename T>
+auto lav::Graph::keep(const T& op)
+{
+    namespace proto = boost::proto;
+
+    //The operators of a lambda hold their operands by reference, the constants would be gone on replay.
+    //proto::deep_copy would do, but it turns the placeholders into nodes Boost.Compute no longer knows.
+    if constexpr (!proto::is_expr<T>::value)
+    {
+        return op;
+    }
+    else if constexpr (std::is_same<typename proto::tag_of<T>::type, proto::tag::terminal>::value)
+    {
+        using Node = typename proto::terminal<std::decay_t<typename proto::result_of::value<const T&>::type>>::type;
+
+        return boost::compute::lambda::expression<Node>(Node::make(proto::value(op)));
+    }
+    else
+    {
+        return keep(op, std::make_index_sequence<proto::arity_of<T>::value>());
+    }
+}
+
+template<typename T, size_t... I>
+auto lav::Graph::keep(const T& op, std::index_sequence<I...>)
+{
+    return boost::proto::make_expr<typename boost::proto::tag_of<T>::type, boost::compute::lambda::domain>(keep(boost::proto::child_c<I>(op))...);
+}
+
+template<typename T>
+void lav::Graph::hold(const T&)
+{
+
+}
+
+template<typename T>
+void lav::Graph::hold(const boost::compute::vector<T>& arg)
+{
+    buffers.push_back(arg.get_buffer());
+}
+
+template<typename... Args>
+void lav::Graph::record(const char* name, const boost::compute::kernel& kernel, size_t dims, const size_t* global, const size_t* local, const Args&... args)
+{
+    if (std::find(global, global + dims, size_t(0)) != global + dims)
+    {
+        return;
+    }
+
+    boost::compute::kernel node(kernel.get_program(), kernel.name());
+    std::array<size_t, 2> sizes = { global[0], dims > 1 ? global[1] : 1 };
+    std::array<size_t, 2> group = { local ? local[0] : 0, local && dims > 1 ? local[1] : 1 };
+    size_t index = 0;
+
+    (node.set_arg(index++, args), ...);
+    (current->hold(args), ...);
+
+    const bool fixed = local || Tuner::local_size(name, node, dims, sizes.data(), group.data());
+
+    current->commands.push_back([=]
+    {
+        Mat::queue.enqueue_nd_range_kernel(node, dims, nullptr, sizes.data(), fixed ? group.data() : nullptr);
+        Stats::count_launch(name);
+    });
+}
+
+template<typename T, typename... Iterators>
+void lav::Graph::record_transform(const T& op, const Iterators&... iterators)
+{
+    if (capturing())
+    {
+        auto stored = keep(op);
+
+        record([=]
         {
-            boost::compute::transform(mat.g_buffer.begin(), mat.g_buffer.end(), ans.g_buffer.begin(), op, Mat::queue);
-        }
-        else
+            boost::compute::transform(iterators..., stored, Mat::queue);
+        });
+    }
+}
+
+template<typename T>
+lav::Mat lav::Mat::unary_op(const lav::Mat& mat, T&& op)
+{
+    if (mat.lazy)
+    {
+        return Full(mat.rows, mat.cols, constant_op(op, mat.constant), true);
+    }
+
+    if (Dispatcher::on_host(mat.rows * mat.cols, { mat }))
+    {
+        Mat ans(mat.rows, mat.cols, false);
+        Use use{ mat, ans };
+        const auto& input = mat.host_buffer();
+
+        for (size_t i = 0; i < input.size(); ++i)
         {
-            ans.g_buffer.assign(mat.c_buffer.begin(), mat.c_buffer.end(), Mat::queue);
-            boost::compute::transform(ans.g_buffer.begin(), ans.g_buffer.end(), ans.g_buffer.begin(), op, Mat::queue);
+            ans.c_buffer[i] = host_op(op, input[i]);
         }
+
+        return std::move(ans);
+    }
+
+    Mat ans(mat.rows, mat.cols, true);
+    Use use{ mat, ans };
+    Profiler::Span span("unary_op", mat.rows, mat.cols);
+
+    if (ans.rows * ans.cols)
+    {
+        const auto& input = mat.device_buffer();
+
+        boost::compute::transform(input.begin(), input.end(), ans.g_buffer.begin(), op, Mat::queue);
+        Graph::record_transform(op, input.begin(), input.end(), ans.g_buffer.begin());
     }
 
     return std::move(ans);
 }
 
 template<typename T>
-static lav::Mat lav::Mat::binary_op(const lav::Mat& a, const lav::Mat& b, T&& op)
+lav::Mat lav::Mat::binary_op(const lav::Mat& a, const lav::Mat& b, T&& op)
 {
     auto&& fun = [&](const auto& a, const auto& b)
     {
         Mat ans(a.rows, a.cols, true);
+        Use use{ a, b, ans };
+        Profiler::Span span("binary_op", a.rows, a.cols);
 
-        if (a.uploaded && b.uploaded)
-        {
-            boost::compute::transform(a.g_buffer.begin(), a.g_buffer.end(), b.g_buffer.begin(), ans.g_buffer.begin(), op, Mat::queue);
-        }
-        else if (a.uploaded)
+        const auto& a_g_buffer = a.device_buffer();
+        const auto& b_g_buffer = b.device_buffer();
+
+        boost::compute::transform(a_g_buffer.begin(), a_g_buffer.end(), b_g_buffer.begin(), ans.g_buffer.begin(), op, Mat::queue);
+        Graph::record_transform(op, a_g_buffer.begin(), a_g_buffer.end(), b_g_buffer.begin(), ans.g_buffer.begin());
+
+        return std::move(ans);
+    };
+
+    const bool broadcastable = (a.rows == b.rows && (a.cols == b.cols || a.cols == 1 || b.cols == 1)) || (a.cols == b.cols && (a.rows == 1 || b.rows == 1));
+
+    //On the host a broadcast operand is simply read with a zero stride, nothing is expanded.
+    if (broadcastable && !(a.lazy && b.lazy) && Dispatcher::on_host(std::max(a.rows, b.rows) * std::max(a.cols, b.cols), { a, b }))
+    {
+        Mat ans(std::max(a.rows, b.rows), std::max(a.cols, b.cols), false);
+        Use use{ a.lazy ? b : a, b.lazy ? a : b, ans };//A lazy operand is not pinned, it would be filled.
+
+        const float* a_data = a.lazy ? &a.constant : a.host_buffer().data();
+        const float* b_data = b.lazy ? &b.constant : b.host_buffer().data();
+        const size_t a_row = a.rows == 1 || a.lazy ? 0 : a.cols, a_col = a.cols == 1 || a.lazy ? 0 : 1;
+        const size_t b_row = b.rows == 1 || b.lazy ? 0 : b.cols, b_col = b.cols == 1 || b.lazy ? 0 : 1;
+
+        for (size_t r = 0; r < ans.rows; ++r)
         {
-            decltype(b.g_buffer) b_g_buffer(b.c_buffer.begin(), b.c_buffer.end(), Mat::queue);
-            boost::compute::transform(a.g_buffer.begin(), a.g_buffer.end(), b_g_buffer.begin(), ans.g_buffer.begin(), op, Mat::queue);
+            for (size_t c = 0; c < ans.cols; ++c)
+            {
+                ans.c_buffer[r * ans.cols + c] = host_op(op, a_data[r * a_row + c * a_col], b_data[r * b_row + c * b_col]);
+            }
         }
-        else if (b.uploaded)
+
+        return std::move(ans);
+    }
+
+    //A lazy operand is read through a constant iterator, it is never filled.
+    if ((a.lazy || b.lazy) && broadcastable)
+    {
+        const size_t rows = std::max(a.rows, b.rows);
+        const size_t cols = std::max(a.cols, b.cols);
+
+        if (a.lazy && b.lazy)
         {
-            decltype(a.g_buffer) a_g_buffer(a.c_buffer.begin(), a.c_buffer.end(), Mat::queue);
-            boost::compute::transform(a_g_buffer.begin(), a_g_buffer.end(), b.g_buffer.begin(), ans.g_buffer.begin(), op, Mat::queue);
+            return Full(rows, cols, constant_op(op, a.constant, b.constant), true);
         }
-        else
+
+        const auto& c = a.lazy ? b : a;
+
+        if (c.rows == rows && c.cols == cols)
         {
-            decltype(a.g_buffer) a_g_buffer(a.c_buffer.begin(), a.c_buffer.end(), Mat::queue);
-            ans.g_buffer.assign(b.c_buffer.begin(), b.c_buffer.end(), Mat::queue);
+            Mat ans(rows, cols, true);
+            Use use{ c, ans };
 
-            boost::compute::transform(a_g_buffer.begin(), a_g_buffer.end(), ans.g_buffer.begin(), ans.g_buffer.begin(), op, Mat::queue);
+            if (rows * cols)
+            {
+                const auto& input = c.device_buffer();
+                auto first = boost::compute::make_constant_iterator(a.lazy ? a.constant : b.constant, 0);
+                auto last = boost::compute::make_constant_iterator(a.lazy ? a.constant : b.constant, rows * cols);
+
+                if (a.lazy)
+                {
+                    boost::compute::transform(first, last, input.begin(), ans.g_buffer.begin(), op, Mat::queue);
+                    Graph::record_transform(op, first, last, input.begin(), ans.g_buffer.begin());
+                }
+                else
+                {
+                    boost::compute::transform(input.begin(), input.end(), first, ans.g_buffer.begin(), op, Mat::queue);
+                    Graph::record_transform(op, input.begin(), input.end(), first, ans.g_buffer.begin());
+                }
+            }
+
+            return std::move(ans);
         }
+    }
 
-        return std::move(ans);
-    };
+    Use use{ a, b };
 
     if (a.rows == b.rows && a.cols == b.cols)
     {
@@ -99,22 +398,22 @@ static lav::Mat lav::Mat::binary_op(const lav::Mat& a, const lav::Mat& b, T&& op
     {
         if (a.cols == 1)
         {
-            return fun(mul(a, lav::Ones(1, b.cols, true)), b);
+            return fun(broadcast(a, b.rows, b.cols), b);
         }
         else
         {
-            return fun(a, mul(b, lav::Ones(1, a.cols, true)));
+            return fun(a, broadcast(b, a.rows, a.cols));
         }
     }
     else if (a.cols == b.cols && (a.rows == 1 || b.rows == 1))
     {
         if (a.rows == 1)
         {
-            return fun(mul(Ones(b.rows, 1), a, true), b);
+            return fun(broadcast(a, b.rows, b.cols), b);
         }
         else
         {
-            return fun(a, mul(Ones(a.rows, 1, true), b));
+            return fun(a, broadcast(b, a.rows, a.cols));
         }
     }
     else
@@ -0,0 +1,337 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : profiler.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : The queue is created without profiling, which would
+ *                 cost every command, and enable recreates it with
+ *                 profiling, then without it again once switched off. The
+ *                 device clock is lined up with the host clock with one
+ *                 marker when it is enabled, which is close enough to read
+ *                 the stalls between host spans and the commands they
+ *                 send.
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat/lav_mat.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <chrono>
+
+using namespace lav;
+namespace boc = boost::compute;
+
+std::atomic<bool> Profiler::flag(false);
+std::atomic<int64_t> Profiler::offset(0);
+
+struct Timeline
+{
+	std::mutex mutex;
+	std::vector<Profiler::Record> records;
+};
+
+//Never destroyed, like the residency registry.
+static Timeline& timeline(void)
+{
+	static Timeline* timeline = new Timeline;
+	return *timeline;
+}
+
+static std::string escape(const std::string& str)
+{
+	std::string ans;
+
+	for (char ch : str)
+	{
+		if (ch == '"' || ch == '\\')
+		{
+			ans += '\\';
+		}
+
+		ans += ch;
+	}
+
+	return ans;
+}
+
+boc::program Mat::build(const std::string& source)
+{
+	Stats::count_build();
+
+	return boc::program::build_with_source(source, Mat::context);
+}
+
+void Mat::enqueue(const char* name, boc::kernel& kernel, size_t dims, const size_t* global, size_t bytes, const size_t* local)
+{
+	if (std::find(global, global + dims, size_t(0)) != global + dims)
+	{
+		return;
+	}
+
+	size_t tuned_local[2];
+	const bool tuned = !local && Tuner::local_size(name, kernel, dims, global, tuned_local);
+
+	auto event = Mat::queue.enqueue_nd_range_kernel(kernel, dims, nullptr, global, local ? local : tuned ? tuned_local : nullptr);
+	event.wait();
+
+	Stats::count_launch(name);
+
+	if (Profiler::enabled())
+	{
+		std::string shape = std::to_string(global[0]);
+
+		for (size_t i = 1; i < dims; ++i)
+		{
+			shape += "x" + std::to_string(global[i]);
+		}
+
+		Profiler::record(name, "kernel", shape, bytes, event);
+	}
+}
+
+size_t Mat::group_size(const boc::kernel& kernel, size_t limit)
+{
+	limit = std::min(limit, kernel.get_work_group_info<size_t>(Mat::device, CL_KERNEL_WORK_GROUP_SIZE));
+
+	size_t local = 1;
+
+	while (local * 2 <= limit)
+	{
+		local *= 2;
+	}
+
+	return local;
+}
+
+//Enough tiles to fill the device, and few enough that the pass merging them stays small.
+size_t Mat::tile_rows(size_t rows, size_t cols)
+{
+	const size_t items = size_t(Mat::device.compute_units()) * 1024;
+	const size_t tiles = std::max<size_t>(1, std::min((items + cols - 1) / cols, rows / 32));
+
+	return (rows + tiles - 1) / tiles;
+}
+
+void Mat::write(boc::vector<float>& dst, const float* src, size_t n)
+{
+	if (n == 0)
+	{
+		return;
+	}
+
+	auto event = Mat::queue.enqueue_write_buffer(dst.get_buffer(), 0, n * sizeof(float), src);
+
+	Stats::count_transfer(true, n * sizeof(float));
+
+	if (Profiler::enabled())
+	{
+		Profiler::record("upload", "transfer", std::to_string(n), n * sizeof(float), event);
+	}
+}
+
+void Mat::read(const boc::vector<float>& src, float* dst, size_t n)
+{
+	if (n == 0)
+	{
+		return;
+	}
+
+	auto event = Mat::queue.enqueue_read_buffer(src.get_buffer(), 0, n * sizeof(float), dst);
+
+	Stats::count_transfer(false, n * sizeof(float));
+
+	if (Profiler::enabled())
+	{
+		Profiler::record("download", "transfer", std::to_string(n), n * sizeof(float), event);
+	}
+}
+
+uint64_t Profiler::now(void)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t Profiler::thread(void)
+{
+	static std::atomic<size_t> count(0);
+	thread_local size_t id = count++;
+
+	return id;
+}
+
+void Profiler::add(Record record)
+{
+	std::lock_guard<std::mutex> lock(timeline().mutex);
+
+	timeline().records.push_back(std::move(record));
+}
+
+void Profiler::enable(bool flag)
+{
+	Mat(0, 0);//The queue is created along with the first matrix.
+
+	//Off while the queue is swapped, no event of the other queue is read.
+	Profiler::flag = false;
+
+	if (bool(Mat::queue.get_properties() & CL_QUEUE_PROFILING_ENABLE) != flag)
+	{
+		Mat::queue.finish();
+		Mat::queue = flag ? boc::command_queue(Mat::context, Mat::device, boc::command_queue::enable_profiling) : boc::command_queue(Mat::context, Mat::device);
+	}
+
+	if (flag)
+	{
+		auto marker = Mat::queue.enqueue_marker();
+		marker.wait();
+
+		offset = int64_t(now()) - int64_t(marker.get_profiling_info<cl_ulong>(CL_PROFILING_COMMAND_END));
+	}
+
+	Profiler::flag = flag;
+}
+
+bool Profiler::enabled(void)
+{
+	return flag;
+}
+
+void Profiler::clear(void)
+{
+	std::lock_guard<std::mutex> lock(timeline().mutex);
+
+	timeline().records.clear();
+}
+
+std::vector<Profiler::Record> Profiler::records(void)
+{
+	std::lock_guard<std::mutex> lock(timeline().mutex);
+
+	return timeline().records;
+}
+
+void Profiler::record(const std::string& name, const std::string& category, const std::string& shape, size_t bytes, const boc::event& event)
+{
+	if (!enabled())
+	{
+		return;
+	}
+
+	auto host = [&](cl_profiling_info info)
+	{
+		return uint64_t(int64_t(event.get_profiling_info<cl_ulong>(info)) + offset);
+	};
+
+	add({ name, category, shape, bytes, thread(), host(CL_PROFILING_COMMAND_QUEUED), host(CL_PROFILING_COMMAND_SUBMIT), host(CL_PROFILING_COMMAND_START), host(CL_PROFILING_COMMAND_END) });
+}
+
+void Profiler::save_trace(const std::string& path)
+{
+	std::ofstream out(path);
+
+	if (!out)
+	{
+		throw std::runtime_error("Save_trace: Could not open file named " + path);
+	}
+
+	const auto all = records();
+	uint64_t origin = UINT64_MAX;
+
+	for (const auto& record : all)
+	{
+		origin = std::min(origin, std::min(record.queued, record.start));
+	}
+
+	auto us = [&](uint64_t ns)
+	{
+		return (ns - origin) / 1e3;
+	};
+
+	out << std::fixed << std::setprecision(3);
+	out << "{\"traceEvents\":[\n";
+	out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"host\"}},\n";
+	out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"device\"}},\n";
+	out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"commands\"}},\n";
+	out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"spans\"}}";
+
+	//Host spans go on the lane of their thread, device records on one lane for the commands and one for
+	//the spans, since the two overlap. How long a command waited in the queue is kept in its args.
+	for (const auto& record : all)
+	{
+		const bool host = record.category == "host";
+		const size_t tid = host ? record.thread : size_t(record.category == "device");
+
+		out << ",\n{\"name\":\"" << escape(record.name) << "\",\"cat\":\"" << record.category << "\",\"ph\":\"X\"";
+		out << ",\"pid\":" << !host << ",\"tid\":" << tid;
+		out << ",\"ts\":" << us(record.start) << ",\"dur\":" << (record.end - record.start) / 1e3;
+		out << ",\"args\":{\"shape\":\"" << escape(record.shape) << "\",\"bytes\":" << record.bytes << ",\"thread\":" << record.thread;
+
+		if (!host)
+		{
+			out << ",\"queued\":" << us(record.queued) << ",\"submit\":" << us(record.submit);
+			out << ",\"waited\":" << (record.start - record.queued) / 1e3;
+		}
+
+		out << "}}";
+	}
+
+	out << "\n]}\n";
+}
+
+Profiler::Span::Span(const char* name, size_t rows, size_t cols) :
+	name(name), rows(rows), cols(cols), start(0)
+{
+	if (enabled())
+	{
+		start = now();
+		marker = Mat::queue.enqueue_marker();
+	}
+}
+
+Profiler::Span::~Span(void)
+{
+	if (!start || !enabled())
+	{
+		return;
+	}
+
+	const uint64_t end = now();
+	const std::string shape = rows == SIZE_MAX ? "" : cols == SIZE_MAX ? std::to_string(rows) : std::to_string(rows) + "x" + std::to_string(cols);
+
+	add({ name, "host", shape, 0, thread(), start, start, start, end });
+
+	if (marker.get())
+	{
+		try
+		{
+			auto last = Mat::queue.enqueue_marker();
+			last.wait();
+
+			const uint64_t first = uint64_t(int64_t(marker.get_profiling_info<cl_ulong>(CL_PROFILING_COMMAND_END)) + offset);
+			const uint64_t stop = uint64_t(int64_t(last.get_profiling_info<cl_ulong>(CL_PROFILING_COMMAND_END)) + offset);
+
+			add({ name, "device", shape, 0, thread(), first, first, first, std::max(first, stop) });
+		}
+		catch (...)
+		{
+			//A destructor must not throw, the span is only left out of the device lane.
+		}
+	}
+}
\ No newline at end of file
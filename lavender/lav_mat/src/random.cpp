@@ -0,0 +1,331 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : random.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : Philox4x32-10 counter-based random numbers. A value is a
+ *                 pure function of the seed and its counter, the element i
+ *                 of a draw takes the counter offset + i and the generator
+ *                 only moves its offset forward by the size of the draw.
+ *                 So the same seed gives the same matrix on the video RAM
+ *                 and on the RAM, draws can run in parallel without any
+ *                 shared state, and fills reuse the existing buffer.
+ *                 Uniforms take the top 24 bits of a word and are bitwise
+ *                 identical on both sides; normals go through log and cos,
+ *                 which OpenCL only bounds to a few ulp.
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat/lav_mat.h>
+
+#include <algorithm>
+#include <random>
+#include <cmath>
+
+using namespace lav;
+namespace boc = boost::compute;
+
+const char Generator::source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+(
+	uint4 philox(uint2 key, uint4 ctr)
+	{
+		for (uint r = 0; r < 10; ++r)
+		{
+			const uint hi0 = mul_hi(0xD2511F53u, ctr.x);
+			const uint hi1 = mul_hi(0xCD9E8D57u, ctr.z);
+			const uint lo0 = 0xD2511F53u * ctr.x;
+			const uint lo1 = 0xCD9E8D57u * ctr.z;
+
+			ctr = (uint4)(hi1 ^ ctr.y ^ key.x, lo1, hi0 ^ ctr.w ^ key.y, lo0);
+			key += (uint2)(0x9E3779B9u, 0xBB67AE85u);
+		}
+
+		return ctr;
+	}
+
+	uint4 draw(uint2 key, uint2 offset, uint i, uint round)
+	{
+		const uint lo = offset.x + i;
+
+		return philox(key, (uint4)(lo, offset.y + (lo < offset.x), round, 0));
+	}
+
+	float uniform(uint x)
+	{
+		return (x >> 8) * (1.0f / 16777216);
+	}
+
+	float gaussian(uint x, uint y)
+	{
+		return sqrt(-2 * log(((x >> 8) + 1) * (1.0f / 16777216))) * cos(6.2831855f * uniform(y));
+	}
+);
+
+std::array<uint32_t, 4> Generator::philox(uint64_t key, uint64_t counter, uint32_t round)
+{
+	uint32_t k0 = uint32_t(key), k1 = uint32_t(key >> 32);
+	uint32_t c0 = uint32_t(counter), c1 = uint32_t(counter >> 32), c2 = round, c3 = 0;
+
+	for (size_t r = 0; r < 10; ++r)
+	{
+		const uint64_t p0 = uint64_t(0xD2511F53u) * c0;
+		const uint64_t p1 = uint64_t(0xCD9E8D57u) * c2;
+
+		c0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+		c1 = uint32_t(p1);
+		c2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+		c3 = uint32_t(p0);
+		k0 += 0x9E3779B9u;
+		k1 += 0xBB67AE85u;
+	}
+
+	return { c0, c1, c2, c3 };
+}
+
+Generator::Generator(uint64_t seed) :
+	key(seed), counter(0)
+{
+
+}
+
+Generator::Generator(const Generator& another) :
+	key(another.seed()), counter(another.offset())
+{
+
+}
+
+Generator& Generator::operator=(const Generator& another)
+{
+	key = another.seed();
+	counter = another.offset();
+
+	return *this;
+}
+
+void Generator::manual_seed(uint64_t seed)
+{
+	key = seed;
+	counter = 0;
+}
+
+void Generator::set_offset(uint64_t offset)
+{
+	counter = offset;
+}
+
+uint64_t Generator::seed(void) const
+{
+	return key;
+}
+
+uint64_t Generator::offset(void) const
+{
+	return counter;
+}
+
+uint64_t Generator::advance(uint64_t n)
+{
+	return counter.fetch_add(n);
+}
+
+Generator& Generator::global(void)
+{
+	static Generator generator(uint64_t(std::random_device{}()) << 32 | std::random_device{}());
+
+	return generator;
+}
+
+//Fills a host buffer on a few threads; every element only depends on its own counter.
+template<typename T>
+static void host_fill(std::vector<float>& buffer, T&& fun)
+{
+	const size_t grain = 1 << 16;
+	const size_t hardware = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	const size_t workers = std::max<size_t>(std::min(hardware, buffer.size() / grain), 1);
+
+	auto&& work = [&](size_t first, size_t last)
+	{
+		for (size_t i = first; i < last; ++i)
+		{
+			buffer[i] = fun(i);
+		}
+	};
+
+	std::vector<std::thread> threads;
+
+	for (size_t i = 1; i < workers; ++i)
+	{
+		threads.emplace_back(work, buffer.size() * i / workers, buffer.size() * (i + 1) / workers);
+	}
+
+	work(0, buffer.size() / workers);
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+static float host_uniform(uint32_t x)
+{
+	return (x >> 8) * (1.0f / 16777216);
+}
+
+static float host_gaussian(uint32_t x, uint32_t y)
+{
+	return std::sqrt(-2 * std::log(((x >> 8) + 1) * (1.0f / 16777216))) * std::cos(6.2831855f * host_uniform(y));
+}
+
+void Mat::fill_random(Mat& mat, Generator& generator, size_t type, float a, float b, float c, float d)
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global float* output, uint2 key, uint2 offset, uint type, float a, float b, float c, float d)
+		{
+			const uint i = get_global_id(0);
+			uint4 r = draw(key, offset, i, 0);
+
+			if (type == 0)
+			{
+				output[i] = a + (b - a) * uniform(r.x);
+			}
+			else if (type == 1)
+			{
+				output[i] = a + b * gaussian(r.x, r.y);
+			}
+			else if (type == 2)
+			{
+				output[i] = uniform(r.x) < a;
+			}
+			else
+			{
+				float x = a + b * gaussian(r.x, r.y);
+
+				for (uint round = 1; round < 64 && !(x >= c && x <= d); ++round)
+				{
+					r = draw(key, offset, i, round);
+					x = a + b * gaussian(r.x, r.y);
+				}
+
+				output[i] = clamp(x, c, d);
+			}
+		}
+	);
+
+	static boc::program fun_program = Mat::build(std::string(Generator::source) + source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+	const size_t n = mat.rows * mat.cols;
+	const uint64_t key = generator.seed();
+	const uint64_t offset = generator.advance(n);
+
+	Use use({ mat }, false);
+
+	mat.invalidate();
+
+	if (n == 0)
+	{
+		return;
+	}
+
+	if (mat.uploaded && Graph::capturing())
+	{
+		//A replay draws new numbers from a stream the graph owns, keyed off the counters of this call
+		//(round 64 is never drawn by the kernel), so it neither reads the generator nor repeats its numbers.
+		const boc::buffer buffer = mat.g_buffer.get_buffer();
+		const auto fork = Generator::philox(key, offset, 64);
+		const uint64_t replay_key = uint64_t(fork[1]) << 32 | fork[0];
+		const auto replay_offset = std::make_shared<uint64_t>(0);
+		boc::kernel node(fun_program, "fun");
+
+		node.set_args(buffer, boc::uint2_(0, 0), boc::uint2_(0, 0), cl_uint(type), a, b, c, d);
+
+		auto draw = [=](uint64_t key, uint64_t offset) mutable
+		{
+			node.set_arg(1, boc::uint2_(cl_uint(key), cl_uint(key >> 32)));
+			node.set_arg(2, boc::uint2_(cl_uint(offset), cl_uint(offset >> 32)));
+			Mat::enqueue("fill_random", node, 1, &n, n * sizeof(float));
+		};
+
+		draw(key, offset);
+
+		Graph::record([=]() mutable
+		{
+			draw(replay_key, *replay_offset);
+			*replay_offset += n;
+		});
+	}
+	else if (mat.uploaded)
+	{
+		Mat::launch("fill_random", fun_kernel, n, mat.g_buffer, boc::uint2_(cl_uint(key), cl_uint(key >> 32)), boc::uint2_(cl_uint(offset), cl_uint(offset >> 32)), cl_uint(type), a, b, c, d);
+	}
+	else
+	{
+		host_fill(mat.c_buffer, [&](size_t i)
+		{
+			auto r = Generator::philox(key, offset + i, 0);
+
+			switch (type)
+			{
+			case 0:
+				return a + (b - a) * host_uniform(r[0]);
+			case 1:
+				return a + b * host_gaussian(r[0], r[1]);
+			case 2:
+				return float(host_uniform(r[0]) < a);
+			default:
+				float x = a + b * host_gaussian(r[0], r[1]);
+
+				for (uint32_t round = 1; round < 64 && !(x >= c && x <= d); ++round)
+				{
+					r = Generator::philox(key, offset + i, round);
+					x = a + b * host_gaussian(r[0], r[1]);
+				}
+
+				return std::min(std::max(x, c), d);
+			}
+		});
+	}
+}
+
+void lav::fill_randu_(Mat& mat, float lower, float upper, Generator& generator)
+{
+	Mat::fill_random(mat, generator, 0, lower, upper, 0, 0);
+}
+
+void lav::fill_randn_(Mat& mat, float mean, float sigma, Generator& generator)
+{
+	Mat::fill_random(mat, generator, 1, mean, sigma, 0, 0);
+}
+
+void lav::fill_bernoulli_(Mat& mat, float p, Generator& generator)
+{
+	Mat::fill_random(mat, generator, 2, p, 0, 0, 0);
+}
+
+void lav::fill_trunc_normal_(Mat& mat, float mean, float sigma, float lower, float upper, Generator& generator)
+{
+	if (not (lower <= upper))
+	{
+		throw std::runtime_error("Fill_trunc_normal: Lower bound is greater than upper bound!");
+	}
+
+	Mat::fill_random(mat, generator, 3, mean, sigma, lower, upper);
+}
\ No newline at end of file
@@ -0,0 +1,253 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : residency.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : Every matrix that holds a buffer on the video RAM is kept
+ *                 in one registry with its size and the time it was last
+ *                 used. Before a new buffer would go over the budget, the
+ *                 least recently used matrices that no operation is using
+ *                 right now are copied back to c_buffer and their buffers
+ *                 are released. An evicted matrix goes back to the video
+ *                 RAM the next time an operation uses it. The mirror of a
+ *                 matrix whose datas is on the RAM is simply dropped.
+ *                 Operations pin the matrices they read and write with a
+ *                 Mat::Use for as long as they run, so only idle matrices
+ *                 are ever evicted.
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat/lav_mat.h>
+
+#include <unordered_map>
+
+using namespace lav;
+namespace boc = boost::compute;
+
+struct Registry
+{
+	std::recursive_mutex mutex;
+	std::unordered_map<const Mat*, size_t> resident;//Bytes held on the video RAM by every matrix.
+	std::unordered_map<const Mat*, size_t> host;//And on the RAM, only counted for the statistics.
+	size_t usage = 0;
+	size_t host_usage = 0;
+	size_t budget = 0;
+	uint64_t clock = 0;
+};
+
+//Never destroyed, matrices with static storage duration may still be released after main returns.
+static Registry& registry(void)
+{
+	static Registry* registry = new Registry;
+	return *registry;
+}
+
+//Records that mat now holds bytes in held, keeps usage up to date and returns what it held before.
+static size_t hold(std::unordered_map<const Mat*, size_t>& held, size_t& usage, const Mat* mat, size_t bytes)
+{
+	auto it = held.find(mat);
+	const size_t old = it == held.end() ? 0 : it->second;
+
+	if (bytes)
+	{
+		held[mat] = bytes;
+	}
+	else if (it != held.end())
+	{
+		held.erase(it);
+	}
+
+	usage = usage - old + bytes;
+
+	return old;
+}
+
+void Mat::set_device_budget(size_t bytes)
+{
+	std::lock_guard<std::recursive_mutex> lock(registry().mutex);
+
+	registry().budget = bytes;
+	make_room(0);
+}
+
+size_t Mat::device_budget(void)
+{
+	std::lock_guard<std::recursive_mutex> lock(registry().mutex);
+
+	return registry().budget ? registry().budget : size_t(Mat::device.global_memory_size());
+}
+
+size_t Mat::device_usage(void)
+{
+	std::lock_guard<std::recursive_mutex> lock(registry().mutex);
+
+	return registry().usage;
+}
+
+void Mat::track(void) const
+{
+	std::lock_guard<std::recursive_mutex> lock(registry().mutex);
+
+	auto& reg = registry();
+	const size_t bytes = g_buffer.capacity() * sizeof(float);
+	const size_t host_bytes = c_buffer.capacity() * sizeof(float);
+	const size_t old = hold(reg.resident, reg.usage, this, bytes);
+	const size_t old_host = hold(reg.host, reg.host_usage, this, host_bytes);
+
+	if (!old && bytes)
+	{
+		last_use = ++reg.clock;//A new buffer is about to be written, it must not be the first to go.
+	}
+
+	Stats::count_memory(true, bytes > old, reg.usage);
+	Stats::count_memory(false, host_bytes > old_host, reg.host_usage);
+}
+
+void Mat::untrack(void) const
+{
+	std::lock_guard<std::recursive_mutex> lock(registry().mutex);
+
+	auto& reg = registry();
+
+	hold(reg.resident, reg.usage, this, 0);
+	hold(reg.host, reg.host_usage, this, 0);
+}
+
+void Mat::make_room(size_t bytes, const Mat* keep)
+{
+	std::lock_guard<std::recursive_mutex> lock(registry().mutex);
+
+	auto& reg = registry();
+	const size_t budget = device_budget();
+
+	while (reg.usage + bytes > budget)
+	{
+		const Mat* victim = nullptr;
+
+		for (const auto& [mat, size] : reg.resident)
+		{
+			if (!mat->pins && mat != keep && (!victim || mat->last_use < victim->last_use))
+			{
+				victim = mat;
+			}
+		}
+
+		if (!victim)
+		{
+			break;//Everything left is in use, the allocation may still fit.
+		}
+
+		victim->evict();
+	}
+}
+
+void Mat::evict(void) const
+{
+	if (uploaded && !lazy)
+	{
+		if (!mirrored)
+		{
+			c_buffer.resize(g_buffer.size());
+			read(g_buffer, c_buffer.data(), g_buffer.size());
+		}
+
+		evicted = true;
+	}
+
+	uploaded = lazy && uploaded;
+	mirrored = false;//A mirror of c_buffer is simply dropped.
+	g_buffer = boc::vector<float>(Mat::context);
+	track();
+}
+
+void Mat::restore(void) const
+{
+	if (evicted)
+	{
+		allocate(c_buffer.size());
+		write(g_buffer, c_buffer.data(), c_buffer.size());
+
+		uploaded = true;
+		evicted = false;
+		mirrored = true;
+	}
+}
+
+//Under the lock, since several threads may read the same matrix and mirror it at once.
+const boc::vector<float>& Mat::device_buffer(void) const
+{
+	std::lock_guard<std::recursive_mutex> lock(registry().mutex);
+
+	if (!uploaded && !mirrored)
+	{
+		allocate(c_buffer.size());
+		write(g_buffer, c_buffer.data(), c_buffer.size());
+
+		mirrored = true;
+	}
+
+	return g_buffer;
+}
+
+//The same for the ops the dispatcher runs on the host, the datas of a matrix on the VRAM is mirrored into c_buffer.
+const std::vector<float>& Mat::host_buffer(void) const
+{
+	std::lock_guard<std::recursive_mutex> lock(registry().mutex);
+
+	if (uploaded && !mirrored)
+	{
+		c_buffer.resize(g_buffer.size());
+		read(g_buffer, c_buffer.data(), g_buffer.size());
+		track();
+
+		mirrored = true;
+	}
+
+	return c_buffer;
+}
+
+Mat::Use::Use(std::initializer_list<std::reference_wrapper<const Mat>> mats, bool fill) :
+	mats(mats.begin(), mats.end())
+{
+	std::lock_guard<std::recursive_mutex> lock(registry().mutex);
+
+	//Pin all of them first, bringing one back must not push out another.
+	for (const Mat& mat : this->mats)
+	{
+		++mat.pins;
+	}
+
+	for (const Mat& mat : this->mats)
+	{
+		mat.materialize(fill);
+		mat.restore();
+		mat.last_use = ++registry().clock;
+	}
+}
+
+Mat::Use::~Use(void)
+{
+	std::lock_guard<std::recursive_mutex> lock(registry().mutex);
+
+	for (const Mat& mat : mats)
+	{
+		--mat.pins;
+	}
+}
\ No newline at end of file
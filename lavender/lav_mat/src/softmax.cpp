@@ -0,0 +1,463 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : softmax.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : One work group per row, or per column when axis is false.
+ *                 Each work item walks its share of the line keeping the
+ *                 running max and the sum of exp rescaled to it, the pairs
+ *                 are merged in local memory, and a second walk over the
+ *                 same line writes the outputs. A line is read twice and
+ *                 written once, with no temporaries and a single launch.
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat/lav_mat.h>
+
+#include <algorithm>
+#include <limits>
+
+using namespace lav;
+namespace boc = boost::compute;
+
+static const char source[] = "#define GROUP 256\n" BOOST_COMPUTE_STRINGIZE_SOURCE
+(
+	void stats(__global float* input, uint base, uint n, uint step, __local float* ms, __local float* ss, float* m_out, float* s_out)
+	{
+		const uint l = get_local_id(0);
+
+		float m = -INFINITY;
+		float s = 0;
+
+		for (uint k = l; k < n; k += get_local_size(0))
+		{
+			const float x = input[base + k * step];
+
+			if (x > m)
+			{
+				s = s * exp(m - x) + 1;
+				m = x;
+			}
+			else
+			{
+				s += exp(x - m);
+			}
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		ms[l] = m;
+		ss[l] = s;
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (uint half = get_local_size(0) / 2; half > 0; half /= 2)
+		{
+			if (l < half)
+			{
+				const float m1 = ms[l];
+				const float m2 = ms[l + half];
+				const float mm = max(m1, m2);
+
+				ss[l] = (m1 == -INFINITY ? 0 : ss[l] * exp(m1 - mm)) + (m2 == -INFINITY ? 0 : ss[l + half] * exp(m2 - mm));
+				ms[l] = mm;
+			}
+
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+
+		*m_out = ms[0];
+		*s_out = ss[0];
+	}
+
+	float total(float value, __local float* cache)
+	{
+		const uint l = get_local_id(0);
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		cache[l] = value;
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (uint half = get_local_size(0) / 2; half > 0; half /= 2)
+		{
+			if (l < half)
+			{
+				cache[l] += cache[l + half];
+			}
+
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+
+		return cache[0];
+	}
+
+	__kernel void softmax(__global float* input, __global float* output, uint n, uint step, uint group_step, uint log_flag)
+	{
+		__local float ms[GROUP];
+		__local float ss[GROUP];
+
+		const uint base = get_group_id(0) * group_step;
+
+		float m, s;
+		stats(input, base, n, step, ms, ss, &m, &s);
+
+		const float log_s = log(s);
+
+		for (uint k = get_local_id(0); k < n; k += get_local_size(0))
+		{
+			const uint i = base + k * step;
+
+			output[i] = log_flag ? input[i] - m - log_s : exp(input[i] - m) / s;
+		}
+	}
+
+	__kernel void softmax_grad(__global float* y, __global float* dy, __global float* output, uint n, uint step, uint group_step, uint log_flag)
+	{
+		__local float cache[GROUP];
+
+		const uint base = get_group_id(0) * group_step;
+
+		float t = 0;
+
+		for (uint k = get_local_id(0); k < n; k += get_local_size(0))
+		{
+			const uint i = base + k * step;
+
+			t += log_flag ? dy[i] : dy[i] * y[i];
+		}
+
+		t = total(t, cache);
+
+		for (uint k = get_local_id(0); k < n; k += get_local_size(0))
+		{
+			const uint i = base + k * step;
+
+			output[i] = log_flag ? dy[i] - exp(y[i]) * t : y[i] * (dy[i] - t);
+		}
+	}
+
+	__kernel void cross_entropy(__global float* input, __global float* labels, __global float* loss, __global float* grad, __global int* flag, uint n, uint indices, uint grad_flag)
+	{
+		__local float ms[GROUP];
+		__local float ss[GROUP];
+
+		const uint r = get_group_id(0);
+		const uint base = r * n;
+		const float index = indices ? labels[r] : 0;
+		const uint label = (uint)index;
+
+		//The whole group leaves together, before any barrier.
+		if (indices && !(index >= 0 && index < n && label == index))
+		{
+			flag[0] = 1;
+			return;
+		}
+
+		float m, s;
+		stats(input, base, n, 1, ms, ss, &m, &s);
+
+		//A distribution per row need not sum to one, the loss is then weighted by its sum.
+		float t = 0;
+		float q = 0;
+
+		for (uint k = get_local_id(0); k < n; k += get_local_size(0))
+		{
+			const float p = indices ? k == label : labels[base + k];
+
+			t += p * input[base + k];
+			q += p;
+		}
+
+		t = total(t, ss);
+		q = total(q, ss);
+
+		if (get_local_id(0) == 0)
+		{
+			loss[r] = q * (m + log(s)) - t;
+		}
+
+		if (grad_flag)
+		{
+			for (uint k = get_local_id(0); k < n; k += get_local_size(0))
+			{
+				const float p = indices ? k == label : labels[base + k];
+
+				grad[base + k] = q * exp(input[base + k] - m) / s - p;
+			}
+		}
+	}
+);
+
+//The group of a line, its length, the stride of its elements and of the lines.
+struct Lines
+{
+	size_t count;
+	size_t n;
+	size_t step;
+	size_t group_step;
+};
+
+static Lines lines_of(const Mat& mat, bool axis)
+{
+	return axis ? Lines{ mat.rows, mat.cols, 1, mat.cols } : Lines{ mat.cols, mat.rows, mat.cols, 1 };
+}
+
+static void host_softmax(const float* input, float* output, const Lines& lines, bool log_flag)
+{
+	for (size_t g = 0; g < lines.count; ++g)
+	{
+		const size_t base = g * lines.group_step;
+
+		float m = -std::numeric_limits<float>::infinity();
+		float s = 0;
+
+		for (size_t k = 0; k < lines.n; ++k)
+		{
+			m = std::max(m, input[base + k * lines.step]);
+		}
+
+		for (size_t k = 0; k < lines.n; ++k)
+		{
+			s += std::exp(input[base + k * lines.step] - m);
+		}
+
+		const float log_s = std::log(s);
+
+		for (size_t k = 0; k < lines.n; ++k)
+		{
+			const size_t i = base + k * lines.step;
+
+			output[i] = log_flag ? input[i] - m - log_s : std::exp(input[i] - m) / s;
+		}
+	}
+}
+
+static void host_softmax_grad(const float* y, const float* dy, float* output, const Lines& lines, bool log_flag)
+{
+	for (size_t g = 0; g < lines.count; ++g)
+	{
+		const size_t base = g * lines.group_step;
+
+		float t = 0;
+
+		for (size_t k = 0; k < lines.n; ++k)
+		{
+			const size_t i = base + k * lines.step;
+
+			t += log_flag ? dy[i] : dy[i] * y[i];
+		}
+
+		for (size_t k = 0; k < lines.n; ++k)
+		{
+			const size_t i = base + k * lines.step;
+
+			output[i] = log_flag ? dy[i] - std::exp(y[i]) * t : y[i] * (dy[i] - t);
+		}
+	}
+}
+
+Mat Mat::softmax_op(const Mat& mat, bool axis, bool log_flag)
+{
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "softmax");
+
+	const Lines lines = lines_of(mat, axis);
+
+	if (Dispatcher::on_host(5 * mat.rows * mat.cols, { mat }))
+	{
+		Mat ans(mat.rows, mat.cols, false);
+		Mat::Use use{ mat, ans };
+		Profiler::Span span(log_flag ? "log_softmax" : "softmax", mat.rows, mat.cols);
+
+		host_softmax(mat.host_buffer().data(), ans.c_buffer.data(), lines, log_flag);
+
+		return std::move(ans);
+	}
+
+	Mat ans(mat.rows, mat.cols, true);
+	Mat::Use use{ mat, ans };
+
+	if (ans.rows * ans.cols)
+	{
+		Mat::launch_groups(log_flag ? "log_softmax" : "softmax", fun_kernel, lines.count, Mat::group_size(fun_kernel), mat.device_buffer(), ans.g_buffer, cl_uint(lines.n), cl_uint(lines.step), cl_uint(lines.group_step), cl_uint(log_flag));
+	}
+
+	return std::move(ans);
+}
+
+Mat Mat::softmax_grad_op(const Mat& y, const Mat& dy, bool axis, bool log_flag)
+{
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "softmax_grad");
+
+	if (y.rows != dy.rows || y.cols != dy.cols)
+	{
+		throw std::runtime_error("Softmax_grad: Size mismatch between two matrices!");
+	}
+
+	const Lines lines = lines_of(y, axis);
+
+	if (Dispatcher::on_host(4 * y.rows * y.cols, { y, dy }))
+	{
+		Mat ans(y.rows, y.cols, false);
+		Mat::Use use{ y, dy, ans };
+		Profiler::Span span("softmax_grad", y.rows, y.cols);
+
+		host_softmax_grad(y.host_buffer().data(), dy.host_buffer().data(), ans.c_buffer.data(), lines, log_flag);
+
+		return std::move(ans);
+	}
+
+	Mat ans(y.rows, y.cols, true);
+	Mat::Use use{ y, dy, ans };
+
+	if (ans.rows * ans.cols)
+	{
+		Mat::launch_groups("softmax_grad", fun_kernel, lines.count, Mat::group_size(fun_kernel), y.device_buffer(), dy.device_buffer(), ans.g_buffer, cl_uint(lines.n), cl_uint(lines.step), cl_uint(lines.group_step), cl_uint(log_flag));
+	}
+
+	return std::move(ans);
+}
+
+Mat lav::softmax(const Mat& mat, bool axis)
+{
+	return Mat::softmax_op(mat, axis, false);
+}
+
+Mat lav::log_softmax(const Mat& mat, bool axis)
+{
+	return Mat::softmax_op(mat, axis, true);
+}
+
+Mat lav::softmax_grad(const Mat& y, const Mat& dy, bool axis)
+{
+	return Mat::softmax_grad_op(y, dy, axis, false);
+}
+
+Mat lav::log_softmax_grad(const Mat& y, const Mat& dy, bool axis)
+{
+	return Mat::softmax_grad_op(y, dy, axis, true);
+}
+
+Mat Mat::cross_entropy_op(const Mat& logits, const Mat& labels, Mat* grad)
+{
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "cross_entropy");
+
+	const bool indices = labels.cols == 1 && logits.cols != 1 && labels.rows == logits.rows;
+
+	if (!indices && (labels.rows != logits.rows || labels.cols != logits.cols))
+	{
+		throw std::runtime_error("Softmax_cross_entropy: Labels must be a column of class indices or a distribution per row of logits!");
+	}
+
+	const size_t rows = logits.rows;
+	const size_t n = logits.cols;
+
+	if (Dispatcher::on_host(6 * rows * n, { logits, labels }))
+	{
+		Mat ans(rows, 1, false);
+		Mat g(grad ? rows : 0, grad ? n : 0, false);
+		Mat::Use use{ logits, labels, ans, g };
+		Profiler::Span span("softmax_cross_entropy", rows, n);
+
+		const float* input = logits.host_buffer().data();
+		const float* p = labels.host_buffer().data();
+
+		for (size_t r = 0; r < rows; ++r)
+		{
+			const float* x = input + r * n;
+			const size_t label = indices && p[r] >= 0 ? size_t(p[r]) : 0;
+
+			if (indices && !(p[r] >= 0 && p[r] < n && float(label) == p[r]))
+			{
+				throw std::runtime_error("Softmax_cross_entropy: Label of row " + std::to_string(r) + " is not a class index!");
+			}
+
+			const float m = *std::max_element(x, x + n);
+
+			float s = 0, t = 0, q = 0;
+
+			for (size_t k = 0; k < n; ++k)
+			{
+				const float pk = indices ? float(k == label) : p[r * n + k];
+
+				s += std::exp(x[k] - m);
+				t += pk * x[k];
+				q += pk;
+			}
+
+			ans.c_buffer[r] = q * (m + std::log(s)) - t;
+
+			for (size_t k = 0; grad && k < n; ++k)
+			{
+				const float pk = indices ? float(k == label) : p[r * n + k];
+
+				g.c_buffer[r * n + k] = q * std::exp(x[k] - m) / s - pk;
+			}
+		}
+
+		if (grad)
+		{
+			*grad = std::move(g);
+		}
+
+		return std::move(ans);
+	}
+
+	Mat ans(rows, 1, true);
+	Mat g(grad ? rows : 0, grad ? n : 0, true);
+	Mat::Use use{ logits, labels, ans, g };
+
+	//Without a gradient the loss buffer stands in for it, the kernel does not touch it then.
+	if (rows)
+	{
+		boc::vector<cl_int> flag(size_t(1), cl_int(0), Mat::queue);
+		cl_int value = 0;
+
+		Mat::launch_groups("softmax_cross_entropy", fun_kernel, rows, Mat::group_size(fun_kernel), logits.device_buffer(), labels.device_buffer(), ans.g_buffer, grad ? g.g_buffer : ans.g_buffer, flag, cl_uint(n), cl_uint(indices), cl_uint(grad != nullptr));
+
+		boc::copy_n(flag.begin(), 1, &value, Mat::queue);
+
+		if (value)
+		{
+			throw std::runtime_error("Softmax_cross_entropy: A label is not a class index!");
+		}
+	}
+
+	if (grad)
+	{
+		*grad = std::move(g);
+	}
+
+	return std::move(ans);
+}
+
+Mat lav::softmax_cross_entropy(const Mat& logits, const Mat& labels)
+{
+	return Mat::cross_entropy_op(logits, labels, nullptr);
+}
+
+Mat lav::softmax_cross_entropy(const Mat& logits, const Mat& labels, Mat& grad)
+{
+	return Mat::cross_entropy_op(logits, labels, &grad);
+}
\ No newline at end of file
@@ -0,0 +1,411 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : sort.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : Every row, or column when axis is false, is sorted on
+ *                 its own by a bitonic network over its keys and indices,
+ *                 padded to a power of two. A work group sorts a chunk of
+ *                 CHUNK elements in local memory; the strides wider than
+ *                 a chunk are one launch each.
+ *                 topk with a small k does not sort the whole line: each
+ *                 chunk is sorted in local memory and only its best k are
+ *                 kept, which at least halves the line per pass, until it
+ *                 fits in a single chunk.
+ *                 Ties keep the order of the indices and NaNs come last,
+ *                 so the results do not depend on the device.
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat/lav_mat.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+using namespace lav;
+namespace boc = boost::compute;
+
+static const char source[] = "#define CHUNK 1024\n#define PAD 0xffffffffu\n" BOOST_COMPUTE_STRINGIZE_SOURCE
+(
+	//Padding goes after everything, then NaNs, and equal keys are ordered by index.
+	int before(float ka, uint ia, float kb, uint ib, uint descending)
+	{
+		if (ia == PAD || ib == PAD)
+		{
+			return ib == PAD && ia != PAD;
+		}
+
+		const int na = isnan(ka);
+		const int nb = isnan(kb);
+
+		if (na || nb)
+		{
+			return na == nb ? ia < ib : nb;
+		}
+
+		if (ka != kb)
+		{
+			return descending ? ka > kb : ka < kb;
+		}
+
+		return ia < ib;
+	}
+
+	//Sorts a chunk of 2 * local size elements of a line and writes its first keep ones to the line of dst.
+	//size = 0 runs the whole network of the chunk, otherwise only the strides below the chunk of that stage.
+	__kernel void local_sort(__global float* src_keys, __global uint* src_idx, __global float* dst_keys, __global uint* dst_idx, uint n, uint step, uint group_step, uint padded, uint first, uint size, uint keep, uint dst_line, uint alternate, uint descending)
+	{
+		__local float keys[CHUNK];
+		__local uint idx[CHUNK];
+
+		const uint l = get_local_id(0);
+		const uint chunk = 2 * get_local_size(0);
+		const uint line = get_group_id(0) * chunk / padded;
+		const uint offset = get_group_id(0) * chunk % padded;
+		const uint origin = alternate ? offset : 0;
+
+		for (uint t = l; t < chunk; t += get_local_size(0))
+		{
+			const uint i = offset + t;
+
+			keys[t] = i < n ? src_keys[line * group_step + i * step] : 0;
+			idx[t] = i < n ? (first ? i : src_idx[line * group_step + i * step]) : PAD;
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (uint k = size ? size : 2; k <= (size ? size : chunk); k <<= 1)
+		{
+			for (uint j = min(k, chunk) >> 1; j > 0; j >>= 1)
+			{
+				const uint a = 2 * l - (l & (j - 1));
+				const uint b = a + j;
+				const int up = ((origin + a) & k) == 0;
+
+				if (up ? before(keys[b], idx[b], keys[a], idx[a], descending) : before(keys[a], idx[a], keys[b], idx[b], descending))
+				{
+					const float key = keys[a];
+					const uint index = idx[a];
+
+					keys[a] = keys[b];
+					idx[a] = idx[b];
+					keys[b] = key;
+					idx[b] = index;
+				}
+
+				barrier(CLK_LOCAL_MEM_FENCE);
+			}
+		}
+
+		for (uint t = l; t < keep; t += get_local_size(0))
+		{
+			dst_keys[line * dst_line + offset / chunk * keep + t] = keys[t];
+			dst_idx[line * dst_line + offset / chunk * keep + t] = idx[t];
+		}
+	}
+
+	//One compare and swap of the stage size at a stride wider than a chunk.
+	__kernel void merge(__global float* keys, __global uint* idx, uint padded, uint size, uint stride, uint descending)
+	{
+		const uint id = get_global_id(0);
+		const uint base = id / (padded / 2) * padded;
+		const uint r = id % (padded / 2);
+		const uint i = 2 * r - (r & (stride - 1));
+		const uint a = base + i;
+		const uint b = a + stride;
+		const int up = (i & size) == 0;
+
+		if (up ? before(keys[b], idx[b], keys[a], idx[a], descending) : before(keys[a], idx[a], keys[b], idx[b], descending))
+		{
+			const float key = keys[a];
+			const uint index = idx[a];
+
+			keys[a] = keys[b];
+			idx[a] = idx[b];
+			keys[b] = key;
+			idx[b] = index;
+		}
+	}
+
+	__kernel void store(__global float* keys, __global uint* idx, __global float* values, __global float* indices, uint count, uint line, uint step, uint group_step, uint flags)
+	{
+		const uint id = get_global_id(0);
+		const uint g = id / count;
+		const uint i = id % count;
+		const uint o = g * group_step + i * step;
+
+		if (flags & 1)
+		{
+			values[o] = keys[g * line + i];
+		}
+
+		if (flags & 2)
+		{
+			indices[o] = idx[g * line + i];
+		}
+	}
+);
+
+static size_t pow2_ceil(size_t n)
+{
+	size_t p = 1;
+
+	while (p < n)
+	{
+		p *= 2;
+	}
+
+	return p;
+}
+
+static void host_sort(const float* input, size_t count, size_t n, size_t step, size_t group_step, size_t k, bool descending, float* values, float* indices, size_t out_step, size_t out_group_step)
+{
+	std::vector<uint32_t> order(n);
+
+	for (size_t g = 0; g < count; ++g)
+	{
+		const float* line = input + g * group_step;
+
+		auto&& before = [&](uint32_t a, uint32_t b)
+		{
+			const float ka = line[a * step];
+			const float kb = line[b * step];
+
+			if (std::isnan(ka) || std::isnan(kb))
+			{
+				return std::isnan(ka) == std::isnan(kb) ? a < b : std::isnan(kb);
+			}
+
+			if (ka != kb)
+			{
+				return descending ? ka > kb : ka < kb;
+			}
+
+			return a < b;
+		};
+
+		std::iota(order.begin(), order.end(), 0);
+		k < n ? std::partial_sort(order.begin(), order.begin() + k, order.end(), before) : std::sort(order.begin(), order.end(), before);
+
+		for (size_t i = 0; i < k; ++i)
+		{
+			if (values)
+			{
+				values[g * out_group_step + i * out_step] = line[order[i] * step];
+			}
+
+			if (indices)
+			{
+				indices[g * out_group_step + i * out_step] = float(order[i]);
+			}
+		}
+	}
+}
+
+void Mat::sort_lines(const Mat& mat, size_t k, bool axis, bool descending, Mat* values, Mat* indices)
+{
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel local_kernel(fun_program, "local_sort");
+	thread_local boc::kernel merge_kernel(fun_program, "merge");
+	thread_local boc::kernel store_kernel(fun_program, "store");
+
+	const size_t count = axis ? mat.rows : mat.cols;
+	const size_t n = axis ? mat.cols : mat.rows;
+	const size_t step = axis ? 1 : mat.cols;
+	const size_t group_step = axis ? mat.cols : 1;
+	const size_t out_rows = axis ? count : k;
+	const size_t out_cols = axis ? k : count;
+	const size_t out_step = axis ? 1 : count;
+	const size_t out_group_step = axis ? k : 1;
+
+	if (k > n)
+	{
+		throw std::runtime_error("Topk: k is larger than the length of the lines!");
+	}
+
+	//The indices are stored as floats, which hold every integer only up to 2^24.
+	if (indices && n > (size_t(1) << 24))
+	{
+		throw std::runtime_error(k < n ? "Topk: Lines longer than 2^24 cannot be indexed!" : "Argsort: Lines longer than 2^24 cannot be indexed!");
+	}
+
+	if (mat.lazy)
+	{
+		if (values)
+		{
+			*values = Full(out_rows, out_cols, mat.constant, true);
+		}
+
+		if (indices)
+		{
+			Mat ans(out_rows, out_cols, false);
+
+			for (size_t i = 0; i < ans.c_buffer.size(); ++i)
+			{
+				ans.c_buffer[i] = float(axis ? i % k : i / count);
+			}
+
+			*indices = std::move(ans);
+		}
+
+		return;
+	}
+
+	if (Dispatcher::on_host(count * n * (1 + size_t(std::log2(n + 1))), { mat }))
+	{
+		Mat v(values ? out_rows : 0, values ? out_cols : 0, false);
+		Mat i(indices ? out_rows : 0, indices ? out_cols : 0, false);
+		Use use{ mat, v, i };
+		Profiler::Span span(k < n ? "topk" : "sort", mat.rows, mat.cols);
+
+		host_sort(mat.host_buffer().data(), count, n, step, group_step, k, descending, values ? v.c_buffer.data() : nullptr, indices ? i.c_buffer.data() : nullptr, out_step, out_group_step);
+
+		if (values)
+		{
+			*values = std::move(v);
+		}
+
+		if (indices)
+		{
+			*indices = std::move(i);
+		}
+
+		return;
+	}
+
+	Mat v(values ? out_rows : 0, values ? out_cols : 0, true);
+	Mat i(indices ? out_rows : 0, indices ? out_cols : 0, true);
+	Use use{ mat, v, i };
+
+	if (count * k)
+	{
+		//Elements per work group, twice the local size local_sort can run with and at most CHUNK.
+		const size_t chunk = 2 * Mat::group_size(local_kernel, 512);
+
+		boc::vector<float> keys(Mat::context);
+		boc::vector<cl_uint> idx(Mat::context);
+		size_t line = 0;
+
+		if (2 * k <= chunk && n > chunk)
+		{
+			//Selection: keeps the best k of every chunk until the line fits in one chunk.
+			boc::vector<float> next_keys(Mat::context);
+			boc::vector<cl_uint> next_idx(Mat::context);
+			size_t m = n;
+			bool first = true;
+
+			while (true)
+			{
+				const bool last = m <= chunk;
+				const size_t c = last ? std::max<size_t>(2, pow2_ceil(m)) : chunk;
+				const size_t padded = (m + c - 1) / c * c;
+				const size_t dst_line = padded / c * k;
+
+				next_keys.resize(count * dst_line, Mat::queue);
+				next_idx.resize(count * dst_line, Mat::queue);
+
+				if (first)
+				{
+					Mat::launch_groups("topk", local_kernel, count * padded / c, c / 2, mat.device_buffer(), next_idx, next_keys, next_idx, cl_uint(m), cl_uint(step), cl_uint(group_step), cl_uint(padded), cl_uint(1), cl_uint(0), cl_uint(k), cl_uint(dst_line), cl_uint(0), cl_uint(descending));
+				}
+				else
+				{
+					Mat::launch_groups("topk", local_kernel, count * padded / c, c / 2, keys, idx, next_keys, next_idx, cl_uint(m), cl_uint(1), cl_uint(m), cl_uint(padded), cl_uint(0), cl_uint(0), cl_uint(k), cl_uint(dst_line), cl_uint(0), cl_uint(descending));
+				}
+
+				std::swap(keys, next_keys);
+				std::swap(idx, next_idx);
+				m = dst_line;
+				first = false;
+
+				if (last)
+				{
+					break;
+				}
+			}
+
+			line = k;
+		}
+		else
+		{
+			const size_t padded = std::max<size_t>(2, pow2_ceil(n));
+			const size_t c = std::min(padded, chunk);
+
+			keys.resize(count * padded, Mat::queue);
+			idx.resize(count * padded, Mat::queue);
+
+			Mat::launch_groups("sort", local_kernel, count * padded / c, c / 2, mat.device_buffer(), idx, keys, idx, cl_uint(n), cl_uint(step), cl_uint(group_step), cl_uint(padded), cl_uint(1), cl_uint(0), cl_uint(c), cl_uint(padded), cl_uint(1), cl_uint(descending));
+
+			for (size_t size = 2 * c; size <= padded; size *= 2)
+			{
+				for (size_t stride = size / 2; stride >= c; stride /= 2)
+				{
+					Mat::launch("sort", merge_kernel, count * padded / 2, keys, idx, cl_uint(padded), cl_uint(size), cl_uint(stride), cl_uint(descending));
+				}
+
+				Mat::launch_groups("sort", local_kernel, count * padded / c, c / 2, keys, idx, keys, idx, cl_uint(padded), cl_uint(1), cl_uint(padded), cl_uint(padded), cl_uint(0), cl_uint(size), cl_uint(c), cl_uint(padded), cl_uint(1), cl_uint(descending));
+			}
+
+			line = padded;
+		}
+
+		//An output that is not wanted is stood in for by the keys, the kernel does not touch it then.
+		Mat::launch("sort", store_kernel, count * k, keys, idx, values ? v.g_buffer : keys, indices ? i.g_buffer : keys, cl_uint(k), cl_uint(line), cl_uint(out_step), cl_uint(out_group_step), cl_uint((values ? 1 : 0) | (indices ? 2 : 0)));
+	}
+
+	if (values)
+	{
+		*values = std::move(v);
+	}
+
+	if (indices)
+	{
+		*indices = std::move(i);
+	}
+}
+
+Mat lav::sort(const Mat& mat, bool axis, bool descending)
+{
+	Mat values(0, 0, false);
+	Mat::sort_lines(mat, axis ? mat.cols : mat.rows, axis, descending, &values, nullptr);
+	return std::move(values);
+}
+
+Mat lav::argsort(const Mat& mat, bool axis, bool descending)
+{
+	Mat indices(0, 0, false);
+	Mat::sort_lines(mat, axis ? mat.cols : mat.rows, axis, descending, nullptr, &indices);
+	return std::move(indices);
+}
+
+Mat lav::topk(const Mat& mat, size_t k, bool axis, bool largest)
+{
+	Mat values(0, 0, false);
+	Mat::sort_lines(mat, k, axis, largest, &values, nullptr);
+	return std::move(values);
+}
+
+Mat lav::topk(const Mat& mat, size_t k, Mat& indices, bool axis, bool largest)
+{
+	Mat values(0, 0, false);
+	Mat::sort_lines(mat, k, axis, largest, &values, &indices);
+	return std::move(values);
+}
\ No newline at end of file
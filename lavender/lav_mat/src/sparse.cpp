@@ -0,0 +1,715 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : sparse.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : Coordinates are sorted into rows with a counting pass and
+ *                 each row by its columns, so building is linear in the
+ *                 nonzeros but for the short sorts of the rows. On the video
+ *                 RAM a product runs one work item per output element over
+ *                 the nonzeros of its row, and the transpose sorts the pairs
+ *                 (column, row) as 64 bits keys carrying the values along.
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat/lav_mat.h>
+
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <cstring>
+#include <cctype>
+#include <iterator>
+
+using namespace lav;
+namespace boc = boost::compute;
+
+template<typename T>
+static void to_device(const std::vector<T>& src, boc::vector<T>& dst)
+{
+	dst = boc::vector<T>(src.size(), Mat::context);
+
+	if (!src.empty())
+	{
+		Mat::queue.enqueue_write_buffer(dst.get_buffer(), 0, src.size() * sizeof(T), src.data());
+		Stats::count_transfer(true, src.size() * sizeof(T));
+	}
+}
+
+template<typename T>
+static std::vector<T> to_host(const boc::vector<T>& src)
+{
+	std::vector<T> dst(src.size());
+
+	if (!dst.empty())
+	{
+		Mat::queue.enqueue_read_buffer(src.get_buffer(), 0, dst.size() * sizeof(T), dst.data());
+		Stats::count_transfer(false, dst.size() * sizeof(T));
+	}
+
+	return dst;
+}
+
+static const boc::context& context(void)
+{
+	Mat(0, 0, false);//Runs Mat::init, the buffers need its context.
+
+	return Mat::context;
+}
+
+SparseMat::SparseMat(void) : rows(0), cols(0), row_ptr(1, 0), g_row_ptr(context()), g_col_idx(Mat::context), g_values(Mat::context)
+{
+
+}
+
+SparseMat::SparseMat(const SparseMat& another) :
+	rows(another.rows), cols(another.cols), uploaded(another.uploaded),
+	row_ptr(another.row_ptr), col_idx(another.col_idx), values(another.values),
+	g_row_ptr(another.g_row_ptr, Mat::queue), g_col_idx(another.g_col_idx, Mat::queue), g_values(another.g_values, Mat::queue)
+{
+
+}
+
+SparseMat& SparseMat::operator=(const SparseMat& another)
+{
+	if (this != &another)
+	{
+		*this = SparseMat(another);
+	}
+
+	return *this;
+}
+
+SparseMat::SparseMat(size_t rows, size_t cols, bool upload_flag) : SparseMat(rows, cols, {}, {}, {}, upload_flag)
+{
+
+}
+
+SparseMat::SparseMat(size_t rows, size_t cols, const std::vector<size_t>& row_indices, const std::vector<size_t>& col_indices, const std::vector<float>& values, bool upload_flag) : SparseMat()
+{
+	this->rows = rows;
+	this->cols = cols;
+
+	build(row_indices, col_indices, values);
+
+	if (upload_flag)
+	{
+		upload();
+	}
+}
+
+SparseMat::SparseMat(const Mat& dense, bool upload_flag) : SparseMat()
+{
+	rows = dense.rows;
+	cols = dense.cols;
+
+	if (rows > UINT32_MAX || cols > UINT32_MAX)
+	{
+		throw std::runtime_error("SparseMat: Too many rows or columns for 32 bits indices!");
+	}
+
+	Mat::Use use{ dense };
+
+	const auto& c_buffer = dense.host_buffer();
+
+	row_ptr.assign(rows + 1, 0);
+
+	for (size_t r = 0; r < rows; ++r)
+	{
+		for (size_t c = 0; c < cols; ++c)
+		{
+			if (c_buffer[r * cols + c] != 0)
+			{
+				col_idx.push_back(uint32_t(c));
+				values.push_back(c_buffer[r * cols + c]);
+			}
+		}
+
+		if (values.size() > UINT32_MAX)
+		{
+			throw std::runtime_error("SparseMat: Too many nonzeros for 32 bits indices!");
+		}
+
+		row_ptr[r + 1] = uint32_t(values.size());
+	}
+
+	if (upload_flag)
+	{
+		upload();
+	}
+}
+
+void SparseMat::build(const std::vector<size_t>& row_indices, const std::vector<size_t>& col_indices, const std::vector<float>& values)
+{
+	const size_t n = values.size();
+
+	if (row_indices.size() != n || col_indices.size() != n)
+	{
+		throw std::runtime_error("SparseMat: The coordinates and the values must have the same length!");
+	}
+
+	if (rows > UINT32_MAX || cols > UINT32_MAX || n > UINT32_MAX)
+	{
+		throw std::runtime_error("SparseMat: Too many rows, columns or nonzeros for 32 bits indices!");
+	}
+
+	std::vector<uint32_t> start(rows + 1, 0);
+	std::vector<uint32_t> order(n);
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (row_indices[i] >= rows || col_indices[i] >= cols)
+		{
+			throw std::runtime_error("SparseMat: Coordinate (" + std::to_string(row_indices[i]) + ", " + std::to_string(col_indices[i]) + ") is out of range!");
+		}
+
+		++start[row_indices[i] + 1];
+	}
+
+	std::partial_sum(start.begin(), start.end(), start.begin());
+
+	std::vector<uint32_t> next(start.begin(), start.end() - 1);
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		order[next[row_indices[i]]++] = uint32_t(i);
+	}
+
+	row_ptr.assign(rows + 1, 0);
+	col_idx.clear();
+	this->values.clear();
+	col_idx.reserve(n);
+	this->values.reserve(n);
+
+	for (size_t r = 0; r < rows; ++r)
+	{
+		std::sort(order.begin() + start[r], order.begin() + start[r + 1], [&](uint32_t a, uint32_t b)
+		{
+			return col_indices[a] < col_indices[b];
+		});
+
+		for (size_t p = start[r]; p < start[r + 1]; ++p)
+		{
+			const uint32_t c = uint32_t(col_indices[order[p]]);
+
+			if (p > start[r] && col_idx.back() == c)
+			{
+				this->values.back() += values[order[p]];
+			}
+			else
+			{
+				col_idx.push_back(c);
+				this->values.push_back(values[order[p]]);
+			}
+		}
+
+		row_ptr[r + 1] = uint32_t(col_idx.size());
+	}
+}
+
+size_t SparseMat::nnz(void) const
+{
+	return uploaded ? g_values.size() : values.size();
+}
+
+bool SparseMat::on_device(void) const
+{
+	return uploaded;
+}
+
+void SparseMat::upload(void)
+{
+	if (!uploaded)
+	{
+		to_device(row_ptr, g_row_ptr);
+		to_device(col_idx, g_col_idx);
+		to_device(values, g_values);
+
+		std::vector<uint32_t>().swap(row_ptr);
+		std::vector<uint32_t>().swap(col_idx);
+		std::vector<float>().swap(values);
+
+		uploaded = true;
+	}
+}
+
+void SparseMat::download(void)
+{
+	if (uploaded)
+	{
+		row_ptr = to_host(g_row_ptr);
+		col_idx = to_host(g_col_idx);
+		values = to_host(g_values);
+
+		g_row_ptr = boc::vector<cl_uint>(Mat::context);
+		g_col_idx = boc::vector<cl_uint>(Mat::context);
+		g_values = boc::vector<float>(Mat::context);
+
+		uploaded = false;
+	}
+}
+
+Mat SparseMat::to_dense(void) const
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global uint* row_ptr, __global uint* col_idx, __global float* values, __global float* output, uint cols)
+		{
+			const uint r = get_global_id(0);
+			const uint c = get_global_id(1);
+			const uint end = row_ptr[r + 1];
+
+			uint lo = row_ptr[r];
+			uint hi = end;
+
+			while (lo < hi)
+			{
+				const uint mid = (lo + hi) / 2;
+
+				if (col_idx[mid] < c)
+				{
+					lo = mid + 1;
+				}
+				else
+				{
+					hi = mid;
+				}
+			}
+
+			output[r * cols + c] = lo < end && col_idx[lo] == c ? values[lo] : 0;
+		}
+	);
+
+	Mat ans(rows, cols, uploaded);
+
+	if (uploaded)
+	{
+		static boc::program fun_program = Mat::build(source);
+		thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+		Mat::Use use{ ans };
+
+		Mat::launch("to_dense", fun_kernel, { rows, cols }, g_row_ptr, g_col_idx, g_values, ans.g_buffer, cl_uint(cols));
+	}
+	else
+	{
+		Mat::Use use{ ans };
+
+		std::fill(ans.c_buffer.begin(), ans.c_buffer.end(), 0.0f);
+
+		for (size_t r = 0; r < rows; ++r)
+		{
+			for (size_t p = row_ptr[r]; p < row_ptr[r + 1]; ++p)
+			{
+				ans.c_buffer[r * cols + col_idx[p]] = values[p];
+			}
+		}
+	}
+
+	return std::move(ans);
+}
+
+void SparseMat::to_coo(std::vector<size_t>& row_indices, std::vector<size_t>& col_indices, std::vector<float>& values) const
+{
+	const std::vector<uint32_t> h_row_ptr = uploaded ? to_host(g_row_ptr) : row_ptr;
+	const std::vector<uint32_t> h_col_idx = uploaded ? to_host(g_col_idx) : col_idx;
+
+	values = uploaded ? to_host(g_values) : this->values;
+	row_indices.resize(values.size());
+	col_indices.assign(h_col_idx.begin(), h_col_idx.end());
+
+	for (size_t r = 0; r < rows; ++r)
+	{
+		std::fill(row_indices.begin() + h_row_ptr[r], row_indices.begin() + h_row_ptr[r + 1], r);
+	}
+}
+
+Mat SparseMat::product(const SparseMat& a, const Mat& b, size_t k)
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global uint* row_ptr, __global uint* col_idx, __global float* values, __global float* b, __global float* output, uint k)
+		{
+			const uint r = get_global_id(0);
+			const uint j = get_global_id(1);
+			const uint end = row_ptr[r + 1];
+
+			float sum = 0;
+
+			for (uint p = row_ptr[r]; p < end; ++p)
+			{
+				sum += values[p] * b[(ulong)col_idx[p] * k + j];
+			}
+
+			output[(ulong)r * k + j] = sum;
+		}
+	);
+
+	Mat ans(a.rows, k, a.uploaded);
+	Mat::Use use{ b, ans };
+
+	if (a.uploaded)
+	{
+		static boc::program fun_program = Mat::build(source);
+		thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+		Mat::launch("spmm", fun_kernel, { a.rows, k }, a.g_row_ptr, a.g_col_idx, a.g_values, b.device_buffer(), ans.g_buffer, cl_uint(k));
+	}
+	else
+	{
+		Profiler::Span span("spmm", a.rows, k);
+
+		const auto& b_c_buffer = b.host_buffer();
+
+		for (size_t r = 0; r < a.rows; ++r)
+		{
+			float* output = ans.c_buffer.data() + r * k;
+
+			std::fill(output, output + k, 0.0f);
+
+			for (size_t p = a.row_ptr[r]; p < a.row_ptr[r + 1]; ++p)
+			{
+				const float value = a.values[p];
+				const float* row = b_c_buffer.data() + a.col_idx[p] * k;
+
+				for (size_t j = 0; j < k; ++j)
+				{
+					output[j] += value * row[j];
+				}
+			}
+		}
+	}
+
+	return std::move(ans);
+}
+
+Mat lav::spmm(const SparseMat& a, const Mat& b)
+{
+	if (a.cols != b.rows)
+	{
+		throw std::runtime_error("Spmm: Size mismatch between two matrices!");
+	}
+
+	return SparseMat::product(a, b, b.cols);
+}
+
+Mat lav::spmv(const SparseMat& a, const Mat& x)
+{
+	if (x.rows * x.cols != a.cols || (x.rows != 1 && x.cols != 1))
+	{
+		throw std::runtime_error("Spmv: x must be a vector of " + std::to_string(a.cols) + " elements!");
+	}
+
+	//A row and a column hold their datas in the same order.
+	return SparseMat::product(a, x, 1);
+}
+
+Mat lav::mul(const SparseMat& a, const Mat& b)
+{
+	return spmm(a, b);
+}
+
+Mat lav::mul(const Mat& a, const SparseMat& b)
+{
+	if (a.cols != b.rows)
+	{
+		throw std::runtime_error("Mul: Size mismatch between two matrices!");
+	}
+
+	return spmm(sparse_t(b), a.t()).t();
+}
+
+SparseMat lav::sparse_t(const SparseMat& mat)
+{
+	return SparseMat::transpose(mat);
+}
+
+SparseMat SparseMat::transpose(const SparseMat& mat)
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void expand(__global uint* row_ptr, __global uint* col_idx, __global ulong* keys)
+		{
+			const uint r = get_global_id(0);
+			const uint end = row_ptr[r + 1];
+
+			for (uint p = row_ptr[r]; p < end; ++p)
+			{
+				keys[p] = (ulong)col_idx[p] << 32 | r;
+			}
+		}
+
+		__kernel void starts(__global ulong* keys, __global uint* row_ptr, uint nnz)
+		{
+			const uint i = get_global_id(0);
+			const ulong key = (ulong)i << 32;
+
+			uint lo = 0;
+			uint hi = nnz;
+
+			while (lo < hi)
+			{
+				const uint mid = (lo + hi) / 2;
+
+				if (keys[mid] < key)
+				{
+					lo = mid + 1;
+				}
+				else
+				{
+					hi = mid;
+				}
+			}
+
+			row_ptr[i] = lo;
+		}
+
+		__kernel void split(__global ulong* keys, __global uint* col_idx)
+		{
+			const uint i = get_global_id(0);
+
+			col_idx[i] = (uint)keys[i];
+		}
+	);
+
+	SparseMat ans;
+
+	ans.rows = mat.cols;
+	ans.cols = mat.rows;
+
+	if (mat.uploaded)
+	{
+		Graph::unsupported("Sparse_t");
+
+		static boc::program fun_program = Mat::build(source);
+		thread_local boc::kernel expand_kernel(fun_program, "expand");
+		thread_local boc::kernel starts_kernel(fun_program, "starts");
+		thread_local boc::kernel split_kernel(fun_program, "split");
+
+		const size_t n = mat.g_values.size();
+
+		boc::vector<cl_ulong> keys(n, Mat::context);
+
+		ans.g_values = boc::vector<float>(n, Mat::context);
+		ans.g_col_idx = boc::vector<cl_uint>(n, Mat::context);
+		ans.g_row_ptr = boc::vector<cl_uint>(ans.rows + 1, Mat::context);
+		ans.uploaded = true;
+
+		Mat::launch("sparse_t", expand_kernel, mat.rows, mat.g_row_ptr, mat.g_col_idx, keys);
+
+		if (n)
+		{
+			Profiler::Span span("sparse_t::sort", n);
+
+			boc::copy(mat.g_values.begin(), mat.g_values.end(), ans.g_values.begin(), Mat::queue);
+			boc::sort_by_key(keys.begin(), keys.end(), ans.g_values.begin(), Mat::queue);
+		}
+
+		Mat::launch("sparse_t", starts_kernel, ans.rows + 1, keys, ans.g_row_ptr, cl_uint(n));
+		Mat::launch("sparse_t", split_kernel, n, keys, ans.g_col_idx);
+	}
+	else
+	{
+		const size_t n = mat.values.size();
+
+		ans.row_ptr.assign(ans.rows + 1, 0);
+		ans.col_idx.resize(n);
+		ans.values.resize(n);
+
+		for (size_t p = 0; p < n; ++p)
+		{
+			++ans.row_ptr[mat.col_idx[p] + 1];
+		}
+
+		std::partial_sum(ans.row_ptr.begin(), ans.row_ptr.end(), ans.row_ptr.begin());
+
+		std::vector<uint32_t> next(ans.row_ptr.begin(), ans.row_ptr.end() - 1);
+
+		//Walking the rows in order leaves every new row sorted by its columns.
+		for (size_t r = 0; r < mat.rows; ++r)
+		{
+			for (size_t p = mat.row_ptr[r]; p < mat.row_ptr[r + 1]; ++p)
+			{
+				const uint32_t q = next[mat.col_idx[p]]++;
+
+				ans.col_idx[q] = uint32_t(r);
+				ans.values[q] = mat.values[p];
+			}
+		}
+	}
+
+	return ans;
+}
+
+static std::string lower(std::string word)
+{
+	std::transform(word.begin(), word.end(), word.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+	return word;
+}
+
+SparseMat lav::load_mtx(const std::string& path, bool upload_flag)
+{
+	std::ifstream in(path, std::ios::binary);
+
+	if (!in)
+	{
+		throw std::runtime_error("Load_mtx: Could not find file named " + path);
+	}
+
+	std::string line;
+	std::string banner, object, format, field, symmetry;
+
+	std::getline(in, line);
+	std::istringstream(line) >> banner >> object >> format >> field >> symmetry;
+
+	if (banner != "%%MatrixMarket" || lower(object) != "matrix" || lower(format) != "coordinate")
+	{
+		throw std::runtime_error("Load_mtx: File " + path + " is not a Matrix Market coordinate file!");
+	}
+
+	field = lower(field);
+	symmetry = lower(symmetry);
+
+	if ((field != "real" && field != "integer" && field != "pattern") || (symmetry != "general" && symmetry != "symmetric" && symmetry != "skew-symmetric"))
+	{
+		throw std::runtime_error("Load_mtx: The " + field + " " + symmetry + " matrices of " + path + " are not supported!");
+	}
+
+	while (std::getline(in, line) && (line.empty() || line[0] == '%'))
+	{
+
+	}
+
+	size_t rows = 0, cols = 0, entries = 0;
+
+	if (!(std::istringstream(line) >> rows >> cols >> entries))
+	{
+		throw std::runtime_error("Load_mtx: File " + path + " has no size line!");
+	}
+
+	//The entries are parsed from one buffer, the stream operators are far too slow for them.
+	const std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	const char* p = text.c_str();
+	const bool pattern = field == "pattern";
+	const bool mirrored = symmetry != "general";
+	const float sign = symmetry == "skew-symmetric" ? -1.0f : 1.0f;
+
+	std::vector<size_t> row_indices, col_indices;
+	std::vector<float> values;
+
+	row_indices.reserve(mirrored ? 2 * entries : entries);
+	col_indices.reserve(mirrored ? 2 * entries : entries);
+	values.reserve(mirrored ? 2 * entries : entries);
+
+	//strtoull would wrap a negative index around instead of failing.
+	auto read_index = [&](size_t i, size_t& index)
+	{
+		while (std::isspace(static_cast<unsigned char>(*p)))
+		{
+			++p;
+		}
+
+		if (*p == '-')
+		{
+			throw std::runtime_error("Load_mtx: Entry " + std::to_string(i + 1) + " of file " + path + " has a negative index!");
+		}
+
+		char* end = nullptr;
+		index = std::strtoull(p, &end, 10);
+
+		const bool ok = end != p;
+		p = end;
+
+		return ok;
+	};
+
+	for (size_t i = 0; i < entries; ++i)
+	{
+		char* end = nullptr;
+		size_t r = 0, c = 0;
+		const bool row_ok = read_index(i, r);
+		const bool col_ok = read_index(i, c);
+		float value = 1;
+
+		if (!pattern)
+		{
+			value = std::strtof(p, &end);
+
+			if (end == p)
+			{
+				throw std::runtime_error("Load_mtx: Entry " + std::to_string(i + 1) + " of file " + path + " is truncated!");
+			}
+
+			p = end;
+		}
+
+		if (!row_ok || !col_ok)
+		{
+			throw std::runtime_error("Load_mtx: Entry " + std::to_string(i + 1) + " of file " + path + " is truncated!");
+		}
+
+		if (r == 0 || c == 0)
+		{
+			throw std::runtime_error("Load_mtx: Entry " + std::to_string(i + 1) + " of file " + path + " is not 1-based!");
+		}
+
+		row_indices.push_back(r - 1);
+		col_indices.push_back(c - 1);
+		values.push_back(value);
+
+		if (mirrored && r != c)
+		{
+			row_indices.push_back(c - 1);
+			col_indices.push_back(r - 1);
+			values.push_back(sign * value);
+		}
+	}
+
+	return SparseMat(rows, cols, row_indices, col_indices, values, upload_flag);
+}
+
+void lav::save_mtx(const std::string& path, const SparseMat& mat)
+{
+	std::ofstream out(path, std::ios::binary);
+
+	if (!out)
+	{
+		throw std::runtime_error("Save_mtx: Could not open file named " + path);
+	}
+
+	std::vector<size_t> row_indices, col_indices;
+	std::vector<float> values;
+
+	mat.to_coo(row_indices, col_indices, values);
+
+	out << "%%MatrixMarket matrix coordinate real general\n";
+	out << mat.rows << ' ' << mat.cols << ' ' << values.size() << '\n';
+	out << std::setprecision(std::numeric_limits<float>::max_digits10);
+
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		out << row_indices[i] + 1 << ' ' << col_indices[i] + 1 << ' ' << values[i] << '\n';
+	}
+}
\ No newline at end of file
@@ -0,0 +1,166 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : stats.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat/lav_mat.h>
+
+#include <algorithm>
+
+using namespace lav;
+
+struct Counters
+{
+	std::mutex mutex;
+	Stats stats;
+	size_t device_usage = 0;
+	size_t host_usage = 0;
+};
+
+//Never destroyed, like the residency registry.
+static Counters& counters(void)
+{
+	static Counters* counters = new Counters;
+	return *counters;
+}
+
+Stats Stats::operator-(const Stats& another) const
+{
+	Stats ans = *this;
+
+	//A reset in between leaves the newer counts below the older ones, they are clamped at zero then.
+	auto&& sub = [](auto& a, auto b)
+	{
+		a = a > b ? a - b : 0;
+	};
+
+	sub(ans.uploads, another.uploads);
+	sub(ans.upload_bytes, another.upload_bytes);
+	sub(ans.downloads, another.downloads);
+	sub(ans.download_bytes, another.download_bytes);
+	sub(ans.device_allocations, another.device_allocations);
+	sub(ans.host_allocations, another.host_allocations);
+	sub(ans.launches, another.launches);
+	sub(ans.builds, another.builds);
+	sub(ans.gemms, another.gemms);
+
+	for (const auto& [name, count] : another.launches_per_op)
+	{
+		auto it = ans.launches_per_op.find(name);
+
+		if (it != ans.launches_per_op.end())
+		{
+			sub(it->second, count);
+
+			if (!it->second)
+			{
+				ans.launches_per_op.erase(it);
+			}
+		}
+	}
+
+	return ans;
+}
+
+Stats Stats::get(void)
+{
+	std::lock_guard<std::mutex> lock(counters().mutex);
+
+	return counters().stats;
+}
+
+void Stats::reset(void)
+{
+	std::lock_guard<std::mutex> lock(counters().mutex);
+
+	auto& all = counters();
+
+	all.stats = Stats();
+	all.stats.device_peak = all.device_usage;
+	all.stats.host_peak = all.host_usage;
+}
+
+Stats::Scope::Scope(void) :
+	start(Stats::get())
+{
+
+}
+
+Stats Stats::Scope::get(void) const
+{
+	return Stats::get() - start;
+}
+
+void Stats::count_transfer(bool upload, size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(counters().mutex);
+
+	auto& stats = counters().stats;
+
+	++(upload ? stats.uploads : stats.downloads);
+	(upload ? stats.upload_bytes : stats.download_bytes) += bytes;
+}
+
+void Stats::count_memory(bool device, bool allocation, size_t usage)
+{
+	std::lock_guard<std::mutex> lock(counters().mutex);
+
+	auto& all = counters();
+
+	if (device)
+	{
+		all.device_usage = usage;
+		all.stats.device_allocations += allocation;
+		all.stats.device_peak = std::max(all.stats.device_peak, usage);
+	}
+	else
+	{
+		all.host_usage = usage;
+		all.stats.host_allocations += allocation;
+		all.stats.host_peak = std::max(all.stats.host_peak, usage);
+	}
+}
+
+void Stats::count_launch(const char* name)
+{
+	std::lock_guard<std::mutex> lock(counters().mutex);
+
+	auto& stats = counters().stats;
+
+	++stats.launches;
+	++stats.launches_per_op[name];
+}
+
+void Stats::count_build(void)
+{
+	std::lock_guard<std::mutex> lock(counters().mutex);
+
+	++counters().stats.builds;
+}
+
+void Stats::count_gemm(void)
+{
+	std::lock_guard<std::mutex> lock(counters().mutex);
+
+	++counters().stats.gemms;
+}
\ No newline at end of file
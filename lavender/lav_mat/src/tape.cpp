@@ -0,0 +1,915 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : tape.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : A run has 2n steps for n nodes: step i runs node i forward
+ *                 and step 2n - 1 - i runs it backward, so the last use of
+ *                 every activation and the life of every gradient are known
+ *                 from the nodes alone. plan fills them in and counts, step
+ *                 by step, the bytes held by the activations and gradients
+ *                 and the temporaries of the step; run then follows it.
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat/lav_mat.h>
+
+#include <algorithm>
+
+using namespace lav;
+namespace boc = boost::compute;
+
+//The members of Tape hide these names, from here the lookup by argument still finds them.
+static Mat exp_of(const Mat& mat)
+{
+	return exp(mat);
+}
+
+static Mat log_of(const Mat& mat)
+{
+	return log(mat);
+}
+
+static Mat sqrt_of(const Mat& mat)
+{
+	return sqrt(mat);
+}
+
+static Mat relu_of(const Mat& mat)
+{
+	return lav::relu(mat);
+}
+
+static bool broadcastable(size_t a_rows, size_t a_cols, size_t b_rows, size_t b_cols)
+{
+	return (a_rows == b_rows && (a_cols == b_cols || a_cols == 1 || b_cols == 1)) || (a_cols == b_cols && (a_rows == 1 || b_rows == 1));
+}
+
+size_t Tape::push(Node node)
+{
+	const size_t n = nodes.size();
+
+	if (node.op != Op::input && node.op != Op::param && (node.a >= n || node.b >= n))
+	{
+		throw std::runtime_error("Tape: The operands must be recorded first!");
+	}
+
+	nodes.push_back(std::move(node));
+
+	return n;
+}
+
+size_t Tape::input(const Mat& mat)
+{
+	Node node;
+
+	node.op = Op::input;
+
+	node.rows = mat.rows;
+	node.cols = mat.cols;
+	node.source = &mat;
+
+	return push(std::move(node));
+}
+
+size_t Tape::param(const Mat& mat)
+{
+	Node node;
+
+	node.op = Op::param;
+
+	node.rows = mat.rows;
+	node.cols = mat.cols;
+	node.source = &mat;
+
+	return push(std::move(node));
+}
+
+Tape::Node Tape::elementwise(size_t a, size_t b) const
+{
+	Node node;
+
+	node.a = a;
+	node.b = b;
+
+	if (a < nodes.size() && b < nodes.size())
+	{
+		const auto& x = nodes[a];
+		const auto& y = nodes[b];
+
+		if (!broadcastable(x.rows, x.cols, y.rows, y.cols))
+		{
+			throw std::runtime_error("Binary_op: Size mismatch between two matrices!");
+		}
+
+		node.rows = std::max(x.rows, y.rows);
+		node.cols = std::max(x.cols, y.cols);
+	}
+
+	return std::move(node);
+}
+
+size_t Tape::add(size_t a, size_t b)
+{
+	Node node = elementwise(a, b);
+	node.op = Op::add;
+	return push(std::move(node));
+}
+
+size_t Tape::sub(size_t a, size_t b)
+{
+	Node node = elementwise(a, b);
+	node.op = Op::sub;
+	return push(std::move(node));
+}
+
+size_t Tape::mul(size_t a, size_t b)
+{
+	Node node = elementwise(a, b);
+	node.op = Op::mul;
+	return push(std::move(node));
+}
+
+size_t Tape::div(size_t a, size_t b)
+{
+	Node node = elementwise(a, b);
+	node.op = Op::div;
+	return push(std::move(node));
+}
+
+Tape::Node Tape::unary(size_t a) const
+{
+	Node node;
+
+	node.a = a;
+	node.b = a;
+
+	if (a < nodes.size())
+	{
+		node.rows = nodes[a].rows;
+		node.cols = nodes[a].cols;
+	}
+
+	return std::move(node);
+}
+
+size_t Tape::neg(size_t a)
+{
+	Node node = unary(a);
+	node.op = Op::neg;
+	return push(std::move(node));
+}
+
+size_t Tape::scale(size_t a, float th)
+{
+	Node node = unary(a);
+	node.op = Op::scale;
+	node.th = th;
+	return push(std::move(node));
+}
+
+size_t Tape::shift(size_t a, float th)
+{
+	Node node = unary(a);
+	node.op = Op::shift;
+	node.th = th;
+	return push(std::move(node));
+}
+
+size_t Tape::exp(size_t a)
+{
+	Node node = unary(a);
+	node.op = Op::exp;
+	return push(std::move(node));
+}
+
+size_t Tape::log(size_t a)
+{
+	Node node = unary(a);
+	node.op = Op::log;
+	return push(std::move(node));
+}
+
+size_t Tape::sqrt(size_t a)
+{
+	Node node = unary(a);
+	node.op = Op::sqrt;
+	return push(std::move(node));
+}
+
+size_t Tape::relu(size_t a)
+{
+	Node node = unary(a);
+	node.op = Op::relu;
+	return push(std::move(node));
+}
+
+size_t Tape::sum(size_t a, bool axis)
+{
+	Node node = unary(a);
+	node.op = Op::sum;
+	node.axis = axis;
+	node.rows = axis ? node.rows : 1;
+	node.cols = axis ? 1 : node.cols;
+	return push(std::move(node));
+}
+
+size_t Tape::mean(size_t a, bool axis)
+{
+	Node node = unary(a);
+	node.op = Op::mean;
+	node.axis = axis;
+	node.rows = axis ? node.rows : 1;
+	node.cols = axis ? 1 : node.cols;
+	return push(std::move(node));
+}
+
+size_t Tape::matmul(size_t a, size_t b, bool trans_a, bool trans_b)
+{
+	Node node;
+
+	node.op = Op::matmul;
+
+	node.a = a;
+	node.b = b;
+	node.trans_a = trans_a;
+	node.trans_b = trans_b;
+
+	if (a < nodes.size() && b < nodes.size())
+	{
+		const auto& x = nodes[a];
+		const auto& y = nodes[b];
+
+		if ((trans_a ? x.rows : x.cols) != (trans_b ? y.cols : y.rows))
+		{
+			throw std::runtime_error("Mul: Size mismatch between two matrices!");
+		}
+
+		node.rows = trans_a ? x.cols : x.rows;
+		node.cols = trans_b ? y.rows : y.cols;
+	}
+
+	return push(std::move(node));
+}
+
+size_t Tape::conv4d(size_t f, size_t g, std::vector<size_t> size, size_t stride, const std::string& padding)
+{
+	Node node;
+
+	node.op = Op::conv4d;
+
+	node.a = f;
+	node.b = g;
+	node.stride = stride;
+	node.valid_padding = padding == "valid";
+
+	if (!node.valid_padding && padding != "same")
+	{
+		throw std::runtime_error("Conv4d: The value of padding can only be \"valid\" or \"same\"!");
+	}
+
+	if (size.size() > 5)
+	{
+		throw std::runtime_error("Conv4d: Size vector must have 5 dimensions, which is width, height, channel, filter size and batch size!");
+	}
+
+	size.insert(size.end(), 5 - size.size(), 1);
+
+	if (size[3] % 2 == 0)
+	{
+		throw std::runtime_error("Conv4d: Side length of filter must be odd!");
+	}
+
+	if (f < nodes.size() && g < nodes.size())
+	{
+		const auto& x = nodes[f];
+		const auto& y = nodes[g];
+
+		if (size[0] * size[1] * size[4] != x.rows || size[2] != x.cols || size[3] * size[3] * size[2] != y.rows)
+		{
+			throw std::runtime_error("Conv4d: The size of matrices f and g must match the value of vector size!");
+		}
+
+		const size_t nw = node.valid_padding ? (size[0] - size[3]) / stride + 1 : (size[0] + stride - 1) / stride;
+		const size_t nh = node.valid_padding ? (size[1] - size[3]) / stride + 1 : (size[1] + stride - 1) / stride;
+
+		node.rows = nw * nh * size[4];
+		node.cols = y.cols;
+	}
+
+	node.shape = std::move(size);
+
+	return push(std::move(node));
+}
+
+void Tape::keep(size_t node)
+{
+	if (node >= nodes.size())
+	{
+		throw std::runtime_error("Keep: Unknown node!");
+	}
+
+	nodes[node].kept = true;
+}
+
+bool Tape::leaf(size_t node) const
+{
+	return nodes[node].op == Op::input || nodes[node].op == Op::param;
+}
+
+bool Tape::binary(size_t node) const
+{
+	switch (nodes[node].op)
+	{
+	case Op::add:
+	case Op::sub:
+	case Op::mul:
+	case Op::div:
+	case Op::matmul:
+	case Op::conv4d:
+		return true;
+	default:
+		return false;
+	}
+}
+
+size_t Tape::bytes(size_t node) const
+{
+	return nodes[node].rows * nodes[node].cols * sizeof(float);
+}
+
+size_t Tape::step_of(size_t node, bool backward) const
+{
+	return backward ? 2 * nodes.size() - 1 - node : node;
+}
+
+std::vector<size_t> Tape::reads(size_t node) const
+{
+	const Node& x = nodes[node];
+	const bool a = nodes[x.a].grad_needed;
+	const bool b = nodes[x.b].grad_needed;
+
+	switch (x.op)
+	{
+	case Op::mul:
+	case Op::matmul:
+	case Op::conv4d:
+		//The gradient of each operand is the upstream one times the other operand.
+		return a && b ? std::vector<size_t>{ x.a, x.b } : a ? std::vector<size_t>{ x.b } : std::vector<size_t>{ x.a };
+	case Op::div:
+		return b ? std::vector<size_t>{ x.a, x.b } : std::vector<size_t>{ x.b };
+	case Op::log:
+	case Op::relu:
+		return { x.a };
+	case Op::exp:
+	case Op::sqrt:
+		return { node };
+	default:
+		return {};
+	}
+}
+
+size_t Tape::plan(size_t loss)
+{
+	if (loss >= nodes.size())
+	{
+		throw std::runtime_error("Plan: The loss is not a node of the tape!");
+	}
+
+	const size_t n = nodes.size();
+
+	for (auto& node : nodes)
+	{
+		node.needed = false;
+		node.grad_needed = false;
+		node.last_use = 0;
+		node.reuse = SIZE_MAX;
+	}
+
+	nodes[loss].needed = true;
+
+	for (size_t i = loss + 1; i-- > 0;)
+	{
+		if (nodes[i].needed && !leaf(i))
+		{
+			nodes[nodes[i].a].needed = true;
+			nodes[nodes[i].b].needed = true;
+		}
+	}
+
+	for (size_t i = 0; i <= loss; ++i)
+	{
+		nodes[i].grad_needed = nodes[i].op == Op::param || (!leaf(i) && (nodes[nodes[i].a].grad_needed || nodes[nodes[i].b].grad_needed));
+	}
+
+	if (!nodes[loss].grad_needed)
+	{
+		throw std::runtime_error("Plan: The loss does not depend on any param!");
+	}
+
+	for (size_t i = 0; i <= loss; ++i)
+	{
+		if (!nodes[i].needed || leaf(i))
+		{
+			continue;
+		}
+
+		nodes[i].last_use = std::max(nodes[i].last_use, step_of(i, false));
+		nodes[nodes[i].a].last_use = std::max(nodes[nodes[i].a].last_use, step_of(i, false));
+		nodes[nodes[i].b].last_use = std::max(nodes[nodes[i].b].last_use, step_of(i, false));
+
+		if (nodes[i].grad_needed)
+		{
+			for (size_t read : reads(i))
+			{
+				nodes[read].last_use = std::max(nodes[read].last_use, step_of(i, true));
+			}
+		}
+	}
+
+	frees.assign(2 * n, {});
+
+	for (size_t i = 0; i <= loss; ++i)
+	{
+		if (nodes[i].needed && !leaf(i) && !nodes[i].kept && i != loss)
+		{
+			frees[nodes[i].last_use].push_back(i);
+		}
+	}
+
+	size_t live = 0;
+	size_t peak = 0;
+
+	auto&& release = [&](size_t step)
+	{
+		for (size_t node : frees[step])
+		{
+			live -= bytes(node);
+		}
+	};
+
+	for (size_t i = 0; i <= loss; ++i)
+	{
+		if (nodes[i].needed && !leaf(i))
+		{
+			const Node& x = nodes[i];
+
+			live += bytes(i);
+			peak = std::max(peak, live + (x.op == Op::conv4d ? x.rows * nodes[x.b].rows * sizeof(float) : 0));
+			release(step_of(i, false));
+		}
+	}
+
+	std::vector<bool> born(n, false);
+
+	born[loss] = true;
+	live += bytes(loss);
+	peak = std::max(peak, live);
+
+	for (size_t i = loss + 1; i-- > 0;)
+	{
+		Node& x = nodes[i];
+
+		if (!x.needed || !x.grad_needed || leaf(i))
+		{
+			continue;
+		}
+
+		//The upstream gradient is only read by this step, a pass-through hands its buffer on.
+		if (x.op == Op::add || x.op == Op::sub || x.op == Op::neg || x.op == Op::scale || x.op == Op::shift)
+		{
+			for (size_t operand : { x.b, x.a })
+			{
+				if (nodes[operand].grad_needed && nodes[operand].rows == x.rows && nodes[operand].cols == x.cols)
+				{
+					x.reuse = operand;
+				}
+			}
+		}
+
+		size_t transient = 0;
+
+		if (x.op == Op::conv4d)
+		{
+			transient = x.rows * nodes[x.b].rows * sizeof(float);
+		}
+		else if (x.op == Op::mul || x.op == Op::div || x.op == Op::exp || x.op == Op::log || x.op == Op::sqrt || x.op == Op::relu)
+		{
+			transient = (x.op == Op::div ? 2 : 1) * bytes(i);
+		}
+
+		std::vector<size_t> operands = { x.a };
+
+		if (binary(i))
+		{
+			operands.push_back(x.b);
+		}
+
+		//As run does: the other contributions first, while the upstream gradient is still there.
+		std::vector<size_t> others;
+		bool handed_on = false;
+
+		for (size_t operand : operands)
+		{
+			if (!nodes[operand].grad_needed)
+			{
+				continue;
+			}
+
+			if (operand == x.reuse && !handed_on)
+			{
+				handed_on = true;
+			}
+			else
+			{
+				others.push_back(operand);
+			}
+		}
+
+		for (size_t operand : others)
+		{
+			live += bytes(operand);
+			peak = std::max(peak, live + transient);
+
+			if (born[operand])
+			{
+				live -= bytes(operand);//Added in place, then dropped.
+			}
+
+			born[operand] = true;
+		}
+
+		if (!handed_on || born[x.reuse])
+		{
+			live -= bytes(i);
+		}
+
+		if (handed_on)
+		{
+			born[x.reuse] = true;
+		}
+
+		release(step_of(i, true));
+	}
+
+	target = loss;
+
+	return peak;
+}
+
+const Mat& Tape::in(size_t node) const
+{
+	return leaf(node) ? *nodes[node].source : nodes[node].value;
+}
+
+void Tape::run(size_t loss)
+{
+	plan(loss);
+
+	Profiler::Span span("Tape::run", nodes.size());
+
+	for (auto& node : nodes)
+	{
+		node.value = Mat();
+		node.grad = Mat();
+		node.has_grad = false;
+	}
+
+	for (size_t i = 0; i <= loss; ++i)
+	{
+		if (nodes[i].needed && !leaf(i))
+		{
+			forward(i);
+
+			for (size_t node : frees[step_of(i, false)])
+			{
+				nodes[node].value = Mat();
+			}
+		}
+	}
+
+	nodes[loss].grad = Ones(nodes[loss].rows, nodes[loss].cols, true);
+	nodes[loss].has_grad = true;
+
+	for (size_t i = loss + 1; i-- > 0;)
+	{
+		if (nodes[i].needed && nodes[i].grad_needed && !leaf(i))
+		{
+			backward(i);
+
+			nodes[i].grad = Mat();
+			nodes[i].has_grad = false;
+
+			for (size_t node : frees[step_of(i, true)])
+			{
+				nodes[node].value = Mat();
+			}
+		}
+	}
+}
+
+void Tape::forward(size_t node)
+{
+	Node& x = nodes[node];
+
+	switch (x.op)
+	{
+	case Op::add:
+		x.value = in(x.a) + in(x.b);
+		break;
+	case Op::sub:
+		x.value = in(x.a) - in(x.b);
+		break;
+	case Op::mul:
+		x.value = in(x.a) * in(x.b);
+		break;
+	case Op::div:
+		x.value = in(x.a) / in(x.b);
+		break;
+	case Op::neg:
+		x.value = -in(x.a);
+		break;
+	case Op::scale:
+		x.value = in(x.a) * x.th;
+		break;
+	case Op::shift:
+		x.value = in(x.a) + x.th;
+		break;
+	case Op::matmul:
+		x.value = lav::mul(in(x.a), in(x.b), x.trans_a, x.trans_b);
+		break;
+	case Op::conv4d:
+		x.value = lav::mul(Mat::im2col(in(x.a), x.shape, x.stride, x.valid_padding), in(x.b));
+		break;
+	case Op::exp:
+		x.value = exp_of(in(x.a));
+		break;
+	case Op::log:
+		x.value = log_of(in(x.a));
+		break;
+	case Op::sqrt:
+		x.value = sqrt_of(in(x.a));
+		break;
+	case Op::relu:
+		x.value = relu_of(in(x.a));
+		break;
+	case Op::sum:
+		x.value = in(x.a).sum(x.axis);
+		break;
+	case Op::mean:
+		x.value = in(x.a).mean(x.axis);
+		break;
+	default:
+		break;
+	}
+}
+
+void Tape::backward(size_t node)
+{
+	Node& x = nodes[node];
+	Mat& g = x.grad;
+	const bool a = nodes[x.a].grad_needed;
+	const bool b = binary(node) && nodes[x.b].grad_needed;
+	const bool hand_a = a && x.reuse == x.a;
+	const bool hand_b = b && x.reuse == x.b && !hand_a;
+
+	switch (x.op)
+	{
+	case Op::add:
+	case Op::sub:
+		if (a && !hand_a)
+		{
+			contribute(x.a, reduce(Mat(g), x.a));
+		}
+
+		if (b && !hand_b)
+		{
+			contribute(x.b, x.op == Op::add ? reduce(Mat(g), x.b) : -reduce(Mat(g), x.b));
+		}
+
+		if (hand_b && x.op == Op::sub)
+		{
+			scale_(g, -1);
+		}
+		break;
+	case Op::neg:
+		scale_(g, -1);
+		break;
+	case Op::scale:
+		scale_(g, x.th);
+		break;
+	case Op::mul:
+		if (a)
+		{
+			contribute(x.a, reduce(g * in(x.b), x.a));
+		}
+
+		if (b)
+		{
+			contribute(x.b, reduce(g * in(x.a), x.b));
+		}
+		break;
+	case Op::div:
+		if (a)
+		{
+			contribute(x.a, reduce(g / in(x.b), x.a));
+		}
+
+		if (b)
+		{
+			contribute(x.b, reduce(-(g * in(x.a)) / (in(x.b) * in(x.b)), x.b));
+		}
+		break;
+	case Op::matmul:
+		if (a)
+		{
+			contribute(x.a, x.trans_a ? lav::mul(in(x.b), g, x.trans_b, true) : lav::mul(g, in(x.b), false, !x.trans_b));
+		}
+
+		if (b)
+		{
+			contribute(x.b, x.trans_b ? lav::mul(g, in(x.a), true, x.trans_a) : lav::mul(in(x.a), g, !x.trans_a, false));
+		}
+		break;
+	case Op::conv4d:
+		if (b)
+		{
+			contribute(x.b, lav::mul(Mat::im2col(in(x.a), x.shape, x.stride, x.valid_padding), g, true, false));
+		}
+
+		if (a)
+		{
+			contribute(x.a, Mat::col2im(lav::mul(g, in(x.b), false, true), x.shape, x.stride, x.valid_padding));
+		}
+		break;
+	case Op::exp:
+		contribute(x.a, g * in(node));
+		break;
+	case Op::log:
+		contribute(x.a, g / in(x.a));
+		break;
+	case Op::sqrt:
+		contribute(x.a, g / (in(node) * 2.0f));
+		break;
+	case Op::relu:
+		contribute(x.a, lav::relu_backward(g, in(x.a)));
+		break;
+	case Op::sum:
+	case Op::mean:
+	{
+		const Node& y = nodes[x.a];
+		const float k = x.op == Op::mean ? 1.0f / (x.axis ? y.cols : y.rows) : 1.0f;
+
+		contribute(x.a, x.axis ? lav::mul(g, Full(1, y.cols, k, true)) : lav::mul(Full(y.rows, 1, k, true), g));
+		break;
+	}
+	default:
+		break;
+	}
+
+	if (x.reuse != SIZE_MAX)
+	{
+		contribute(x.reuse, std::move(g));
+	}
+}
+
+void Tape::contribute(size_t node, Mat&& grad)
+{
+	Node& x = nodes[node];
+
+	if (x.has_grad)
+	{
+		accumulate_(x.grad, grad);
+	}
+	else
+	{
+		x.grad = std::move(grad);
+		x.has_grad = true;
+	}
+}
+
+Mat Tape::reduce(Mat&& grad, size_t node) const
+{
+	const Node& x = nodes[node];
+
+	if (grad.rows != x.rows)
+	{
+		grad = grad.sum(false);
+	}
+
+	if (grad.cols != x.cols)
+	{
+		grad = grad.sum(true);
+	}
+
+	return std::move(grad);
+}
+
+void Tape::accumulate_(Mat& dst, const Mat& src)
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global float* dst, __global float* src)
+		{
+			const uint i = get_global_id(0);
+
+			dst[i] += src[i];
+		}
+	);
+
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+	dst.upload();
+
+	Mat::Use use{ dst, src };
+
+	dst.invalidate();
+
+	Mat::launch("accumulate_", fun_kernel, dst.rows * dst.cols, dst.g_buffer, src.device_buffer());
+}
+
+void Tape::scale_(Mat& mat, float th)
+{
+	static const char source[] = BOOST_COMPUTE_STRINGIZE_SOURCE
+	(
+		__kernel void fun(__global float* mat, float th)
+		{
+			const uint i = get_global_id(0);
+
+			mat[i] *= th;
+		}
+	);
+
+	static boc::program fun_program = Mat::build(source);
+	thread_local boc::kernel fun_kernel(fun_program, "fun");
+
+	mat.upload();
+
+	Mat::Use use{ mat };
+
+	mat.invalidate();
+
+	Mat::launch("scale_", fun_kernel, mat.rows * mat.cols, mat.g_buffer, th);
+}
+
+const Mat& Tape::value(size_t node) const
+{
+	if (node >= nodes.size())
+	{
+		throw std::runtime_error("Value: Unknown node!");
+	}
+
+	if (!leaf(node) && !nodes[node].kept && node != target)
+	{
+		throw std::runtime_error("Value: The activation is freed by the plan, keep the node before running!");
+	}
+
+	return in(node);
+}
+
+const Mat& Tape::grad(size_t node) const
+{
+	if (node >= nodes.size() || nodes[node].op != Op::param)
+	{
+		throw std::runtime_error("Grad: Only the gradients of params are kept!");
+	}
+
+	if (!nodes[node].has_grad)
+	{
+		throw std::runtime_error("Grad: The param does not reach the loss of the last run!");
+	}
+
+	return nodes[node].grad;
+}
+
+size_t Tape::size(void) const
+{
+	return nodes.size();
+}
+
+void Tape::clear(void)
+{
+	nodes.clear();
+	frees.clear();
+	target = SIZE_MAX;
+}
\ No newline at end of file
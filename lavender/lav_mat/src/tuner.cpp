@@ -0,0 +1,295 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : tuner.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : The kernels launched through Mat::launch use no local
+ *                 memory and no barrier, so any local size that divides
+ *                 the global size gives the same result and only the speed
+ *                 changes. The kernels that reduce in local memory go
+ *                 through Mat::launch_groups with their own local size and
+ *                 are never tuned. The search times each candidate with
+ *                 the profiling events of a queue of its own, the shared
+ *                 one having none unless the profiler is on, the driver's
+ *                 own choice being one of the candidates, and keeps the
+ *                 fastest. A winner only applies when it divides the
+ *                 global size of the launch, other launches of the same
+ *                 class are left to the driver.
+ *
+ *                 One line of the file per entry, tab separated:
+ *                 device, kernel, shape class, local size (0 = driver).
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat/lav_mat.h>
+
+#include <algorithm>
+#include <sstream>
+
+using namespace lav;
+namespace boc = boost::compute;
+
+std::atomic<bool> Tuner::flag(false);
+
+struct Table
+{
+	std::mutex mutex;
+	std::map<std::string, std::array<size_t, 2>> entries;
+	std::atomic<bool> empty{ true };//Read without the mutex, so that untuned launches skip the lookup.
+};
+
+//Never destroyed, like the residency registry.
+static Table& table(void)
+{
+	static Table* table = new Table;
+	return *table;
+}
+
+//Read once, the device is fixed after Mat::init.
+static const std::string& identity(void)
+{
+	static const std::string identity = Mat::device.name() + " (" + Mat::device.driver_version() + ")";
+	return identity;
+}
+
+void Tuner::tune(bool flag)
+{
+	Tuner::flag = flag;
+}
+
+bool Tuner::tuning(void)
+{
+	return flag;
+}
+
+void Tuner::clear(void)
+{
+	std::lock_guard<std::mutex> lock(table().mutex);
+
+	table().entries.clear();
+	table().empty = true;
+}
+
+size_t Tuner::size(void)
+{
+	std::lock_guard<std::mutex> lock(table().mutex);
+
+	return table().entries.size();
+}
+
+std::string Tuner::default_path(void)
+{
+	const char* path = std::getenv("LAV_MAT_TUNING_FILE");
+
+	return path && *path ? path : "lav_mat_tuning.txt";
+}
+
+bool Tuner::load(const std::string& path)
+{
+	std::ifstream in(path);
+
+	if (!in)
+	{
+		return false;
+	}
+
+	std::string line;
+	std::lock_guard<std::mutex> lock(table().mutex);
+
+	while (std::getline(in, line))
+	{
+		if (!line.empty() && line.back() == '\r')
+		{
+			line.pop_back();
+		}
+
+		const size_t pos = line.rfind('\t');
+
+		if (line.empty() || line[0] == '#' || pos == std::string::npos)
+		{
+			continue;
+		}
+
+		std::array<size_t, 2> local = { 0, 1 };
+		std::istringstream sin(line.substr(pos + 1));
+		char ch;
+
+		if (!(sin >> local[0]) || ((sin >> ch) && !(ch == 'x' && sin >> local[1])))
+		{
+			throw std::runtime_error("Tuner::load: Bad local size in " + path + "!");
+		}
+
+		table().entries[line.substr(0, pos)] = local;
+		table().empty = false;
+	}
+
+	return true;
+}
+
+void Tuner::save(const std::string& path)
+{
+	std::ofstream out(path);
+
+	if (!out)
+	{
+		throw std::runtime_error("Tuner::save: Cannot open " + path + "!");
+	}
+
+	std::lock_guard<std::mutex> lock(table().mutex);
+
+	out << "#device\tkernel\tshape class\tlocal size" << std::endl;
+
+	for (auto& entry : table().entries)
+	{
+		out << entry.first << '\t' << entry.second[0] << 'x' << entry.second[1] << std::endl;
+	}
+}
+
+//The shape class of a global size is its highest power of two, per dimension.
+std::string Tuner::key(const char* name, const boc::kernel& kernel, size_t dims, const size_t* global)
+{
+	std::string shape;
+
+	for (size_t i = 0; i < dims; ++i)
+	{
+		size_t bits = 0;
+
+		while (global[i] >> (bits + 1))
+		{
+			++bits;
+		}
+
+		shape += (i ? "x2^" : "2^") + std::to_string(bits);
+	}
+
+	return identity() + '\t' + name + ':' + kernel.name() + '\t' + shape;
+}
+
+std::vector<std::array<size_t, 2>> Tuner::candidates(const boc::kernel& kernel, size_t dims, const size_t* global)
+{
+	const size_t limit = std::min(kernel.get_work_group_info<size_t>(Mat::device, CL_KERNEL_WORK_GROUP_SIZE), Mat::device.max_work_group_size());
+	const auto items = Mat::device.get_info<std::vector<size_t>>(CL_DEVICE_MAX_WORK_ITEM_SIZES);
+
+	std::vector<std::array<size_t, 2>> ans = { { 0, 1 } };
+
+	for (size_t x = 1; x <= limit && x <= items[0]; x *= 2)
+	{
+		for (size_t y = 1; y <= (dims == 2 ? limit / x : 1) && y <= items[std::min<size_t>(1, items.size() - 1)]; y *= 2)
+		{
+			if (x * y >= 8 && global[0] % x == 0 && (dims == 1 || global[1] % y == 0))
+			{
+				ans.push_back({ x, y });
+			}
+		}
+	}
+
+	return ans;
+}
+
+std::array<size_t, 2> Tuner::search(boc::kernel& kernel, size_t dims, const size_t* global)
+{
+	const size_t repeats = 3;
+
+	//The inputs of the kernel were written through the shared queue, which another queue does not wait for.
+	static boc::command_queue queue(Mat::context, Mat::device, boc::command_queue::enable_profiling);
+	Mat::queue.finish();
+
+	std::array<size_t, 2> best = { 0, 1 };
+	cl_ulong best_time = ~cl_ulong(0);
+
+	for (auto& local : candidates(kernel, dims, global))
+	{
+		cl_ulong time = 0;
+
+		try
+		{
+			//The first run is a warm up.
+			for (size_t i = 0; i <= repeats; ++i)
+			{
+				auto event = queue.enqueue_nd_range_kernel(kernel, dims, nullptr, global, local[0] ? local.data() : nullptr);
+				event.wait();
+
+				if (i)
+				{
+					time += event.get_profiling_info<cl_ulong>(CL_PROFILING_COMMAND_END) - event.get_profiling_info<cl_ulong>(CL_PROFILING_COMMAND_START);
+				}
+			}
+		}
+		catch (const boc::opencl_error&)
+		{
+			continue;//Rejected by the driver, for the resources the kernel needs.
+		}
+
+		if (time < best_time)
+		{
+			best = local;
+			best_time = time;
+		}
+	}
+
+	return best;
+}
+
+bool Tuner::local_size(const char* name, boc::kernel& kernel, size_t dims, const size_t* global, size_t* local)
+{
+	//Nothing to find and nothing to search: the key, which queries the name of the kernel, is not even built.
+	if (dims > 2 || (table().empty && !tuning()))
+	{
+		return false;
+	}
+
+	const std::string k = key(name, kernel, dims, global);
+	std::array<size_t, 2> ans = { 0, 1 };
+	bool found = false;
+
+	{
+		std::lock_guard<std::mutex> lock(table().mutex);
+		auto iter = table().entries.find(k);
+
+		if (iter != table().entries.end())
+		{
+			ans = iter->second;
+			found = true;
+		}
+	}
+
+	if (!found)
+	{
+		if (!tuning())
+		{
+			return false;
+		}
+
+		ans = search(kernel, dims, global);
+
+		std::lock_guard<std::mutex> lock(table().mutex);
+		table().entries[k] = ans;
+		table().empty = false;
+	}
+
+	if (ans[0] == 0 || global[0] % ans[0] || (dims == 2 && global[1] % ans[1]))
+	{
+		return false;
+	}
+
+	std::copy(ans.begin(), ans.begin() + dims, local);
+
+	return true;
+}
\ No newline at end of file
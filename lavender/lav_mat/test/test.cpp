@@ -0,0 +1,133 @@
+/* ************************************************************************
+ * Copyright 2020 Rihothy.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ************************************************************************/
+
+/* ************************************************************************
+ * Author        : (Rihothy)
+ * File name     : test.cpp
+ * Version       : 1.0
+ * Last modified : 2026-10-18
+ * Describe      : Regression cases for behaviours that are easy to break
+ *                 without noticing, each a function that throws with a
+ *                 message on the first wrong value. Run by ctest, from the
+ *                 build directory where the cases write their fixtures.
+ *
+ *                 lav_mat_test [--filter text]
+ *
+ * See https://github.com/rihothy/lav_mat to get source code.
+ * ************************************************************************/
+
+#include <lav_mat.h>
+
+#include <functional>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+
+using namespace lav;
+
+static void check(bool condition, const std::string& message)
+{
+	if (!condition)
+	{
+		throw std::runtime_error(message);
+	}
+}
+
+static void check_values(const Mat& mat, size_t rows, size_t cols, const std::vector<float>& values, const std::string& name)
+{
+	check(mat.rows == rows && mat.cols == cols, name + ": Got a " + std::to_string(mat.rows) + "x" + std::to_string(mat.cols) + " matrix!");
+
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		check(mat(i / cols, i % cols) == values[i], name + ": Wrong value at " + std::to_string(i / cols) + ", " + std::to_string(i % cols) + "!");
+	}
+}
+
+//A delimiter ending a line does not start another column.
+static void test_load_txt_trailing_delimiter(void)
+{
+	const std::string path = "lav_mat_test_trailing.txt";
+
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << "1,2,3,\n4,5,6,\r\n";
+	}
+
+	Mat mat = load_txt(path, ',');
+	std::remove(path.c_str());
+
+	check_values(mat, 2, 3, { 1, 2, 3, 4, 5, 6 }, "load_txt");
+}
+
+//Appending a matrix on the VRAM moves the host one there; its stale RAM copy must not be read back.
+static void test_push_back_device_onto_host(void)
+{
+	Mat mat(2, 2, { 1, 2, 3, 4 }, false);
+	const Mat rows(1, 2, { 5, 6 }, true);
+
+	mat.push_back(rows);
+
+	check_values(mat, 3, 2, { 1, 2, 3, 4, 5, 6 }, "push_back");
+}
+
+int main(int argc, char* argv[])
+{
+	const std::vector<std::pair<std::string, std::function<void(void)>>> cases =
+	{
+		{ "load_txt_trailing_delimiter", test_load_txt_trailing_delimiter },
+		{ "push_back_device_onto_host", test_push_back_device_onto_host },
+	};
+
+	std::string filter;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+
+		if (arg == "--filter" && i + 1 < argc)
+		{
+			filter = argv[++i];
+		}
+		else
+		{
+			std::cerr << "Usage: " << argv[0] << " [--filter text]" << std::endl;
+			return 1;
+		}
+	}
+
+	size_t failures = 0;
+
+	for (auto& [name, test] : cases)
+	{
+		if (!filter.empty() && name.find(filter) == std::string::npos)
+		{
+			continue;
+		}
+
+		try
+		{
+			test();
+			std::cerr << "passed " << name << std::endl;
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "FAILED " << name << ": " << e.what() << std::endl;
+			failures += 1;
+		}
+	}
+
+	return failures ? 1 : 0;
+}
\ No newline at end of file